@@ -0,0 +1,109 @@
+/*
+ * archive.h - object archive header
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include "digest.h"
+
+/*
+ * with --archive, finished files are appended to a segment, NNN-SSSSSS.nfa,
+ * instead of each getting one of their own.  the segment's index,
+ * NNN-SSSSSS.nfi, is a header and then a fixed size record for each file
+ * in the order they went in.  both are only ever appended to.  everything
+ * is in host byte order, except the addresses and ports, which are as
+ * they came off the wire.  with --compress, a segment that's done is 
+ * rewritten as NNN-SSSSSS.nfz with its files compressed one by one, and
+ * its index is replaced by one that says so and where they are now.
+ */
+#define ARCHIVE_MAGIC       "NFXI"
+#define ARCHIVE_VERSION     2
+#define ARCHIVE_SEGMENT     ".nfa"
+#define ARCHIVE_PACKED      ".nfz"
+#define ARCHIVE_INDEX       ".nfi"
+#define ARCHIVE_FD          -2      /** an extraction's fd when it's staged */
+#define ARCHIVE_STAGE_MIN   4096    /** where staging buffers start */
+#define ARCHIVE_EXT_LEN     10
+#define ARCHIVE_NAME_LEN    256
+#define ARCHIVE_QUEUE       64      /** segments waiting to be compressed */
+
+/** how a file's stored in its segment */
+#define ARCHIVE_RAW         0
+#define ARCHIVE_ZSTD        1
+#define ARCHIVE_LZ4         2
+
+/** archive_header_t flags */
+#define ARCHIVE_F_PACKED    0x01    /** the files are in the .nfz */
+
+struct archive_header
+{
+    char magic[4];                  /* ARCHIVE_MAGIC */
+    uint32_t version;               /* ARCHIVE_VERSION */
+    uint32_t record;                /* sizeof (archive_record_t) */
+    uint32_t flags;                 /* ARCHIVE_F_* */
+};
+typedef struct archive_header archive_header_t;
+
+/** one file in the segment */
+struct archive_record
+{
+    uint64_t id;                    /* what its file number would've been */
+    uint64_t offset;                /* where it starts in the segment */
+    uint64_t length;
+    uint64_t stored;                /* bytes it takes up there */
+    uint32_t ts_sec;                /* packet time it started */
+    uint32_t ts_usec;
+    uint32_t ip_src;
+    uint32_t ip_dst;
+    uint16_t port_src;
+    uint16_t port_dst;
+    uint8_t digests;                /* which of the DIGEST_* are filled in */
+    uint8_t complete;               /* we saw the end of it */
+    uint8_t codec;                  /* ARCHIVE_RAW, _ZSTD or _LZ4 */
+    uint8_t nopack;                 /* its type isn't worth compressing */
+    char ext[ARCHIVE_EXT_LEN];      /* its type, NUL terminated */
+    uint8_t md5[MD5_LEN];
+    uint8_t sha1[SHA1_LEN];
+    uint8_t sha256[SHA256_LEN];
+    uint8_t pad[2];
+};
+typedef struct archive_record archive_record_t;
+
+/** the segment a profile is filling */
+struct archive
+{
+    int fd;                         /* the segment, -1 if there isn't one */
+    int ifd;                        /* and its index */
+    uint64_t size;                  /* bytes in it so far */
+    uint32_t seq;                   /* its number */
+    char name[ARCHIVE_NAME_LEN];    /* and what it's called, less suffix */
+};
+typedef struct archive archive_t;
+
+/*
+ * finished segments waiting to be compressed, and the child compressing
+ * one, which says on the way out what it got them down to
+ */
+struct archive_packer
+{
+    int codec;                      /* --compress, ARCHIVE_RAW for none */
+    pid_t pid;                      /* the child at it, 0 if none */
+    int fd;                         /* where it reports */
+    char *queue[ARCHIVE_QUEUE];     /* the segments after it */
+    int head;
+    int n;
+    uint64_t in;                    /* bytes it's been given */
+    uint64_t out;                   /* and what they came to */
+    uint32_t segments;              /* how many have been done */
+};
+typedef struct archive_packer archive_packer_t;
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,40 @@
+/*
+ * compress.h - archive compression header
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include "config.h"
+#include "archive.h"
+
+#define COMPRESS_BUFFER_SIZE 65536  /** what's read and written at a time */
+#define COMPRESS_ZSTD_LEVEL  3      /** zstd's own default */
+#ifndef MIN
+#define MIN( x, y ) ((x) < (y) ? (x) : (y))
+#endif
+
+int compress_available(int);
+int64_t compress_object(int, archive_record_t *, int, int);
+int decompress_object(int, archive_record_t *, int, digest_t *);
+
+#if (HAVE_ZSTD || HAVE_LZ4)
+static int compress_put(int, const uint8_t *, size_t, uint64_t *);
+#endif /** HAVE_ZSTD || HAVE_LZ4 */
+#if (HAVE_ZSTD)
+static int64_t compress_zstd(int, archive_record_t *, int);
+static int decompress_zstd(int, archive_record_t *, int, digest_t *);
+#endif /** HAVE_ZSTD */
+#if (HAVE_LZ4)
+static int64_t compress_lz4(int, archive_record_t *, int);
+static int decompress_lz4(int, archive_record_t *, int, digest_t *);
+#endif /** HAVE_LZ4 */
+
+#endif /* COMPRESS_H */
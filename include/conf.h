@@ -33,5 +33,7 @@
 #define CONF_H
 
 extern void config_type(char *, char *, char *, char *, void *a);
+extern void config_option(char *, char *, void *a);
+extern char *config_cat(char *, char *);
 
 #endif /* CONF_H */
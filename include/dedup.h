@@ -0,0 +1,48 @@
+/*
+ * dedup.h - duplicate file header
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <inttypes.h>
+#include "digest.h"
+
+#define DEDUP_OFF       0
+#define DEDUP_LINK      1           /** repeats are links to the first copy */
+#define DEDUP_REF       2           /** repeats go, the index names the first */
+#define DEDUP_HT_SIZE   65536       /** buckets, by the digest's first bytes */
+#define DEDUP_MEM_SHARE 4           /** the table gets 1/4 of -m */
+
+/** a file we've kept, known by its contents */
+struct dedup_object
+{
+    struct dedup_object *next;
+    struct dedup_object *older;     /* by when it was last seen */
+    struct dedup_object *newer;
+    uint8_t digest[SHA256_LEN];     /* SHA-256 of what's in it */
+    uint64_t size;
+    char *path;                     /* where the copy we kept is */
+};
+typedef struct dedup_object dedup_object_t;
+
+struct dedup
+{
+    int mode;                       /* DEDUP_* */
+    dedup_object_t **ht;            /* every file kept, by digest */
+    dedup_object_t *oldest;         /* first to be forgotten */
+    dedup_object_t *newest;
+    uint32_t nobjects;
+    uint64_t limit;                 /* bytes it may take, 0 for no limit */
+    FILE *store;                    /* --dedup-store, or NULL */
+};
+typedef struct dedup dedup_t;
+
+#endif /* DEDUP_H */
@@ -0,0 +1,95 @@
+/*
+ * digest.h - message digest header
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#define MD5_LEN         16          /** bytes in an MD5 digest */
+#define SHA1_LEN        20          /** a SHA-1 */
+#define SHA256_LEN      32          /** a SHA-256 */
+#define DIGEST_BLOCK    64          /** all three work on 64 byte blocks */
+#define SHA256_BLOCK    DIGEST_BLOCK
+
+/** which digests an extraction gets */
+#define DIGEST_MD5      0x01
+#define DIGEST_SHA1     0x02
+#define DIGEST_SHA256   0x04
+/** room for them all in hex, ", " between */
+#define DIGEST_HEX_MAX  (2 * (MD5_LEN + SHA1_LEN + SHA256_LEN) + 5)
+
+/** an MD5 in progress (RFC 1321) */
+struct md5
+{
+    uint32_t h[4];
+    uint64_t len;
+    uint8_t buf[DIGEST_BLOCK];
+};
+typedef struct md5 md5_t;
+
+/** a SHA-1 in progress (FIPS 180-4) */
+struct sha1
+{
+    uint32_t h[5];
+    uint64_t len;
+    uint8_t buf[DIGEST_BLOCK];
+};
+typedef struct sha1 sha1_t;
+
+/** a SHA-256 in progress (FIPS 180-4) */
+struct sha256
+{
+    uint32_t h[8];                  /* chaining state */
+    uint64_t len;                   /* bytes hashed so far */
+    uint8_t buf[SHA256_BLOCK];      /* partial block waiting for more */
+};
+typedef struct sha256 sha256_t;
+
+/** whichever of them are wanted, fed the same bytes */
+struct digest
+{
+    int which;                      /* DIGEST_* */
+    md5_t md5;
+    sha1_t sha1;
+    sha256_t sha256;
+};
+typedef struct digest digest_t;
+
+/** and what they came to */
+struct digest_sum
+{
+    int which;                      /* DIGEST_* */
+    uint8_t md5[MD5_LEN];
+    uint8_t sha1[SHA1_LEN];
+    uint8_t sha256[SHA256_LEN];
+};
+typedef struct digest_sum digest_sum_t;
+
+void md5_init(md5_t *);
+void md5_update(md5_t *, const uint8_t *, size_t);
+void md5_final(md5_t *, uint8_t *);
+void sha1_init(sha1_t *);
+void sha1_update(sha1_t *, const uint8_t *, size_t);
+void sha1_final(sha1_t *, uint8_t *);
+void sha256_init(sha256_t *);
+void sha256_update(sha256_t *, const uint8_t *, size_t);
+void sha256_final(sha256_t *, uint8_t *);
+void digest_init(digest_t *, int);
+void digest_update(digest_t *, const uint8_t *, size_t);
+void digest_final(digest_t *, digest_sum_t *, char *);
+void digest_hex(const uint8_t *, size_t, char *);
+
+static void md5_block(md5_t *, const uint8_t *);
+static void sha1_block(sha1_t *, const uint8_t *);
+static void sha256_block(sha256_t *, const uint8_t *);
+static void digest_length(uint8_t *, uint64_t, int);
+
+#endif /* DIGEST_H */
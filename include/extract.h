@@ -33,13 +33,31 @@
 #define EXTRACT_H
 
 #include <sys/types.h>
+#include <sys/time.h>
 #include <inttypes.h>
 #include "search.h"
+#include "digest.h"
 
 #ifndef FILENAME_BUFFER_SIZE
 #define FILENAME_BUFFER_SIZE 4096
 #endif
 
+/** how hard a type with a poor yield is throttled */
+#define EXTRACT_NORMAL       0
+#define EXTRACT_SAMPLED      1      /* one candidate in 16 */
+#define EXTRACT_SUSPENDED    2      /* one in 256, enough to see it recover */
+#define EXTRACT_SAMPLE(l)    (1 << (4 * (l)))
+#define EXTRACT_JUDGE_WINDOW 64     /* candidates to a verdict */
+#define EXTRACT_DEMOTE_PCT   10     /* kept fewer than this, throttle harder */
+#define EXTRACT_PROMOTE_PCT  25     /* kept at least this, ease off */
+
+/** candidates are held in pooled buffers until they're worth a file */
+#define EXTRACT_COMMIT_MAX   (1024 * 1024)  /* biggest commit= */
+#define EXTRACT_POOL_MIN     10     /* smallest buffer is 1 KB */
+#define EXTRACT_POOL_N       11     /* and they double up to 1 MB */
+#define EXTRACT_POOL_KEEP    16     /* spares kept of each size */
+#define EXTRACT_POOL_SIZE(c) ((size_t)1 << ((c) + EXTRACT_POOL_MIN))
+
 struct extract_list
 {
     struct extract_list *next;
@@ -48,12 +66,36 @@ struct extract_list
     time_t timestamp;        /* update this guy everytime we touch him */
     int fd;                  /* file descriptor to write data to file */
     off_t nwritten;          /* number of bytes written */
+    off_t limit;             /* stop writing once we get this far */
     struct
     {                        /* this struct defines the area to be written */
         int start;
         int end;
     } segment;
     int finish;              /* set when a FOOTER is found */
+    int complete;            /* we know we got to the end of the file */
+    int rejected;            /* the validator threw it out */
+    int cut;                 /* ended from outside, it isn't judged */
+    uint32_t ip_src;         /* who it's from, for naming and indexing */
+    uint32_t ip_dst;
+    uint16_t port_src;
+    uint16_t port_dst;
+    uint8_t *pending;        /* held back until it's worth a file */
+    size_t npending;         /* bytes in pending */
+    size_t room;             /* how many it'll take */
+    int hold;                /* its pool size class */
+    int vetted;              /* the validator's passed it, or there's none */
+    struct timeval ts;       /* packet time it started, for the index */
+    char *path;              /* the file, kept if it's indexed at the end */
+    size_t name;             /* where the index's name for it starts */
+    digest_t *digest;        /* its digests, as it's written */
+    uint8_t *stage;          /* with --archive, all of it until it's done */
+    size_t nstage;
+    size_t stagesz;
+    resolve_t *resolve;      /* working out how long the file really is */
+    struct hash_table_node *session; /* the flow it's coming from */
+    struct extract_list *older;      /* everything extracting, by when */
+    struct extract_list *newer;      /* it started */
 };
 typedef struct extract_list extract_list_t;
 
@@ -0,0 +1,30 @@
+/*
+ * gen.h - generated scanner header
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#ifndef GEN_H
+#define GEN_H
+
+#include <stdio.h>
+#include "search.h"
+
+/*
+ * --emit-c writes the unanchored machines out as C, one function per
+ * machine with every state a label and every transition a goto.  built
+ * into a shared object and loaded with --scanner, these stand in for the
+ * table walk in search().  anchored machines are only ever walked a few
+ * bytes so they stay as tables.
+ */
+#define GEN_VERSION     1           /** bump when the generated ABI changes */
+#define GEN_MACHINES    2           /** HEADER, FOOTER */
+
+static srch_machine_t **gen_machine(srch_set_t *, int, char **);
+static void gen_state(FILE *, srch_machine_t *, uint32_t);
+static void gen_scanner(FILE *, srch_machine_t *, char *);
+
+#endif /* GEN_H */
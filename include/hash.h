@@ -20,10 +20,15 @@
 #include <inttypes.h>
 #include "search.h"
 #include "extract.h"
+#include "http.h"
 
-#define FNV_PRIME         0x811C9DC5
 #define SESSION_THRESHOLD 30        /** a session will stale out in 30s */
-#define NFEX_HT_SIZE      33211     /** randomly chosen largish prime */
+#ifndef NFEX_HT_BITS
+#define NFEX_HT_BITS      16        /** session table buckets, as a power of 2 */
+#endif
+#define NFEX_HT_SIZE      (1 << NFEX_HT_BITS)
+#define NFEX_HT_MASK      (NFEX_HT_SIZE - 1)
+#define NFEX_SYN_CACHE    4096      /** recent SYNs we remember */
 
 struct four_tuple
 {
@@ -34,14 +39,33 @@ struct four_tuple
 };
 typedef struct four_tuple four_tuple_t;
 
+/** where a recently opened stream starts, so we don't need a session */
+struct syn_cache
+{
+    four_tuple_t ft;                /* four tuple information */
+    uint32_t seq0;                  /* sequence number of stream offset 0 */
+};
+typedef struct syn_cache syn_cache_t;
+
 struct hash_table_node
 {
     four_tuple_t ft;                /* four tuple information */
     time_t timestamp;               /* the last time a packet was seen */
-    srchptr_list_t *srchptr_list;   /* current search threads */
+    srch_set_t *set;                /* signatures this session started with */
+    uint32_t srch_state;            /* where the HEADER search is at */
+    uint32_t foot_state;            /* where the FOOTER search is at */
     extract_list_t *extract_list;   /* list of current files being extracted */
+    http_state_t *http;             /* HTTP parser, if we're following one */
+    srch_anchor_t *anchor;          /* stream anchored search in progress */
+    uint8_t *carry;                 /* last bytes, while a HEADER's partway */
+    uint32_t ncarry;                /* how many of them there are */
+    uint32_t carrysz;               /* and room for */
+    int has_seq0;                   /* we know where the stream starts */
+    uint32_t seq0;                  /* sequence number of stream offset 0 */
     struct hash_table_node *next;   /* next entry in the list */
     struct hash_table_node *prev;   /* prev entry in the list */
+    struct hash_table_node *older;  /* seen less recently */
+    struct hash_table_node *newer;  /* seen more recently */
 };
 typedef struct hash_table_node ht_node_t;
 
@@ -0,0 +1,58 @@
+/*
+ * http.h - HTTP/1.x message framing header
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include "search.h"
+#include "extract.h"
+
+#define HTTP_LINE_MAX     1024      /** longest header line we keep */
+#define HTTP_PIPELINE     16        /** requests remembered for responses */
+
+/** request methods whose responses frame differently */
+#define HTTP_M_OTHER      0
+#define HTTP_M_HEAD       1         /* response never has a body */
+#define HTTP_M_CONNECT    2         /* a 2xx response has none, a tunnel */
+
+/** parser states, one parser per direction of a flow */
+enum http_pstate
+{
+    HTTP_IDLE,                      /* between messages */
+    HTTP_HEADERS,                   /* reading header lines */
+    HTTP_BODY,                      /* Content-Length delimited body */
+    HTTP_BODY_CLOSE,                /* body delimited by connection close */
+    HTTP_CHUNK_SIZE,                /* reading a chunk size line */
+    HTTP_CHUNK_DATA,                /* reading chunk data */
+    HTTP_CHUNK_CRLF,                /* reading the CRLF after chunk data */
+    HTTP_TRAILERS                   /* reading trailers after the last chunk */
+};
+typedef enum http_pstate http_pstate_t;
+
+struct http_state
+{
+    http_pstate_t state;            /* where we are in the message */
+    int response;                   /* message is a response */
+    int status;                     /* response status code */
+    int chunked;                    /* Transfer-Encoding: chunked */
+    int64_t clen;                   /* Content-Length, -1 if not given */
+    uint64_t remaining;             /* bytes left in the body or chunk */
+    char line[HTTP_LINE_MAX];       /* partial header or chunk size line */
+    uint16_t linelen;               /* bytes in line */
+    srch_anchor_t magic;            /* checking the start of the body */
+    extract_list_t *extract;        /* extraction being fed by this body */
+    uint8_t methods[HTTP_PIPELINE]; /* requests sent and not answered yet */
+    uint8_t mhead;
+    uint8_t mn;
+};
+typedef struct http_state http_state_t;
+
+#endif /* HTTP_H */
@@ -38,6 +38,8 @@
 #include <sys/resource.h>
 #include <termios.h>
 #include "hash.h"
+#include "dedup.h"
+#include "archive.h"
 #include "config.h"
 
 #if (HAVE_GEOIP)
@@ -55,6 +57,28 @@
 /** as we add more protocols this needs to change */
 #define NFEX_PCAP_FILTER "tcp"
 
+#ifndef NFEX_BATCH
+#define NFEX_BATCH 100      /** packets per pcap_dispatch(), searched together */
+#endif
+
+/** what the -m memory budget is spent on */
+#define NFEX_MEM_SESSIONS  0      /* session table entries and HTTP parsers */
+#define NFEX_MEM_SEARCH    1      /* anchored searches and length resolvers */
+#define NFEX_MEM_EXTRACT   2      /* extractions and data held for validation */
+#define NFEX_MEM_PACKETS   3      /* the batch's copies of packets */
+#define NFEX_MEM_DEDUP     4      /* files kept, by their contents */
+#define NFEX_MEM_N         5
+/** the flows' classes are the ones before DEDUP, ht_mem() adds these up */
+#define NFEX_MEM_FLOW_N    NFEX_MEM_DEDUP
+
+/** where files go, -o can be given this many times */
+#define NFEX_OUTPUT_MAX    8
+#define NFEX_LAYOUT_TIME   0x01   /* YYYY/MM/DD/HH/ of when it started */
+#define NFEX_LAYOUT_HASH   0x02   /* one of 256 dirs, by file id */
+#define NFEX_SPREAD_RR     0      /* -o dirs take turns */
+#define NFEX_SPREAD_SPACE  1      /* the one with the most room */
+#define NFEX_SPREAD_CHECK  64     /* files between looks at free space */
+
 /* BEGIN MACROS */
 /** simple way to subtract timeval based timers */
 #define PTIMERSUB(tvp, uvp, vvp)                                             \
@@ -72,6 +96,16 @@
 #ifndef MAX
 #define MAX( x, y ) ((x) > (y) ? (x) : (y))
 #endif
+#ifndef MIN
+#define MIN( x, y ) ((x) < (y) ? (x) : (y))
+#endif
+
+/** start pulling something into the cache we'll want shortly */
+#if defined(__GNUC__)
+#define NFEX_PREFETCH(p) __builtin_prefetch((p))
+#else
+#define NFEX_PREFETCH(p)
+#endif
 /* END MACROS */
 
 /** statistics */
@@ -86,12 +120,100 @@ struct nfex_statistics
     uint32_t ht_nc;                   /* hash table: non-chained entries */
     uint32_t ht_ic;                   /* hash table: chained entries */
     uint32_t ht_lc;                   /* hash table: longest chain */
+    uint32_t ht_stateless;            /* packets handled without a session */
+    uint32_t http_msgs;               /* HTTP messages parsed */
+    uint64_t http_bypassed;           /* HTTP body bytes skipped unscanned */
+    uint32_t validate_rejects;        /* candidates that failed validation */
+    uint32_t validate_expired;        /* and that timed out before a verdict */
+    uint32_t validate_skipped;        /* dropped, no memory to hold for one */
+    uint32_t resolved;                /* files cut to their real length */
+    uint32_t reloads;                 /* signature reloads swapped in */
+    uint32_t rescans;                 /* batch searches that guessed wrong */
+    uint32_t evicted_idle;            /* sessions dropped for memory */
+    uint32_t evicted_extracting;      /* and ones that had files going */
+    uint32_t shed_flow;               /* extractions refused, flow at its cap */
+    uint32_t shed_type;               /* type at its cap */
+    uint32_t shed_rate;               /* type over its rate */
+    uint32_t shed_global;             /* everything at -x, nothing to bump */
+    uint32_t preempted;               /* closed early to make room */
+    uint32_t shed_yield;              /* type throttled for its junk */
+    uint32_t uncommitted;             /* candidates dropped short of commit= */
+    uint32_t dups;                    /* files we already had */
+    uint64_t dup_bytes;               /* and what they'd have taken up */
+    uint32_t dedup_forgotten;         /* kept files dropped from the table */
+    uint32_t segments;                /* --archive segments started */
+    uint64_t archived;                /* bytes appended to them */
     struct timeval ts_start;          /* total uptime timestamp */
     struct timeval ts_last;           /* last file extracted timestamp */
     uint32_t ip_last;                 /* last packet seen ip */
 };
 typedef struct nfex_statistics n_stats_t;
 
+/** the -c files, each is a profile with its own signatures and output */
+struct nfex_conf
+{
+    char *fname[SRCH_PROFILE_MAX];    /* config file or signature image */
+    char *dir[SRCH_PROFILE_MAX];      /* its own output dir, or NULL */
+    int n;
+};
+typedef struct nfex_conf nfex_conf_t;
+
+/** the -o directories, and how files are laid out under them */
+struct nfex_output
+{
+    char dir[NFEX_OUTPUT_MAX][128];   /* each with a trailing / */
+    int n;
+    int layout;                       /* NFEX_LAYOUT_* */
+    int spread;                       /* NFEX_SPREAD_* */
+    uint64_t segment;                 /* --archive segment size, 0 if off */
+    int codec;                        /* --compress, ARCHIVE_RAW for none */
+};
+typedef struct nfex_output nfex_output_t;
+
+/** one of a profile's output directories */
+struct nfex_outdir
+{
+    char path[128];                   /* output directory prefix */
+    char bucket[32];                  /* time subdir we last made in it */
+    uint8_t made[32];                 /* hash subdirs made, as bits */
+    uint64_t avail;                   /* free bytes at the last look */
+};
+typedef struct nfex_outdir nfex_outdir_t;
+
+/** where a profile's files go */
+struct nfex_profile
+{
+    nfex_outdir_t dir[NFEX_OUTPUT_MAX]; /* first one holds the index */
+    int ndirs;
+    int next;                         /* whose turn it is */
+    char indexfname[128];
+    FILE *indexfp;
+    uint32_t files;                   /* files extracted for it */
+    archive_t archive;                /* with --archive, where they go */
+};
+typedef struct nfex_profile nfex_profile_t;
+
+/** a packet waiting in the batch, copied out of pcap's buffer */
+struct nfex_packet
+{
+    struct pcap_pkthdr header;        /* as pcap gave it to us */
+    uint8_t *data;                    /* the packet */
+    uint32_t size;                    /* bytes allocated for it */
+    uint8_t *payload;                 /* TCP payload, NULL if none */
+    int32_t payload_size;
+    four_tuple_t ft;                  /* its flow */
+    uint32_t hash;                    /* and where it is in the session table */
+    uint32_t seq;
+    int syn;                          /* starts a stream */
+    int fin;                          /* or ends one, FIN or RST */
+    int round;                        /* batch search round, -1 if none */
+    int prev;                         /* the flow's packet a round before */
+    int scanned;                      /* lane holds its HEADER search */
+    uint32_t state0;                  /* which started from here */
+    srch_lane_t lane;
+};
+typedef struct nfex_packet nfex_packet_t;
+
 /** monolithic opaque control context, everything imporant is here */
 struct nfex_control_context
 {
@@ -99,24 +221,48 @@ struct nfex_control_context
     int pcap_fd;                      /* pcap fd used to select across */
     char *device;                     /* pcap device */
     ht_node_t *ht[NFEX_HT_SIZE];      /* our hash table of sessions */
+    uint64_t ht_key[4];               /* its secret hash key */
+    ht_node_t *ht_oldest;             /* sessions by when they were last */
+    ht_node_t *ht_newest;             /* seen, for expiry and eviction */
+    uint64_t mem[NFEX_MEM_N];         /* bytes held, by NFEX_MEM_* */
+    uint64_t mem_limit;               /* -m budget for them, 0 for none */
+    extract_list_t *extract_oldest;   /* every extraction in progress, */
+    extract_list_t *extract_newest;   /* by when it started */
+    uint32_t extracting;              /* how many there are */
+    uint32_t max_extracts;            /* -x cap on them, 0 for none */
+    uint32_t max_flow_extracts;       /* -X cap on a single flow's */
+    uint8_t *pool[EXTRACT_POOL_N];    /* spare hold buffers, by size */
+    uint32_t npool[EXTRACT_POOL_N];
     ht_node_t *session;               /* current session in focus */
-    srch_node_t *srch_machine;
+    nfex_packet_t batch[NFEX_BATCH];  /* packets from this pcap_dispatch() */
+    int nbatch;
+    srch_set_t *set;                  /* current signatures */
+    fileid_tally_t *tallies;          /* every type's numbers, across reloads */
+    pid_t reload_pid;                 /* signature rebuild in progress */
+    int reload_fd;                    /* readable once the rebuild is done */
+    char reload_image[FILENAME_BUFFER_SIZE]; /* the rebuild's image */
+    char scanfname[128];              /* generated scanner, if any */
+    syn_cache_t syn_cache[NFEX_SYN_CACHE]; /* where recent streams start */
     struct termios term;              /* save terminal info to restore later */
     uint16_t flags;                   /* control context flags */
 #define NFEX_VERBOSE       0x0001     /* toggle verbosity */
 #define NFEX_GEOIP         0x0002     /* toggle geoIP mode */
 #define NFEX_DEBUG         0x0004     /* debug mode */
 #define NFEX_SESSIONS_LOCK 0x0008     /* locked, don't go in here */
+#define NFEX_HTTP          0x0010     /* follow HTTP/1.x message framing */
     FILE *log;                        /* logfile FILE descriptor */
 #if (HAVE_GEOIP)
     GeoIP *gi;                        /* geoip database pointer */
     char geoip_data[128];             /* geoip database path */
 #endif /** HAVE_GEOIP */
-    char yyinfname[128];
-    char output_dir[128];             /* output directory prefix */
-    u_int16_t filenum;                /* number of files we've written */
-    char indexfname[128];
-    FILE *indexfp;
+    nfex_conf_t conf;                 /* where the signatures come from */
+    nfex_output_t output;             /* -o and friends */
+    nfex_profile_t profile[SRCH_PROFILE_MAX]; /* by the set's profiles */
+    uint32_t nprofiles;
+    uint64_t filenum;                 /* id of the last file we wrote */
+    dedup_t dedup;                    /* files kept, by their contents */
+    archive_packer_t packer;          /* finished segments to compress */
+    int digests;                      /* --hashes for the index, DIGEST_* */
     char capfname[128];               /* pcap capture file name */
     off_t capfsize;                   /* size of capfile */
     n_stats_t stats;                  /* stats */
@@ -126,15 +272,49 @@ typedef struct nfex_control_context ncc_t;
 
 /** call back when we have a packet */
 void process_packet(u_char *, const struct pcap_pkthdr *, const u_char *);
+void packet_flush(ncc_t *);
+static void packet_parse(ncc_t *, nfex_packet_t *);
+static void packet_warm(ncc_t *);
+static void packet_prescan(ncc_t *);
+static srch_results_t *packet_search(ncc_t *, nfex_packet_t *, 
+srch_machine_t *, uint32_t *);
+static void packet_process(ncc_t *, nfex_packet_t *);
+static void packet_carry(ht_node_t *, const uint8_t *, size_t, ncc_t *);
 void quit_signal(int);
 
 /** initialization functions */
-ncc_t *control_context_init(char *, char *, char *, char *, char *, char *,
-uint16_t, char *);
+ncc_t *control_context_init(nfex_output_t *, nfex_conf_t *, char *, char *, char *,
+char *, uint16_t, char *);
 void control_context_destroy(ncc_t *);
+int config_load(srch_set_t *, nfex_conf_t *);
+static int profile_init(ncc_t *);
+
+/** signature set and image functions */
+srch_set_t *sigs_new();
+void sigs_hold(srch_set_t *);
+void sigs_release(srch_set_t *);
+int sigs_compile(nfex_conf_t *, char *);
+int sigs_bench(nfex_conf_t *);
+int sigs_write(srch_set_t *, char *);
+int sigs_load(srch_set_t *, char *);
+int sigs_probe(char *);
+
+/** generated scanner functions */
+int gen_compile(nfex_conf_t *, char *);
+int gen_emit(srch_set_t *, char *, char *);
+int gen_load(srch_set_t *, char *);
+void gen_free(srch_set_t *);
+
+/** signature reload functions */
+void reload_init(ncc_t *);
+void reload_signal(int);
+void reload_start(ncc_t *);
+int reload_poll(ncc_t *, int);
+void reload_stop(ncc_t *);
 
 /** main loop functions */
 int the_game(ncc_t *);
+int soak(ncc_t *, char *, int);
 int process_keypress(ncc_t *);
 
 /**
@@ -180,12 +360,58 @@ ncc_t *);
 static void set_segment_marks(extract_list_t *, size_t);
 static void mark_footer(extract_list_t *, srch_results_t *);
 static void extract_segment(extract_list_t *, const uint8_t *, ncc_t *);
-static void sweep_extract_list(extract_list_t **);
-static  int open_extract(char *ext, uint32_t src_ip, uint16_t src_prt, 
-                         uint32_t dst_ip, uint16_t dst_prt, char **fname,
-                         ncc_t *);
+static void sweep_extract_list(extract_list_t **, ncc_t *);
+static int extract_admit(fileid_t *, ht_node_t *, ncc_t *);
+static void extract_shed(extract_list_t *, ncc_t *);
+static void extract_judge(extract_list_t *, ncc_t *);
+static int extract_commit(extract_list_t *, ncc_t *);
+static int extract_pending(extract_list_t *, int, ncc_t *);
+static uint8_t *extract_hold(extract_list_t *, size_t, ncc_t *);
+static void extract_release(extract_list_t *, ncc_t *);
+static int open_extract(fileid_t *, struct timeval *, char **, ncc_t *);
+static int extract_path(nfex_outdir_t *, struct timeval *, char *, ncc_t *);
 void extract(extract_list_t **elist, srch_results_t *results, 
              ht_node_t *session, const uint8_t *data, size_t size, ncc_t *ncc);
+extract_list_t *extract_open(extract_list_t **, fileid_t *, ht_node_t *, 
+                             ncc_t *);
+void extract_dump_types(ncc_t *);
+void extract_tally(srch_set_t *, ncc_t *);
+void extract_tally_free(ncc_t *);
+void extract_pool_free(ncc_t *);
+void extract_write(extract_list_t *, const uint8_t *, size_t, ncc_t *);
+void extract_close(extract_list_t **, extract_list_t *, ncc_t *);
+uint32_t extract_mask(extract_list_t *, srch_results_t *);
+void extract_index(extract_list_t *, char *, char *, ncc_t *);
+nfex_outdir_t *extract_dir(nfex_profile_t *, ncc_t *);
+static ssize_t extract_put(extract_list_t *, const uint8_t *, size_t, 
+ncc_t *);
+static void extract_done(extract_list_t *, ncc_t *);
+
+/** object archive functions */
+void archive_put(extract_list_t *, digest_sum_t *, ncc_t *);
+void archive_close(archive_t *, archive_packer_t *);
+int archive_nopack(char *);
+int archive_poll(ncc_t *, int);
+void archive_stop(ncc_t *);
+static int archive_roll(nfex_profile_t *, ncc_t *);
+static int archive_pack(char *, int, uint64_t *);
+
+/** duplicate file functions */
+int dedup_init(ncc_t *, int, char *);
+void dedup_file(extract_list_t *, char *, uint8_t *, ncc_t *);
+void dedup_free(ncc_t *);
+static dedup_object_t *dedup_lookup(dedup_t *, uint8_t *);
+static dedup_object_t *dedup_add(ncc_t *, uint8_t *, uint64_t, char *);
+static void dedup_touch(dedup_t *, dedup_object_t *);
+static void dedup_forget(ncc_t *);
+
+/** http framing functions */
+int http_sniff(const uint8_t *, size_t);
+http_state_t *http_new(ncc_t *);
+void http_free(ht_node_t *, ncc_t *);
+int http_idle(http_state_t *);
+void http_fin(ht_node_t *, ncc_t *);
+int http_process(ht_node_t *, const uint8_t *, size_t, ncc_t *);
 
 /** misc functions */
 #define NFEX_STATS_UPDATE   0
@@ -196,12 +422,25 @@ void quit_signal(int sig);
 void print_hex(uint8_t *, uint16_t);
 void convert_seconds(uint32_t, uint32_t *, uint32_t *, uint32_t *, 
                      uint32_t *);
+void proc_usage(long *, int *);
+int mkpath(char *, size_t);
 
 /** session table functions */
 ht_node_t *ht_insert(four_tuple_t *ft, ncc_t *ncc);
 ht_node_t *ht_find(four_tuple_t *ft, ncc_t *ncc);
-uint16_t ht_hash(four_tuple_t *ft);
-uint32_t ht_count_extracts(ncc_t *ncc);
+ht_node_t *ht_lookup(four_tuple_t *ft, uint32_t n, ncc_t *ncc);
+void ht_remove(ht_node_t *p, ncc_t *ncc);
+void ht_shutitdown(ncc_t *ncc);
+static void ht_link(ht_node_t *p, ncc_t *ncc);
+static void ht_unlink(ht_node_t *p, ncc_t *ncc);
+void ht_govern(ncc_t *ncc);
+uint64_t ht_mem(ncc_t *ncc);
+void ht_syn_add(four_tuple_t *ft, uint32_t seq0, ncc_t *ncc);
+int64_t ht_stream_offset(ht_node_t *p, four_tuple_t *ft, uint32_t seq, 
+                         ncc_t *ncc);
+uint32_t ht_hash(four_tuple_t *ft, ncc_t *ncc);
+static uint64_t ht_mix(uint64_t a, uint64_t b);
+void ht_seed(ncc_t *ncc);
 void ht_dump(ncc_t *ncc);
 void ht_free(ncc_t *ncc);
 void ht_status(ncc_t *ncc);
@@ -0,0 +1,67 @@
+/*
+ * resolve.h - file length resolution header
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#define RESOLVE_FIELD_MAX   64      /** biggest field a resolver asks for */
+#define RESOLVE_FAIL        -1      /** length for a resolver that gave up */
+
+/** a length resolver in progress, one per extraction */
+struct resolve
+{
+    /** called once the field asked for has been read */
+    void (*step)(struct resolve *);
+    /** or, for formats that have to be scanned, called on every run */
+    void (*scan)(struct resolve *, const uint8_t *, size_t, off_t);
+    off_t want;                     /* file offset of the field we're after */
+    size_t wantlen;                 /* how long it is */
+    uint8_t field[RESOLVE_FIELD_MAX];  /* the field as it's read */
+    size_t have;                    /* bytes of it read so far */
+    int state;                      /* where the resolver is at */
+    uint32_t n;                     /* resolver private counters */
+    uint32_t count;
+    off_t pos;                      /* resolver private offsets */
+    off_t base;
+    off_t end;
+    uint8_t m[3];                   /* partial pattern matches for scans */
+    off_t length;                   /* answer, 0 if unknown, or RESOLVE_FAIL */
+};
+typedef struct resolve resolve_t;
+
+/** sets up a resolver for a fresh extraction */
+typedef void (*resolve_start_t)(resolve_t *);
+
+struct resolver
+{
+    char *ext;                      /* file extension it applies to */
+    resolve_start_t start;          /* how to get it going */
+};
+typedef struct resolver resolver_t;
+
+resolve_start_t resolve_lookup(char *);
+void resolve_feed(resolve_t *, const uint8_t *, size_t, off_t);
+
+static void resolve_want(resolve_t *, off_t, size_t);
+static int resolve_match(const char *, uint8_t *, uint8_t);
+static void resolve_pe_start(resolve_t *);
+static void resolve_pe(resolve_t *);
+static void resolve_png_start(resolve_t *);
+static void resolve_png(resolve_t *);
+static void resolve_zip_start(resolve_t *);
+static void resolve_zip(resolve_t *);
+static void resolve_riff_start(resolve_t *);
+static void resolve_riff(resolve_t *);
+static void resolve_pdf_start(resolve_t *);
+static void resolve_pdf(resolve_t *, const uint8_t *, size_t, off_t);
+
+#endif /* RESOLVE_H */
@@ -34,14 +34,8 @@
 
 #include <sys/types.h>
 #include <inttypes.h>
-
-/** search node types */
-enum srch_nodetype
-{
-    TABLE,
-    COMPLETE
-} srch_nodetype;
-typedef enum srch_nodetype srch_nodetype_t;
+#include "validate.h"
+#include "resolve.h"
 
 /** specifier types */
 enum spectype
@@ -51,37 +45,222 @@ enum spectype
 } spectype;
 typedef enum spectype spectype_t;
 
-/** file identifier */
+/** where a HEADER is allowed to match */
+enum anchortype
+{
+    ANCHOR_NONE,      /* anywhere in the stream */
+    ANCHOR_STREAM,    /* at TCP stream offset 0 */
+    ANCHOR_BODY,      /* at HTTP body offset 0 */
+    ANCHOR_WITHIN     /* anywhere in the first window bytes of the stream */
+} anchortype;
+typedef enum anchortype anchortype_t;
+
+#define SRCH_ANCHOR_MAX 64  /** longest anchored HEADER we'll hold onto */
+
+/** masks of file types to search for, ids share bits past 32 */
+#define SRCH_ID_BIT(id)     (1U << ((id) & 31))
+#define SRCH_MASK_ALL       0xffffffffU
+
+#define SRCH_START      0               /** every machine starts here */
+#define SRCH_DEAD       0xffffffffU     /** anchored walk that can't match */
+#define SRCH_EMPTY      0xffffffffU     /** unowned slot in a compressed DFA */
+#ifndef SRCH_STATE_MAX
+#define SRCH_STATE_MAX  262144          /** cap on states per machine */
+#endif
+#ifndef SRCH_DENSE_MAX
+#define SRCH_DENSE_MAX  1024            /** biggest machine given a full table */
+#endif
+
+#define SRCH_PROFILE_MAX    16          /** -c files in one run */
+#define SRCH_PROFILE_NAME   32
+
+/** file identifier, one per line in the config file */
 struct fileid
 {
-    int id;           /* id number of search pattern */
-    char *ext;        /* file extension canonical type */
-    u_long maxlen;    /* maximum length of file */
-    size_t len;       /* the length of the HEADER or FOOTER */
+    int id;                 /* id number of search pattern */
+    char *ext;              /* file extension canonical type */
+    u_long maxlen;          /* maximum length of file */
+    anchortype_t anchor;    /* where the HEADER may match */
+    u_long window;          /* for ANCHOR_WITHIN */
+    validate_t validate;    /* format check before extracting, or NULL */
+    resolve_start_t resolve;/* works out the real length, or NULL */
+    int profile;            /* which profile it extracts for */
+    uint32_t max;           /* extracting at once at most, 0 for any */
+    uint32_t rate;          /* new extractions a second, 0 for any */
+    uint32_t burst;         /* how many of those may come at once */
+    int priority;           /* higher ones are shed last under load */
+    uint32_t commit;        /* bytes held before it gets a file, 0 for none */
+    int footer;             /* has a FOOTER to finish on */
+    int nothrottle;         /* never throttled for its yield */
+    int nopack;             /* not worth compressing in the archive */
+    struct fileid_tally *tally; /* how it's doing, see extract_tally() */
 };
 typedef struct fileid fileid_t;
 
-/** the compiled form of a set of search keywords */
-struct srch_node
+/*
+ * what a file type has been up to since we started.  it's kept apart from
+ * the fileid, which a reload replaces, so the type's caps, rate bucket and
+ * yield carry over to its new fileid and the old set's extractions still
+ * count against them.  a type is known by profile, ext and which of the 
+ * profile's lines for that ext it is.
+ */
+struct fileid_tally
+{
+    struct fileid_tally *next;
+    char *ext;
+    int profile;
+    int nth;
+    uint32_t active;        /* extracting right now */
+    uint64_t tokens;        /* rate's bucket, in millionths */
+    uint64_t refilled;      /* packet time it was last topped up, usec */
+    int level;              /* EXTRACT_NORMAL, _SAMPLED or _SUSPENDED */
+    uint32_t hits;          /* HEADERs that wanted an extraction */
+    uint32_t refused;       /* and didn't get one */
+    uint32_t kept;          /* extractions that panned out */
+    uint32_t junk;          /* and ones that didn't */
+    uint32_t files;         /* files written */
+    uint64_t bytes;         /* and their size all together */
+    uint32_t wkept;         /* kept, and */
+    uint32_t wjudged;       /* judged, since its level last changed */
+};
+typedef struct fileid_tally fileid_tally_t;
+
+/** the set of bytes one position of a pattern takes */
+typedef uint8_t srch_class_t[32];
+
+#define SRCH_CLASS_SET(c, b)    ((c)[(b) >> 3] |= 1 << ((b) & 7))
+#define SRCH_CLASS_ISSET(c, b)  ((c)[(b) >> 3] & (1 << ((b) & 7)))
+
+/** a HEADER or FOOTER from the config file, waiting to be built */
+struct srch_pattern
 {
-    srch_nodetype_t nodetype;          /* node type */
+    struct srch_pattern *next;         /* next pattern in the machine */
+    fileid_t *fileid;                  /* who it belongs to */
     spectype_t spectype;               /* specifier type */
-    union
-    {
-        struct srch_node *table[256];  /* table of search node pointers */
-        fileid_t fileid;               /* or a file identifier */
-    } data;
+    char *spec;                        /* as written, for diagnostics */
+    size_t len;                        /* number of positions */
+    srch_class_t *class;               /* what each position takes */
+    uint32_t base;                     /* first NFA position number */
+};
+typedef struct srch_pattern srch_pattern_t;
+
+/*
+ * a pattern that's complete on entering a state.  a state's matches sit
+ * next to each other in the machine's match array, the last one is 
+ * flagged.  these are written out to signature images as is.
+ */
+struct srch_match
+{
+    uint32_t fileid;                   /* index into the fileid table */
+    uint32_t spectype;                 /* specifier type */
+    uint32_t len;                      /* the length of the HEADER or FOOTER */
+    uint32_t last;                     /* last match for its state */
+};
+typedef struct srch_match srch_match_t;
+
+/*
+ * a scanner generated from a machine by --emit-c.  it runs the DFA from
+ * *state over len bytes and stops just after a byte that enters a state
+ * with matches, returning how many bytes it took.
+ */
+typedef size_t (*srch_scan_t)(uint32_t *, const uint8_t *, size_t);
+
+/*
+ * the compiled form of a set of search keywords.  patterns are collected
+ * as the config file is read, then built into a DFA in one go.  the DFA
+ * is one table lookup per byte no matter how many patterns or wildcards
+ * are in it.
+ *
+ * a full 256 entry row per state is only kept for small machines.  big
+ * ones are row compressed the way lex does it: a state's row is stored as
+ * the handful of bytes where it differs from a default state's row, packed
+ * into the shared next/check arrays at base.  a byte whose slot isn't 
+ * owned by the state (check) is looked up in the default state instead.
+ * defaults are always lower numbered and the start state's row is stored 
+ * whole, so the walk ends.  for plain strings a state's default is its 
+ * Aho-Corasick failure state and the rows cost about one slot per pattern
+ * byte.
+ */
+struct srch_machine
+{
+    srch_pattern_t *patterns;          /* what goes in it */
+    srch_pattern_t **last;             /* where the next one goes */
+    uint32_t npos;                     /* NFA positions across all patterns */
+    int anchored;                      /* matches only from the first byte */
+    uint32_t nstates;                  /* DFA states */
+    uint32_t (*table)[256];            /* DFA transitions, if a full table */
+    uint32_t *base;                    /* else, where each row sits */
+    uint32_t *def;                     /* the state each row defaults to */
+    uint32_t *next;                    /* transitions, by base + byte */
+    uint32_t *check;                   /* the state each slot belongs to */
+    uint32_t ncomb;                    /* slots in next and check */
+    uint32_t *match;                   /* per state, 1 + its first match */
+    srch_match_t *matches;             /* all the matches, by state */
+    uint32_t nmatches;
+    uint32_t maxlen;                   /* longest match, in bytes */
+    fileid_t **fileids;                /* what match fileids refer to */
+    int mapped;                        /* tables live in a signature image */
+    srch_scan_t scan;                  /* generated scanner, or NULL */
+};
+typedef struct srch_machine srch_machine_t;
+
+/*
+ * a whole set of signatures: the file types from the config files (or
+ * image) and the machines built from them.  each config file is a profile
+ * with its own output, its file types all go in the same machines and 
+ * matches find their way back to it through the fileid.  the control context holds
+ * the current set and every session holds the set it started with, so a
+ * reload can swap in a new one while flows in the middle of something
+ * finish on the old one.  a set goes once nobody holds it.
+ */
+struct srch_set
+{
+    fileid_t **fileids;                /* every file type, indexed by id */
+    uint32_t nfileids;
+    char profile[SRCH_PROFILE_MAX][SRCH_PROFILE_NAME]; /* profile names */
+    uint32_t nprofiles;
+    srch_machine_t *srch_machine;      /* unanchored HEADERs */
+    srch_machine_t *foot_machine;      /* FOOTERs, only run while extracting */
+    srch_machine_t *strm_machine;      /* HEADERs anchored to stream start */
+    srch_machine_t *body_machine;      /* HEADERs checked at HTTP body start */
+    uint32_t anch_depth;               /* how far into a stream anchors reach */
+    void *image;                       /* mapped signature image, if any */
+    size_t image_size;
+    void *gen;                         /* generated scanner handle, if any */
+    uint32_t refs;                     /* holders, the context and sessions */
+};
+typedef struct srch_set srch_set_t;
+
+/** an anchored search in progress, the bytes walked are kept */
+struct srch_anchor
+{
+    srch_machine_t *machine;           /* machine walked, NULL if dead */
+    uint32_t state;                    /* where the walk is at */
+    uint8_t prefix[SRCH_ANCHOR_MAX];   /* bytes walked so far */
+    uint16_t len;                      /* bytes in prefix */
 };
-typedef struct srch_node srch_node_t;
+typedef struct srch_anchor srch_anchor_t;
 
-/** the list of concurrent search threads */
-struct srchptr_list
+/** scratch space for search_build(), DFA states as sets of NFA positions */
+struct srch_build
 {
-    struct srchptr_list *next;         /* next entry in the list */
-    struct srchptr_list *prev;         /* prev entry in the list */
-    srch_node_t *node;                 /* a search node set */
+    srch_pattern_t **pos;              /* which pattern each position is in */
+    uint32_t *start[256];              /* positions entered from nowhere */
+    uint32_t nstart[256];
+    uint32_t *pool;                    /* every state's position set */
+    uint32_t npool;
+    uint32_t poolsize;
+    uint32_t *set;                     /* per state, where its set starts */
+    uint32_t *setlen;                  /* per state, how big it is */
+    uint32_t *hash;                    /* state numbers by set, 0 is empty */
+    uint32_t hashsize;
+    uint32_t size;                     /* states allocated for */
+    uint32_t *par;                     /* per state, the state it came from */
+    uint8_t *parc;                     /* and the byte it came on */
+    uint32_t combsize;                 /* slots allocated in next and check */
+    uint32_t lofree;                   /* no free slots below this */
 };
-typedef struct srchptr_list srchptr_list_t;
+typedef struct srch_build srch_build_t;
 
 struct srch_results
 {
@@ -97,18 +276,68 @@ struct srch_results
 };
 typedef struct srch_results srch_results_t;
 
-void search_compile(srch_node_t **, int, char *, u_long, char *, spectype_t);
-extern srch_results_t *search(srch_node_t *, srchptr_list_t **, uint8_t *, 
-size_t);
+/** one buffer in a batch search */
+struct srch_lane
+{
+    srch_machine_t *machine;           /* what to search it with */
+    uint32_t state;                    /* where to start, then where it ended */
+    uint8_t *buf;
+    size_t len;
+    srch_results_t *results;           /* what turned up */
+};
+typedef struct srch_lane srch_lane_t;
+
+#ifndef SRCH_LANES
+#define SRCH_LANES          8           /** buffers walked at once */
+#endif
+#define SRCH_BENCH_BATCH    64          /** packets per batch for --bench */
+
+/** for search_lanes(), one compressed step and lane k's matches */
+#define SRCH_LANE_STEP(s, c)                                                 \
+    do                                                                       \
+    {                                                                        \
+        while (check[base[s] + (c)] != (s))                                  \
+        {                                                                    \
+            (s) = def[s];                                                    \
+        }                                                                    \
+        (s) = next[base[s] + (c)];                                           \
+    } while (0)
+
+#define SRCH_LANE_MATCH(k)                                                   \
+    if (match[s ## k])                                                       \
+    {                                                                        \
+        add_matches(&(act[k]->results), m, s ## k, SRCH_MASK_ALL,            \
+            pos[k] + j);                                                     \
+    }
+
+size_t search_compile(srch_machine_t **, fileid_t *, char *, spectype_t);
+extern void search_build(srch_machine_t *, int, fileid_t **, char *);
+extern void search_free(srch_machine_t *);
+extern uint64_t search_hash(srch_machine_t *);
+extern uint32_t search_next(srch_machine_t *, uint32_t, uint8_t);
+extern size_t search_size(srch_machine_t *);
+extern double search_bench(srch_machine_t *, uint8_t *, size_t, int);
+extern srch_results_t *search(srch_machine_t *, uint32_t *, uint8_t *, 
+size_t, uint32_t);
+extern void search_batch(srch_lane_t **, int);
+extern fileid_t *search_anchor(srch_anchor_t *, const uint8_t *, size_t, 
+size_t *);
+extern void search_window(srch_results_t **, int64_t);
 extern void free_results_list(srch_results_t **);
 
-static srch_node_t *new_srch_node(srch_nodetype_t);
-static srch_node_t *add_simple(srch_node_t *, uint8_t, int, int, char *,
-unsigned long, spectype_t);
-static srch_node_t *add_wildcard(srch_node_t *, int, int, char *,
-unsigned long, spectype_t);
-static void update_search(srch_node_t *, srchptr_list_t **, srch_results_t **,
-uint8_t, int);
-static void add_result(srch_results_t **, fileid_t *, spectype_t, int);
+static int parse_byte(char *, int *, int);
+static int parse_class(char *, int *, int, srch_class_t);
+static uint32_t dfa_state(srch_machine_t *, srch_build_t *, uint32_t *, 
+uint32_t, char *);
+static void dfa_overflow(srch_machine_t *, char *);
+static void dfa_rehash(srch_machine_t *, srch_build_t *);
+static void dfa_row(srch_machine_t *, srch_build_t *, uint32_t, uint32_t *);
+static void dfa_dense(srch_machine_t *);
+static void search_lanes(srch_machine_t *, srch_lane_t **, uint32_t *, 
+size_t *, size_t);
+static void add_result(srch_results_t **, fileid_t *, spectype_t, size_t, 
+int);
+static void add_matches(srch_results_t **, srch_machine_t *, uint32_t, 
+uint32_t, int);
 
 #endif /* SEARCH_H */
@@ -0,0 +1,88 @@
+/*
+ * sigs.h - precompiled signature image header
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#ifndef SIGS_H
+#define SIGS_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/*
+ * a signature image is the fileid table and the built search machines,
+ * written out by --compile-sigs.  everything in it is an offset from the
+ * start of the file or an index, so it can be mapped anywhere and shared
+ * between processes.
+ */
+#define SIGS_MAGIC      "NFEXSIGS"
+#define SIGS_VERSION    6
+#define SIGS_BOM        0x01020304     /** catches images from the wrong arch */
+#define SIGS_MACHINES   4              /** HEADER, FOOTER, stream, body */
+#define SIGS_ALIGN      64
+#define SIGS_BENCH_SIZE (64 * 1024 * 1024)  /** bytes --bench scans */
+
+/** fileid flags */
+#define SIGS_VALIDATE   0x01           /* has a validator */
+#define SIGS_RESOLVE    0x02           /* has a length resolver */
+#define SIGS_FOOTER     0x04           /* has a FOOTER */
+#define SIGS_NOTHROTTLE 0x08           /* throttle=no */
+#define SIGS_NOPACK     0x10           /* stored uncompressed */
+
+struct sigs_machine
+{
+    uint32_t present;                  /* is there a machine at all */
+    uint32_t anchored;                 /* matches only from the first byte */
+    uint32_t nstates;                  /* DFA states */
+    uint32_t nmatches;                 /* entries in the match array */
+    uint32_t ncomb;                    /* compressed slots, 0 if a full table */
+    uint32_t pad;
+    uint64_t table;                    /* offset of nstates * 256 uint32s */
+    uint64_t base;                     /* or of nstates uint32s */
+    uint64_t def;                      /* and nstates uint32s */
+    uint64_t next;                     /* and ncomb uint32s */
+    uint64_t check;                    /* and ncomb uint32s */
+    uint64_t match;                    /* offset of nstates uint32s */
+    uint64_t matches;                  /* offset of nmatches srch_match_ts */
+};
+
+struct sigs_fileid
+{
+    uint32_t id;                       /* id number of search pattern */
+    uint32_t ext;                      /* offset of the extension string */
+    uint64_t maxlen;                   /* maximum length of file */
+    uint64_t window;                   /* for ANCHOR_WITHIN */
+    uint32_t anchor;                   /* where the HEADER may match */
+    uint32_t flags;                    /* SIGS_VALIDATE, SIGS_RESOLVE... */
+    uint32_t profile;                  /* which profile it extracts for */
+    uint32_t max;                      /* concurrent extractions cap */
+    uint32_t rate;                     /* new extractions a second */
+    uint32_t burst;                    /* and how many at once */
+    int32_t priority;                  /* shed order under load */
+    uint32_t commit;                   /* bytes held before making a file */
+};
+
+struct sigs_header
+{
+    char magic[8];                     /* SIGS_MAGIC */
+    uint32_t version;                  /* SIGS_VERSION */
+    uint32_t bom;                      /* SIGS_BOM */
+    uint64_t size;                     /* of the whole image */
+    uint32_t nfileids;                 /* entries in the fileid table */
+    uint32_t anch_depth;               /* how far into a stream anchors reach */
+    uint64_t fileids;                  /* offset of the fileid table */
+    uint32_t nprofiles;                /* config files compiled in */
+    uint32_t pad;
+    char profile[SRCH_PROFILE_MAX][SRCH_PROFILE_NAME]; /* and their names */
+    struct sigs_machine machine[SIGS_MACHINES];
+};
+
+static srch_machine_t **sigs_machine(srch_set_t *, int);
+static int sigs_inside(struct sigs_header *, uint64_t, uint64_t);
+static int sigs_check(struct sigs_header *, struct sigs_machine *, uint8_t *);
+
+#endif /* SIGS_H */
@@ -40,6 +40,7 @@ extern void error(char *);
 extern void report(char *, ...);
 extern void *emalloc(size_t);
 extern void *ecalloc(size_t, size_t);
+extern void *erealloc(void *, size_t);
 void build_bpf_filter(register char **argv, char **buf);
 void fprintip(FILE *stream, uint32_t ip, ncc_t *ncc);
 
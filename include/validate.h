@@ -0,0 +1,42 @@
+/*
+ * validate.h - file format validation header
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#define VALIDATE_MAX    1024    /** most we'll hold back waiting on a verdict */
+
+/** validator verdicts */
+#define VALIDATE_BAD    -1      /* not the type it claims to be */
+#define VALIDATE_MORE    0      /* can't tell yet, need more bytes */
+#define VALIDATE_OK      1      /* looks like the real thing */
+
+/** checks the first bytes of a candidate file */
+typedef int (*validate_t)(const uint8_t *, size_t);
+
+struct validator
+{
+    char *ext;                  /* file extension it applies to */
+    validate_t check;           /* the check itself */
+};
+typedef struct validator validator_t;
+
+validate_t validate_lookup(char *);
+
+static int validate_pe(const uint8_t *, size_t);
+static int validate_pdf(const uint8_t *, size_t);
+static int validate_zip(const uint8_t *, size_t);
+static int validate_png(const uint8_t *, size_t);
+static int validate_jpg(const uint8_t *, size_t);
+static int validate_gif(const uint8_t *, size_t);
+
+#endif /* VALIDATE_H */
@@ -18,6 +18,9 @@
  * srcip.port:   destination ip addess and destination port
  * filename:     new filename for extracted binary: PID-counter-md5.exe
  * malware name: as reported by clamav; "name" or "*UNKNOWN" or "*ERROR"
+ *
+ * If nfex was run with --hashes md5 the index already has each file's md5
+ * after its filename, and we use that rather than reading the file again.
  */
 
 #include <stdio.h>
@@ -45,13 +48,15 @@ void usage(char *);
 int
 main(int argc, char *argv[])
 {
-    int c, i, j, m, n, fd; 
+    int c, i, j, m, fd, have_md5; 
     uint32_t pehdr, pesig;
     struct cl_engine *engine;
     FILE *oldlog, *newlog;
-    char p[256], pp[128];
+    char p[256], *pp, *line;
+    size_t linesz;
     unsigned char md5[16];
-    char *q, *src_file, *timestamp, *src_ip, *dst_ip, *filename, *suffix;
+    char *q, *r, *src_file, *timestamp, *src_ip, *dst_ip, *filename, *suffix;
+    unsigned int x;
     const char *vname;
     unsigned long int size;
     uint8_t b[512];
@@ -111,16 +116,17 @@ main(int argc, char *argv[])
         return (EXIT_FAILURE);
     }
 
-    n        = sizeof (p);
     size     = 0;
     src_file = timestamp = src_ip = dst_ip = filename = NULL;
     pesig    = PE32_SIGNATURE;
+    line     = NULL;
+    linesz   = 0;
 next_entry:
-    while(fgets(p, n, oldlog))
+    /** lines with long paths and all three digests run well past 256 */
+    while (getline(&line, &linesz, oldlog) != -1)
     {
         /** save all of these guys, we'll need them later */
-        /** XXX: fix memory leak with the implied malloc() in strsep() */
-        q = p;
+        q = line;
         src_file  = strsep(&q, ",");
         if (src_file == NULL)
         {
@@ -155,7 +161,25 @@ next_entry:
         /** step over last bit of whitespace and replace newline with a NULL */
 	for (i = 0; filename[i] == ' '; i++);
         filename = filename + i;
-        filename[strlen(filename) - 1] = 0;
+        filename[strcspn(filename, "\n")] = 0;
+
+        /** any digests follow the filename, the md5 is the 32 digit one */
+        have_md5 = 0;
+        while ((r = strsep(&q, ",")))
+        {
+            for (; *r == ' '; r++);
+            r[strcspn(r, "\n")] = 0;
+            if (strlen(r) != 32 || strspn(r, "0123456789abcdef") != 32)
+            {
+                continue;
+            }
+            for (j = 0; j < 16; j++)
+            {
+                sscanf(r + 2 * j, "%2x", &x);
+                md5[j] = x;
+            }
+            have_md5 = 1;
+        }
         fd = open(filename, O_RDONLY);
         if (fd == -1)
         {
@@ -195,11 +219,20 @@ next_entry:
             fprintf(newlog, "%s,", src_ip);
             fprintf(newlog, "%s,", dst_ip);
            
-            /** md5 hash of file */ 
-            md5file(fd, md5);
+            /** md5 hash of file, unless nfex worked it out already */ 
+            if (!have_md5)
+            {
+                md5file(fd, md5);
+            }
             
             /** build new filename for file based off of md5 */
-            memset(pp, 0, sizeof (pp));
+            pp = malloc(strlen(filename) + 2 * sizeof (md5) + 6);
+            if (pp == NULL)
+            {
+                fprintf(stderr, "malloc(): %s\n", strerror(errno));
+                close(fd);
+                goto next_entry;
+            }
             sprintf(pp, "%s", filename);
             for (i = 0; pp[i] != '.'; i++);
             sprintf(&pp[i], "-");
@@ -215,6 +248,7 @@ next_entry:
             fprintf(newlog, " %s, ", pp);
             fflush(newlog);
             rename(filename, pp);
+            free(pp);
 
             /** see if we have malware */
             i = cl_scandesc(fd, &vname, &size, engine, CL_SCAN_STDOPT);
@@ -252,6 +286,7 @@ next_entry:
             close(fd);
         }
     }
+    free(line);
     fclose(newlog);
     fclose(oldlog);
     /** delete old logfile */
@@ -0,0 +1,473 @@
+/*
+ * archive.c - object archive
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include <sys/wait.h>
+#include "nfex.h"
+#include "extract.h"
+#include "compress.h"
+
+/*
+ * a finished file goes on the end of its profile's segment and a record
+ * of it on the end of the segment's index, so the disk sees one big
+ * sequential write per file and no new inodes.  a segment that's reached
+ * its --archive size is closed and the next one started, in whichever -o
+ * dir is up next.
+ */
+void
+archive_put(extract_list_t *p, digest_sum_t *sum, ncc_t *ncc)
+{
+    ssize_t c;
+    archive_t *ar;
+    archive_record_t rec;
+    nfex_profile_t *pr;
+
+    pr = &(ncc->profile[p->fileid->profile]);
+    ar = &(pr->archive);
+    if ((ar->fd == -1 || ar->size >= ncc->output.segment) &&
+        archive_roll(pr, ncc) == -1)
+    {
+        ncc->stats.extraction_errors++;
+        return;
+    }
+
+    memset(&rec, 0, sizeof (rec));
+    rec.id       = ++ncc->filenum;
+    rec.offset   = ar->size;
+    rec.length   = p->nstage;
+    rec.stored   = p->nstage;
+    rec.ts_sec   = p->ts.tv_sec;
+    rec.ts_usec  = p->ts.tv_usec;
+    rec.ip_src   = p->ip_src;
+    rec.ip_dst   = p->ip_dst;
+    rec.port_src = p->port_src;
+    rec.port_dst = p->port_dst;
+    rec.digests  = sum->which;
+    rec.complete = p->complete;
+    rec.codec    = ARCHIVE_RAW;
+    rec.nopack   = p->fileid->nopack;
+    strncpy(rec.ext, p->fileid->ext, ARCHIVE_EXT_LEN - 1);
+    memcpy(rec.md5, sum->md5, MD5_LEN);
+    memcpy(rec.sha1, sum->sha1, SHA1_LEN);
+    memcpy(rec.sha256, sum->sha256, SHA256_LEN);
+
+    c = p->nstage ? write(ar->fd, p->stage, p->nstage) : 0;
+    if (c != (ssize_t)p->nstage)
+    {
+        fprintf(stderr, "error writing archive segment, wrote %ld of %ld "
+            "bytes: %s\n", (long)c, (long)p->nstage, strerror(errno));
+        ncc->stats.extraction_errors++;
+        /** it's no good to add to now, the next file starts another */
+        archive_close(ar, &(ncc->packer));
+        return;
+    }
+    ar->size += p->nstage;
+    if (write(ar->ifd, &rec, sizeof (rec)) != sizeof (rec))
+    {
+        fprintf(stderr, "error writing archive index: %s\n",
+            strerror(errno));
+        ncc->stats.extraction_errors++;
+        archive_close(ar, &(ncc->packer));
+        return;
+    }
+    pr->files++;
+    ncc->stats.archived += p->nstage;
+}
+
+/** finish a profile's segment, if it has one, and start the next */
+static int
+archive_roll(nfex_profile_t *pr, ncc_t *ncc)
+{
+    int n;
+    archive_t *ar;
+    archive_header_t h;
+    nfex_outdir_t *dir;
+    char fname[FILENAME_BUFFER_SIZE];
+
+    ar = &(pr->archive);
+    archive_close(ar, &(ncc->packer));
+    ar->size = 0;
+    dir = extract_dir(pr, ncc);
+    ar->seq++;
+    n = snprintf(ar->name, sizeof (ar->name), "%s%d-%06u", dir->path, 
+        getpid(), ar->seq);
+    snprintf(fname, sizeof (fname), "%s", ar->name);
+
+    strcpy(fname + n, ARCHIVE_SEGMENT);
+    ar->fd = open(fname, O_WRONLY|O_CREAT|O_EXCL|O_APPEND,
+        S_IRWXU|S_IRWXG|S_IRWXO);
+    if (ar->fd == -1)
+    {
+        fprintf(stderr, "error opening archive segment %s: %s\n", fname,
+            strerror(errno));
+        return (-1);
+    }
+    if (ncc->flags & NFEX_VERBOSE)
+    {
+        fprintf(stdout, "archiving to %s\n", fname);
+    }
+
+    strcpy(fname + n, ARCHIVE_INDEX);
+    ar->ifd = open(fname, O_WRONLY|O_CREAT|O_EXCL|O_APPEND,
+        S_IRWXU|S_IRWXG|S_IRWXO);
+    if (ar->ifd == -1)
+    {
+        fprintf(stderr, "error opening archive index %s: %s\n", fname,
+            strerror(errno));
+        archive_close(ar, NULL);
+        return (-1);
+    }
+    memset(&h, 0, sizeof (h));
+    memcpy(h.magic, ARCHIVE_MAGIC, sizeof (h.magic));
+    h.version = ARCHIVE_VERSION;
+    h.record  = sizeof (archive_record_t);
+    if (write(ar->ifd, &h, sizeof (h)) != sizeof (h))
+    {
+        fprintf(stderr, "error writing archive index %s: %s\n", fname,
+            strerror(errno));
+        archive_close(ar, NULL);
+        return (-1);
+    }
+    ncc->stats.segments++;
+    archive_poll(ncc, 0);
+
+    return (1);
+}
+
+/** a segment's finished, it's queued up to be compressed if there's a pk */
+void
+archive_close(archive_t *ar, archive_packer_t *pk)
+{
+    if (pk && pk->codec != ARCHIVE_RAW && ar->fd != -1 && ar->ifd != -1 &&
+        ar->size)
+    {
+        if (pk->n == ARCHIVE_QUEUE)
+        {
+            fprintf(stderr, "too many segments waiting to be compressed, "
+                "%s is left as it is\n", ar->name);
+        }
+        else if ((pk->queue[(pk->head + pk->n) % ARCHIVE_QUEUE] = 
+            strdup(ar->name)) == NULL)
+        {
+            fprintf(stderr, "can't queue %s to be compressed: %s\n", 
+                ar->name, strerror(errno));
+        }
+        else
+        {
+            pk->n++;
+        }
+    }
+    if (ar->fd != -1)
+    {
+        close(ar->fd);
+    }
+    if (ar->ifd != -1)
+    {
+        close(ar->ifd);
+    }
+    ar->fd  = -1;
+    ar->ifd = -1;
+}
+
+/*
+ * called from the main loop, and whenever a segment's done.  collects the
+ * child compressing a segment if it's finished (or waits for it, if block)
+ * and starts on the next one.  it's a child for the same reason a reload
+ * is: however long it takes, it's not holding up packets.  returns -1 if
+ * the next one couldn't be started, it stays queued for another try.
+ */
+int
+archive_poll(ncc_t *ncc, int block)
+{
+    int fds[2], status;
+    pid_t pid;
+    uint64_t sizes[2];
+    archive_packer_t *pk;
+
+    pk = &(ncc->packer);
+    if (pk->pid)
+    {
+        pid = waitpid(pk->pid, &status, block ? 0 : WNOHANG);
+        if (pid == 0)
+        {
+            return (1);
+        }
+        if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) ||
+            read(pk->fd, sizes, sizeof (sizes)) != sizeof (sizes))
+        {
+            fprintf(stderr, "compressing an archive segment failed, it's "
+                "left as it was\n");
+        }
+        else
+        {
+            pk->in  += sizes[0];
+            pk->out += sizes[1];
+            pk->segments++;
+        }
+        close(pk->fd);
+        pk->fd  = -1;
+        pk->pid = 0;
+    }
+    if (pk->n == 0)
+    {
+        return (1);
+    }
+    if (pipe(fds) == -1)
+    {
+        fprintf(stderr, "can't compress %s: pipe(): %s\n", 
+            pk->queue[pk->head], strerror(errno));
+        return (-1);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    switch (pid)
+    {
+        case -1:
+            fprintf(stderr, "can't compress %s: fork(): %s\n",
+                pk->queue[pk->head], strerror(errno));
+            close(fds[0]);
+            close(fds[1]);
+            return (-1);
+        case 0:
+            /** see it through, even if we're being shut down */
+            close(fds[0]);
+            signal(SIGHUP, SIG_IGN);
+            signal(SIGINT, SIG_IGN);
+            sizes[0] = 0;
+            sizes[1] = 0;
+            if (archive_pack(pk->queue[pk->head], pk->codec, sizes) == -1 ||
+                write(fds[1], sizes, sizeof (sizes)) != sizeof (sizes))
+            {
+                _exit(EXIT_FAILURE);
+            }
+            _exit(EXIT_SUCCESS);
+        default:
+            close(fds[1]);
+            pk->pid = pid;
+            pk->fd  = fds[0];
+            free(pk->queue[pk->head]);
+            pk->head = (pk->head + 1) % ARCHIVE_QUEUE;
+            pk->n--;
+            break;
+    }
+    return (1);
+}
+
+/** shutting down, the segments that are done still get compressed */
+void
+archive_stop(ncc_t *ncc)
+{
+    uint32_t i;
+    archive_packer_t *pk;
+
+    pk = &(ncc->packer);
+    for (i = 0; i < ncc->nprofiles; i++)
+    {
+        archive_close(&(ncc->profile[i].archive), pk);
+    }
+    if (pk->n)
+    {
+        printf("compressing %d archive segments...\n", pk->n + 
+            (pk->pid != 0));
+    }
+    while (pk->pid || pk->n)
+    {
+        if (archive_poll(ncc, 1) == -1)
+        {
+            /** no child to do it, nobody's coming back to retry */
+            fprintf(stderr, "leaving %d archive segments uncompressed\n",
+                pk->n);
+            while (pk->n)
+            {
+                free(pk->queue[pk->head]);
+                pk->head = (pk->head + 1) % ARCHIVE_QUEUE;
+                pk->n--;
+            }
+        }
+    }
+    if (pk->segments)
+    {
+        printf("archive compression:\t\t%llu to %llu bytes (%.2f:1)\n",
+            (unsigned long long)pk->in, (unsigned long long)pk->out,
+            pk->out ? (double)pk->in / pk->out : 0);
+    }
+}
+
+/*
+ * in the child, compress a segment: each file that's worth it goes into
+ * the .nfz compressed on its own, the rest as they are, then the index is
+ * swapped for one that knows where they are now and the .nfa goes.  up to
+ * then anyone reading the segment sees the old one, intact.  sizes gets
+ * the bytes in and out.
+ */
+static int
+archive_pack(char *stem, int codec, uint64_t *sizes)
+{
+    int ifd, sfd, zfd, ret;
+    uint32_t i, n;
+    int64_t c;
+    uint64_t off;
+    struct stat st;
+    digest_t d;
+    archive_header_t h;
+    archive_record_t *recs;
+    char *q;
+    char fname[FILENAME_BUFFER_SIZE], tmp[FILENAME_BUFFER_SIZE];
+
+    ret  = -1;
+    recs = NULL;
+    sfd  = -1;
+    zfd  = -1;
+    snprintf(fname, sizeof (fname), "%s" ARCHIVE_INDEX, stem);
+    ifd = open(fname, O_RDONLY);
+    if (ifd == -1 || fstat(ifd, &st) == -1 ||
+        read(ifd, &h, sizeof (h)) != sizeof (h))
+    {
+        goto done;
+    }
+    n    = (st.st_size - sizeof (h)) / sizeof (*recs);
+    recs = malloc(n * sizeof (*recs) + 1);
+    if (recs == NULL || read(ifd, recs, n * sizeof (*recs)) != 
+        (ssize_t)(n * sizeof (*recs)))
+    {
+        goto done;
+    }
+
+    snprintf(fname, sizeof (fname), "%s" ARCHIVE_SEGMENT, stem);
+    sfd = open(fname, O_RDONLY);
+    snprintf(tmp, sizeof (tmp), "%s" ARCHIVE_PACKED, stem);
+    zfd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, S_IRWXU|S_IRWXG|S_IRWXO);
+    if (sfd == -1 || zfd == -1)
+    {
+        goto done;
+    }
+    digest_init(&d, 0);
+    for (i = 0, off = 0; i < n; i++)
+    {
+        c = -1;
+        if (recs[i].nopack == 0 && recs[i].length)
+        {
+            c = compress_object(sfd, &(recs[i]), codec, zfd);
+        }
+        if (c == -1 || (uint64_t)c >= recs[i].length)
+        {
+            /** not worth it, it goes in as it is */
+            if (ftruncate(zfd, off) == -1 || 
+                lseek(zfd, off, SEEK_SET) == -1 ||
+                decompress_object(sfd, &(recs[i]), zfd, &d) == -1)
+            {
+                goto done;
+            }
+            c = recs[i].length;
+        }
+        else
+        {
+            recs[i].codec = codec;
+        }
+        sizes[0] += recs[i].length;
+        sizes[1] += c;
+        recs[i].offset = off;
+        recs[i].stored = c;
+        off += c;
+    }
+
+    /*
+     * nothing's let go of until what replaces it is on disk: the .nfz, then
+     * the index that points at it, then the rename.  only then does the
+     * .nfa go
+     */
+    if (fsync(zfd) == -1)
+    {
+        goto done;
+    }
+    close(zfd);
+    zfd = -1;
+
+    /** the new index goes in under the old one's name, all at once */
+    h.flags |= ARCHIVE_F_PACKED;
+    snprintf(tmp, sizeof (tmp), "%s" ARCHIVE_INDEX ".tmp", stem);
+    zfd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, S_IRWXU|S_IRWXG|S_IRWXO);
+    if (zfd == -1 || write(zfd, &h, sizeof (h)) != sizeof (h) ||
+        write(zfd, recs, n * sizeof (*recs)) != 
+        (ssize_t)(n * sizeof (*recs)) || fsync(zfd) == -1)
+    {
+        unlink(tmp);
+        goto done;
+    }
+    close(zfd);
+    zfd = -1;
+    snprintf(fname, sizeof (fname), "%s" ARCHIVE_INDEX, stem);
+    if (rename(tmp, fname) == -1)
+    {
+        unlink(tmp);
+        goto done;
+    }
+    q = strrchr(fname, '/');
+    if (q)
+    {
+        q[1] = '\0';
+    }
+    zfd = open(q ? fname : ".", O_RDONLY);
+    if (zfd == -1 || fsync(zfd) == -1)
+    {
+        /** the index is the new one, but the .nfa stays to be safe */
+        ret = 1;
+        goto done;
+    }
+    snprintf(fname, sizeof (fname), "%s" ARCHIVE_SEGMENT, stem);
+    unlink(fname);
+    ret = 1;
+
+done:
+    if (ret == -1)
+    {
+        snprintf(tmp, sizeof (tmp), "%s" ARCHIVE_PACKED, stem);
+        unlink(tmp);
+    }
+    if (zfd != -1)
+    {
+        close(zfd);
+    }
+    if (sfd != -1)
+    {
+        close(sfd);
+    }
+    if (ifd != -1)
+    {
+        close(ifd);
+    }
+    free(recs);
+    return (ret);
+}
+
+/** types that are compressed already, they go in the .nfz as they are */
+static char *nopack[] =
+{
+    "jpg", "jpeg", "gif", "png", "webp", "zip", "jar", "docx", "xlsx",
+    "pptx", "gz", "bz2", "xz", "rar", "7z", "cab", "mp3", "mp4", "mpg",
+    "avi", "flv", NULL
+};
+
+int
+archive_nopack(char *ext)
+{
+    int i;
+
+    for (i = 0; nopack[i]; i++)
+    {
+        if (strcasecmp(nopack[i], ext) == 0)
+        {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+/** EOF */
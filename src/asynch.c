@@ -26,7 +26,9 @@ the_game(ncc_t *ncc)
          * program will block here (in file mode) if no packets match the 
          * filter that was specified at the command line.
          */
-        c = pcap_dispatch(ncc->p, 100, process_packet, (uint8_t *)ncc);
+        c = pcap_dispatch(ncc->p, NFEX_BATCH, process_packet, 
+            (uint8_t *)ncc);
+        packet_flush(ncc);
         /** hand the keypress off be processed */
         switch (process_keypress(ncc))
         {
@@ -43,6 +45,9 @@ the_game(ncc_t *ncc)
             ht_expire_session(ncc);
             j = 0;
         }
+        /** pick up new signatures between batches */
+        reload_poll(ncc, 0);
+        archive_poll(ncc, 0);
         if (c < 0)
         {
             error(pcap_geterr(ncc->p));
@@ -60,19 +65,43 @@ the_game(ncc_t *ncc)
     /** network extraction */
     for (j = 0; ; j++)
     {
-        /** we multiplex input across the network and STDIN */
+        /** start a reload if we got a SIGHUP */
+        reload_poll(ncc, 0);
+        archive_poll(ncc, 0);
+
+        /** we multiplex input across the network, STDIN and any reload */
         FD_ZERO(&read_set);
         FD_SET(STDIN_FILENO, &read_set);
         FD_SET(ncc->pcap_fd, &read_set);
+        if (ncc->reload_fd != -1)
+        {
+            FD_SET(ncc->reload_fd, &read_set);
+        }
+        if (ncc->packer.fd != -1)
+        {
+            FD_SET(ncc->packer.fd, &read_set);
+        }
 
         /** check the status of our file descriptors */
         c = select(FD_SETSIZE, &read_set, 0, 0, NULL);
         if (c > 0)
         {
+            /** the signature rebuild finished */
+            if (ncc->reload_fd != -1 && FD_ISSET(ncc->reload_fd, &read_set))
+            {
+                reload_poll(ncc, 1);
+            }
+            /** a segment's been compressed, start the next */
+            if (ncc->packer.fd != -1 && FD_ISSET(ncc->packer.fd, &read_set))
+            {
+                archive_poll(ncc, 1);
+            }
             /** input from the network */
             if (FD_ISSET(ncc->pcap_fd, &read_set))
             {
-                n = pcap_dispatch(ncc->p, 100, process_packet, (u_char *)ncc);
+                n = pcap_dispatch(ncc->p, NFEX_BATCH, process_packet, 
+                    (u_char *)ncc);
+                packet_flush(ncc);
                 /** every 10,000 packets let's clean house */
                 if (j == 100)
                 {
@@ -98,6 +127,11 @@ the_game(ncc_t *ncc)
                 }
             }
         }
+        if (c == -1 && errno == EINTR)
+        {
+            /** a signal, probably SIGHUP */
+            continue;
+        }
         if (c == -1)
         {
             perror("error fatal select");
@@ -146,7 +180,7 @@ process_keypress(ncc_t *ncc)
             ht_status(ncc); 
             break;
         case 'f':
-            //search_dump_types(ncc);
+            extract_dump_types(ncc);
             break;
         case 'r':
             /* clear stats */
@@ -154,6 +188,10 @@ process_keypress(ncc_t *ncc)
             memset(&ncc->stats, 0, sizeof (ncc->stats));
             printf("nfex statistics cleared\n");
             break;
+        case 'R':
+            /* reload signatures */
+            reload_start(ncc);
+            break;
         case 's':
             /* display statistics */
             stats(ncc, NFEX_STATS_UPDATE);
@@ -185,6 +223,7 @@ process_keypress(ncc_t *ncc)
             printf("[g]   - toggle geoIP mode\n");
 #endif /** HAVE_GEOIP */
             printf("[r]   - reset statistics\n");
+            printf("[R]   - reload signatures\n");
             printf("[s]   - display statistics\n");
             printf("[q]   - quit\n");
             printf("[V]   - display program version\n");
@@ -217,11 +256,80 @@ process_keypress(ncc_t *ncc)
     return (1);
 }
 
+/*
+ * --soak: play the capture file through again and again without a 
+ * restart, letting every session go after each pass.  once the first
+ * pass has warmed things up nothing should grow, a leak in session 
+ * teardown shows up as memory or fds creeping up pass after pass.
+ * returns -1 if they did.
+ */
+int
+soak(ncc_t *ncc, char *bpf, int passes)
+{
+    int i, fds, fds0;
+    long rss, rss0;
+    uint64_t held;
+    struct bpf_program filter_program;
+
+    for (i = 1, rss0 = 0, fds0 = 0; i <= passes; i++)
+    {
+        if (i > 1)
+        {
+            /** back to the start of the file */
+            pcap_close(ncc->p);
+            ncc->p = pcap_open_offline(ncc->capfname, ncc->errbuf);
+            if (ncc->p == NULL)
+            {
+                fprintf(stderr, "can't reopen pcap file %s: %s\n",
+                    ncc->capfname, ncc->errbuf);
+                return (-1);
+            }
+            if (pcap_compile(ncc->p, &filter_program, bpf, 0, 0) == -1 ||
+                pcap_setfilter(ncc->p, &filter_program) == -1)
+            {
+                fprintf(stderr, "can't install filter %s: %s\n", bpf,
+                    pcap_geterr(ncc->p));
+                return (-1);
+            }
+            pcap_freecode(&filter_program);
+            ncc->pcap_fd = pcap_get_selectable_fd(ncc->p);
+        }
+        if (the_game(ncc) == 2)
+        {
+            return (0);
+        }
+        ht_shutitdown(ncc);
+
+        proc_usage(&rss, &fds);
+        held = ht_mem(ncc) - ncc->mem[NFEX_MEM_PACKETS];
+        printf("soak pass %d: %ld KB resident, %d fds open, %llu bytes "
+            "held by flows\n", i, rss, fds, (unsigned long long)held);
+        if (i == 1)
+        {
+            rss0 = rss;
+            fds0 = fds;
+        }
+        if (held || fds > fds0 || rss > rss0 + rss0 / 8)
+        {
+            fprintf(stderr, "soak pass %d: resources are growing, something "
+                "isn't being let go\n", i);
+            return (-1);
+        }
+    }
+    return (1);
+}
+
 void
 stats(ncc_t *ncc, int mode)
 {
     struct timeval r, e;
     u_int32_t day, hour, min, sec;
+    uint32_t i, n;
+    int fds;
+    long rss;
+    static char *mem_names[NFEX_MEM_N] =
+        {"sessions", "search state", "extraction buffers", "packet batch",
+         "dedup table"};
 
     gettimeofday(&e, NULL);
     PTIMERSUB(&e, &(ncc->stats.ts_start), &r);
@@ -281,18 +389,112 @@ stats(ncc_t *ncc, int mode)
     {
        printf("sessions watched:\t\t%d\n", ncc->stats.ht_entries);
     }
+    printf("stateless packets:\t\t%d\n", ncc->stats.ht_stateless);
+    if (ncc->flags & NFEX_HTTP)
+    {
+        printf("HTTP messages parsed:\t\t%d\n", ncc->stats.http_msgs);
+        printf("HTTP body bytes skipped:\t%llu\n", 
+            (unsigned long long)ncc->stats.http_bypassed);
+    }
     printf("packets churned:\t\t%d\n", ncc->stats.total_packets);
-    printf("bytes churned:\t\t\t%lld\n", ncc->stats.total_bytes);
+    printf("bytes churned:\t\t\t%llu\n", 
+        (unsigned long long)ncc->stats.total_bytes);
     if (ncc->capfname[0])
     {
         printf("pcap file processed:\t\t%.1f%%\n", 
             ((double)ncc->stats.total_bytes * 100) / (double)ncc->capfsize);
     }
     printf("files extracted:\t\t%d\n", ncc->stats.total_files);
+    for (i = 0; ncc->nprofiles > 1 && i < ncc->nprofiles; i++)
+    {
+        printf("  %-30s%d\n", ncc->set->profile[i], 
+            ncc->profile[i].files);
+    }
+    printf("files failing validation:\t%d\n", ncc->stats.validate_rejects);
+    if (ncc->stats.validate_expired)
+    {
+        printf("files expired unvalidated:\t%d\n", 
+            ncc->stats.validate_expired);
+    }
+    if (ncc->stats.validate_skipped)
+    {
+        printf("files dropped unvalidated:\t%d\n", 
+            ncc->stats.validate_skipped);
+    }
+    printf("files sized from structure:\t%d\n", ncc->stats.resolved);
+    if (ncc->dedup.mode)
+    {
+        printf("files already kept:\t\t%d (%llu bytes)\n", ncc->stats.dups,
+            (unsigned long long)ncc->stats.dup_bytes);
+        if (ncc->dedup.limit)
+        {
+            printf("kept files forgotten for room:\t%d\n", 
+                ncc->stats.dedup_forgotten);
+        }
+    }
+    if (ncc->output.segment)
+    {
+        printf("archive segments:\t\t%d (%llu bytes)\n", 
+            ncc->stats.segments, (unsigned long long)ncc->stats.archived);
+    }
+    if (ncc->packer.segments)
+    {
+        printf("archive compression:\t\t%llu to %llu bytes (%.2f:1)\n",
+            (unsigned long long)ncc->packer.in,
+            (unsigned long long)ncc->packer.out, ncc->packer.out ?
+            (double)ncc->packer.in / ncc->packer.out : 0);
+    }
+    if (ncc->stats.uncommitted)
+    {
+        printf("candidates dropped unwritten:\t%d\n", 
+            ncc->stats.uncommitted);
+    }
+    if (ncc->stats.reloads)
+    {
+        printf("signature reloads:\t\t%d\n", ncc->stats.reloads);
+    }
+    if (ncc->flags & NFEX_DEBUG)
+    {
+        printf("[DEBUG] batch searches redone:\t%d\n", ncc->stats.rescans);
+    }
     if (mode == NFEX_STATS_UPDATE)
     {
         printf("files currently extracting:\t%d\n", 
-            ht_count_extracts(ncc));
+            ncc->extracting);
+    }
+    if (mode == NFEX_STATS_UPDATE)
+    {
+        proc_usage(&rss, &fds);
+        printf("resident memory:\t\t%ld KB\n", rss);
+        printf("open file descriptors:\t\t%d\n", fds);
+        printf("flow memory in use:\t\t%llu KB\n", 
+            (unsigned long long)(ht_mem(ncc) >> 10));
+        for (i = 0; i < NFEX_MEM_N; i++)
+        {
+            printf("  %-30s%llu KB\n", mem_names[i], 
+                (unsigned long long)(ncc->mem[i] >> 10));
+        }
+    }
+    n = ncc->stats.shed_flow + ncc->stats.shed_type + ncc->stats.shed_rate +
+        ncc->stats.shed_global + ncc->stats.shed_yield;
+    if (n || ncc->stats.preempted)
+    {
+        printf("extractions refused:\t\t%d\n", n);
+        printf("  %-30s%d\n", "flow at its cap", ncc->stats.shed_flow);
+        printf("  %-30s%d\n", "type at its cap", ncc->stats.shed_type);
+        printf("  %-30s%d\n", "type over its rate", ncc->stats.shed_rate);
+        printf("  %-30s%d\n", "all at the cap", ncc->stats.shed_global);
+        printf("  %-30s%d\n", "type throttled", ncc->stats.shed_yield);
+        printf("extractions cut short for room:\t%d\n", 
+            ncc->stats.preempted);
+    }
+    if (ncc->mem_limit)
+    {
+        printf("flow memory budget:\t\t%llu KB\n", 
+            (unsigned long long)(ncc->mem_limit >> 10));
+        printf("idle sessions evicted:\t\t%d\n", ncc->stats.evicted_idle);
+        printf("extracting sessions evicted:\t%d\n", 
+            ncc->stats.evicted_extracting);
     }
     printf("packet errors:\t\t\t%d\n", ncc->stats.packet_errors);
     printf("extraction errors:\t\t%d\n", ncc->stats.extraction_errors);
@@ -0,0 +1,355 @@
+/*
+ * compress.c - archive compression
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "compress.h"
+#if (HAVE_ZSTD)
+#include <zstd.h>
+#endif /** HAVE_ZSTD */
+#if (HAVE_LZ4)
+#include <lz4frame.h>
+#endif /** HAVE_LZ4 */
+
+/*
+ * files in an archive segment are compressed one at a time and a buffer at
+ * a time, zstd or lz4 frames, so any one of them can still be read back on
+ * its own and it doesn't matter how big they are.
+ */
+
+/** was nfex built with this codec */
+int
+compress_available(int codec)
+{
+    switch (codec)
+    {
+        case ARCHIVE_RAW:
+            return (1);
+#if (HAVE_ZSTD)
+        case ARCHIVE_ZSTD:
+            return (1);
+#endif /** HAVE_ZSTD */
+#if (HAVE_LZ4)
+        case ARCHIVE_LZ4:
+            return (1);
+#endif /** HAVE_LZ4 */
+        default:
+            return (0);
+    }
+}
+
+/*
+ * read a file out of the segment sfd and write it compressed to the end of
+ * zfd.  returns how many bytes that took, -1 on an error.
+ */
+int64_t
+compress_object(int sfd, archive_record_t *rec, int codec, int zfd)
+{
+    switch (codec)
+    {
+#if (HAVE_ZSTD)
+        case ARCHIVE_ZSTD:
+            return (compress_zstd(sfd, rec, zfd));
+#endif /** HAVE_ZSTD */
+#if (HAVE_LZ4)
+        case ARCHIVE_LZ4:
+            return (compress_lz4(sfd, rec, zfd));
+#endif /** HAVE_LZ4 */
+        default:
+            return (-1);
+    }
+}
+
+/*
+ * read a file back out of its segment, however it's stored, to ofd (or
+ * nowhere if it's -1) and through d.  returns 1, or -1 if it couldn't be
+ * read, written or didn't come out the size it went in.
+ */
+int
+decompress_object(int sfd, archive_record_t *rec, int ofd, digest_t *d)
+{
+    ssize_t n;
+    uint64_t off;
+    uint8_t buf[COMPRESS_BUFFER_SIZE];
+
+    switch (rec->codec)
+    {
+        case ARCHIVE_RAW:
+            break;
+#if (HAVE_ZSTD)
+        case ARCHIVE_ZSTD:
+            return (decompress_zstd(sfd, rec, ofd, d));
+#endif /** HAVE_ZSTD */
+#if (HAVE_LZ4)
+        case ARCHIVE_LZ4:
+            return (decompress_lz4(sfd, rec, ofd, d));
+#endif /** HAVE_LZ4 */
+        default:
+            fprintf(stderr, "file %llu is compressed with something this "
+                "wasn't built with\n", (unsigned long long)rec->id);
+            return (-1);
+    }
+    for (off = 0; off < rec->length; off += n)
+    {
+        n = MIN(rec->length - off, sizeof (buf));
+        n = pread(sfd, buf, n, rec->offset + off);
+        if (n <= 0 || (ofd != -1 && write(ofd, buf, n) != n))
+        {
+            return (-1);
+        }
+        digest_update(d, buf, n);
+    }
+    return (1);
+}
+
+#if (HAVE_ZSTD || HAVE_LZ4)
+/** write out some of a compressed file, adding up how much */
+static int
+compress_put(int fd, const uint8_t *buf, size_t size, uint64_t *total)
+{
+    if (size && write(fd, buf, size) != (ssize_t)size)
+    {
+        return (-1);
+    }
+    *total += size;
+    return (1);
+}
+#endif /** HAVE_ZSTD || HAVE_LZ4 */
+
+#if (HAVE_ZSTD)
+static int64_t
+compress_zstd(int sfd, archive_record_t *rec, int zfd)
+{
+    size_t r;
+    ssize_t n;
+    uint64_t off, total;
+    ZSTD_CStream *zs;
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    uint8_t buf[COMPRESS_BUFFER_SIZE], obuf[COMPRESS_BUFFER_SIZE];
+
+    zs = ZSTD_createCStream();
+    if (zs == NULL || ZSTD_isError(ZSTD_initCStream(zs,
+        COMPRESS_ZSTD_LEVEL)))
+    {
+        goto err;
+    }
+    for (off = 0, total = 0; off < rec->length; off += n)
+    {
+        n = MIN(rec->length - off, sizeof (buf));
+        n = pread(sfd, buf, n, rec->offset + off);
+        if (n <= 0)
+        {
+            goto err;
+        }
+        in.src  = buf;
+        in.size = n;
+        in.pos  = 0;
+        while (in.pos < in.size)
+        {
+            out.dst  = obuf;
+            out.size = sizeof (obuf);
+            out.pos  = 0;
+            r = ZSTD_compressStream(zs, &out, &in);
+            if (ZSTD_isError(r) || compress_put(zfd, obuf, out.pos,
+                &total) == -1)
+            {
+                goto err;
+            }
+        }
+    }
+    do
+    {
+        /** whatever it's still holding onto, and the end of the frame */
+        out.dst  = obuf;
+        out.size = sizeof (obuf);
+        out.pos  = 0;
+        r = ZSTD_endStream(zs, &out);
+        if (ZSTD_isError(r) || compress_put(zfd, obuf, out.pos,
+            &total) == -1)
+        {
+            goto err;
+        }
+    } while (r);
+    ZSTD_freeCStream(zs);
+    return (total);
+
+err:
+    if (zs)
+    {
+        ZSTD_freeCStream(zs);
+    }
+    return (-1);
+}
+
+static int
+decompress_zstd(int sfd, archive_record_t *rec, int ofd, digest_t *d)
+{
+    size_t r;
+    ssize_t n;
+    uint64_t off, total;
+    ZSTD_DStream *zs;
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    uint8_t buf[COMPRESS_BUFFER_SIZE], obuf[COMPRESS_BUFFER_SIZE];
+
+    zs = ZSTD_createDStream();
+    if (zs == NULL || ZSTD_isError(ZSTD_initDStream(zs)))
+    {
+        goto err;
+    }
+    for (off = 0, total = 0; off < rec->stored; off += n)
+    {
+        n = MIN(rec->stored - off, sizeof (buf));
+        n = pread(sfd, buf, n, rec->offset + off);
+        if (n <= 0)
+        {
+            goto err;
+        }
+        in.src  = buf;
+        in.size = n;
+        in.pos  = 0;
+        do
+        {
+            /** a full buffer might mean there's more where it came from */
+            out.dst  = obuf;
+            out.size = sizeof (obuf);
+            out.pos  = 0;
+            r = ZSTD_decompressStream(zs, &out, &in);
+            if (ZSTD_isError(r) || (ofd != -1 &&
+                write(ofd, obuf, out.pos) != (ssize_t)out.pos))
+            {
+                goto err;
+            }
+            digest_update(d, obuf, out.pos);
+            total += out.pos;
+        } while (in.pos < in.size || out.pos == out.size);
+    }
+    ZSTD_freeDStream(zs);
+    return (total == rec->length ? 1 : -1);
+
+err:
+    if (zs)
+    {
+        ZSTD_freeDStream(zs);
+    }
+    return (-1);
+}
+#endif /** HAVE_ZSTD */
+
+#if (HAVE_LZ4)
+static int64_t
+compress_lz4(int sfd, archive_record_t *rec, int zfd)
+{
+    size_t r, room;
+    ssize_t n;
+    uint64_t off, total;
+    uint8_t *obuf;
+    LZ4F_cctx *lz;
+    uint8_t buf[COMPRESS_BUFFER_SIZE];
+
+    lz   = NULL;
+    room = LZ4F_compressBound(sizeof (buf), NULL);
+    obuf = malloc(room);
+    if (obuf == NULL ||
+        LZ4F_isError(LZ4F_createCompressionContext(&lz, LZ4F_VERSION)))
+    {
+        goto err;
+    }
+    total = 0;
+    r = LZ4F_compressBegin(lz, obuf, room, NULL);
+    if (LZ4F_isError(r) || compress_put(zfd, obuf, r, &total) == -1)
+    {
+        goto err;
+    }
+    for (off = 0; off < rec->length; off += n)
+    {
+        n = MIN(rec->length - off, sizeof (buf));
+        n = pread(sfd, buf, n, rec->offset + off);
+        if (n <= 0)
+        {
+            goto err;
+        }
+        r = LZ4F_compressUpdate(lz, obuf, room, buf, n, NULL);
+        if (LZ4F_isError(r) || compress_put(zfd, obuf, r, &total) == -1)
+        {
+            goto err;
+        }
+    }
+    r = LZ4F_compressEnd(lz, obuf, room, NULL);
+    if (LZ4F_isError(r) || compress_put(zfd, obuf, r, &total) == -1)
+    {
+        goto err;
+    }
+    LZ4F_freeCompressionContext(lz);
+    free(obuf);
+    return (total);
+
+err:
+    if (lz)
+    {
+        LZ4F_freeCompressionContext(lz);
+    }
+    free(obuf);
+    return (-1);
+}
+
+static int
+decompress_lz4(int sfd, archive_record_t *rec, int ofd, digest_t *d)
+{
+    size_t r, in, out;
+    ssize_t n;
+    uint64_t off, total;
+    LZ4F_dctx *lz;
+    uint8_t buf[COMPRESS_BUFFER_SIZE], obuf[COMPRESS_BUFFER_SIZE];
+
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&lz, LZ4F_VERSION)))
+    {
+        return (-1);
+    }
+    for (off = 0, total = 0; off < rec->stored; off += n)
+    {
+        n = MIN(rec->stored - off, sizeof (buf));
+        n = pread(sfd, buf, n, rec->offset + off);
+        if (n <= 0)
+        {
+            goto err;
+        }
+        out = sizeof (obuf);
+        for (in = 0; in < (size_t)n || out == sizeof (obuf); in += r)
+        {
+            /** it says how much of the input it took each time */
+            r   = n - in;
+            out = sizeof (obuf);
+            if (LZ4F_isError(LZ4F_decompress(lz, obuf, &out, buf + in, &r,
+                NULL)) || (ofd != -1 && write(ofd, obuf, out) !=
+                (ssize_t)out))
+            {
+                goto err;
+            }
+            digest_update(d, obuf, out);
+            total += out;
+            if (r == 0 && out == 0)
+            {
+                break;
+            }
+        }
+    }
+    LZ4F_freeDecompressionContext(lz);
+    return (total == rec->length ? 1 : -1);
+
+err:
+    LZ4F_freeDecompressionContext(lz);
+    return (-1);
+}
+#endif /** HAVE_LZ4 */
+
+/** EOF */
@@ -31,34 +31,289 @@
 
 #include "nfex.h"
 #include "conf.h"
+#include "util.h"
 
-static int id;
+/** options given after a file type specifier, reset for every line */
+static struct
+{
+    anchortype_t anchor;
+    u_long window;
+    int novalidate;
+    int noresolve;
+    int nothrottle;
+    int pack;                   /* compress=, 1 or -1, 0 goes by the type */
+    uint32_t max;
+    uint32_t rate;
+    uint32_t burst;
+    int priority;
+    uint32_t commit;
+} opts;
+
+/** glue two pieces of a specifier together, both are used up */
+char *
+config_cat(char *s1, char *s2)
+{
+    char *p;
+
+    p = emalloc(strlen(s1) + strlen(s2) + 1);
+    strcpy(p, s1);
+    strcat(p, s2);
+    free(s1);
+    free(s2);
+
+    return (p);
+}
+
+void
+config_option(char *key, char *value, void *a)
+{
+    if (strcmp(key, "anchor") == 0)
+    {
+        if (strcmp(value, "stream") == 0)
+        {
+            opts.anchor = ANCHOR_STREAM;
+        }
+        else if (strcmp(value, "body") == 0)
+        {
+            opts.anchor = ANCHOR_BODY;
+        }
+        else
+        {
+            error("Invalid anchor in file format specifier\n");
+        }
+    }
+    else if (strcmp(key, "within") == 0)
+    {
+        if (!sscanf(value, "%lu", &opts.window) || opts.window == 0)
+        {
+            error("Invalid window in file format specifier\n");
+        }
+        opts.anchor = ANCHOR_WITHIN;
+    }
+    else if (strcmp(key, "validate") == 0)
+    {
+        if (strcmp(value, "no") == 0)
+        {
+            opts.novalidate = 1;
+        }
+        else if (strcmp(value, "yes") == 0)
+        {
+            opts.novalidate = 0;
+        }
+        else
+        {
+            error("Invalid validate in file format specifier\n");
+        }
+    }
+    else if (strcmp(key, "resolve") == 0)
+    {
+        if (strcmp(value, "no") == 0)
+        {
+            opts.noresolve = 1;
+        }
+        else if (strcmp(value, "yes") == 0)
+        {
+            opts.noresolve = 0;
+        }
+        else
+        {
+            error("Invalid resolve in file format specifier\n");
+        }
+    }
+    else if (strcmp(key, "throttle") == 0)
+    {
+        if (strcmp(value, "no") == 0)
+        {
+            opts.nothrottle = 1;
+        }
+        else if (strcmp(value, "yes") == 0)
+        {
+            opts.nothrottle = 0;
+        }
+        else
+        {
+            error("Invalid throttle in file format specifier\n");
+        }
+    }
+    else if (strcmp(key, "compress") == 0)
+    {
+        if (strcmp(value, "no") == 0)
+        {
+            opts.pack = -1;
+        }
+        else if (strcmp(value, "yes") == 0)
+        {
+            opts.pack = 1;
+        }
+        else
+        {
+            error("Invalid compress in file format specifier\n");
+        }
+    }
+    else if (strcmp(key, "max") == 0)
+    {
+        if (!sscanf(value, "%u", &opts.max) || opts.max == 0)
+        {
+            error("Invalid max in file format specifier\n");
+        }
+    }
+    else if (strcmp(key, "rate") == 0)
+    {
+        if (!sscanf(value, "%u", &opts.rate) || opts.rate == 0)
+        {
+            error("Invalid rate in file format specifier\n");
+        }
+    }
+    else if (strcmp(key, "burst") == 0)
+    {
+        if (!sscanf(value, "%u", &opts.burst) || opts.burst == 0)
+        {
+            error("Invalid burst in file format specifier\n");
+        }
+    }
+    else if (strcmp(key, "priority") == 0)
+    {
+        if (!sscanf(value, "%d", &opts.priority))
+        {
+            error("Invalid priority in file format specifier\n");
+        }
+    }
+    else if (strcmp(key, "commit") == 0)
+    {
+        if (!sscanf(value, "%u", &opts.commit) || opts.commit == 0 ||
+            opts.commit > EXTRACT_COMMIT_MAX)
+        {
+            error("Invalid commit in file format specifier\n");
+        }
+    }
+    else
+    {
+        error("Unknown option in file format specifier\n");
+    }
+}
 
 void
 config_type(char *extension, char *maxlength, char *hspec, char *fspec, void *a)
 {
     unsigned long maxlen;
-    ncc_t *ncc;
+    size_t len;
+    fileid_t *fileid;
+    srch_set_t *set;
 
-    ncc = (ncc_t *)a;
+    set = (srch_set_t *)a;
 
     if (!sscanf(maxlength, "%lu", &maxlen))
     {
         error("Invalid maximum length in file format specifier");
     }
 
-    search_compile(&(ncc->srch_machine), id, strdup(extension), maxlen, hspec, 
-            HEADER);
+    /** every file type is known by its place in the fileid table */
+    set->fileids = erealloc(set->fileids, 
+        (set->nfileids + 1) * sizeof (fileid_t *));
+    fileid          = ecalloc(1, sizeof (fileid_t));
+    fileid->id      = set->nfileids;
+    set->fileids[set->nfileids++] = fileid;
+    fileid->ext     = strdup(extension);
+    fileid->maxlen  = maxlen;
+    fileid->anchor  = opts.anchor;
+    fileid->window  = opts.window;
+    fileid->profile = set->nprofiles - 1;
+    fileid->max      = opts.max;
+    fileid->rate     = opts.rate;
+    fileid->burst    = opts.burst ? opts.burst : opts.rate;
+    fileid->priority = opts.priority;
+    fileid->commit   = opts.commit;
+    fileid->footer   = fspec != NULL;
+    fileid->nothrottle = opts.nothrottle;
+    fileid->nopack     = opts.pack ? opts.pack == -1 : 
+        archive_nopack(extension);
+    if (opts.novalidate == 0)
+    {
+        fileid->validate = validate_lookup(extension);
+    }
+    if (opts.noresolve == 0)
+    {
+        fileid->resolve = resolve_lookup(extension);
+    }
+
+    /*
+     * headers go in whichever machine matches where they're allowed to 
+     * start.  anything not tied to the start of a stream could just as 
+     * well show up at the start of an HTTP body
+     */
+    switch (fileid->anchor)
+    {
+        case ANCHOR_STREAM:
+            len = search_compile(&(set->strm_machine), fileid, hspec, HEADER);
+            if (len > SRCH_ANCHOR_MAX)
+            {
+                error("Anchored file format specifier is too long\n");
+            }
+            set->anch_depth = MAX(set->anch_depth, len);
+            break;
+        case ANCHOR_BODY:
+            search_compile(&(set->body_machine), fileid, hspec, HEADER);
+            break;
+        case ANCHOR_WITHIN:
+            set->anch_depth = MAX(set->anch_depth, fileid->window);
+            /* FALLTHROUGH */
+        default:
+            search_compile(&(set->srch_machine), fileid, hspec, HEADER);
+            search_compile(&(set->body_machine), fileid, hspec, HEADER);
+            break;
+    }
 
     /** if a footer is specified in the confi file, compile it here */
     if (fspec)
     {
-        search_compile(&(ncc->srch_machine), id, strdup(extension), maxlen, 
-            fspec, FOOTER);
+        search_compile(&(set->foot_machine), fileid, fspec, FOOTER);
+    }
+    printf("%2d %s search code compiled (%ld byte max", set->nfileids, 
+            extension, maxlen);
+    switch (fileid->anchor)
+    {
+        case ANCHOR_STREAM:
+            printf(", stream anchored");
+            break;
+        case ANCHOR_BODY:
+            printf(", body anchored");
+            break;
+        case ANCHOR_WITHIN:
+            printf(", first %ld bytes", fileid->window);
+            break;
+        default:
+            break;
+    }
+    if (fileid->validate)
+    {
+        printf(", validated");
+    }
+    if (fileid->resolve)
+    {
+        printf(", sized");
+    }
+    if (fileid->max)
+    {
+        printf(", %u at once", fileid->max);
+    }
+    if (fileid->rate)
+    {
+        printf(", %u/s", fileid->rate);
+    }
+    if (fileid->priority)
+    {
+        printf(", priority %d", fileid->priority);
+    }
+    if (fileid->commit)
+    {
+        printf(", held to %u bytes", fileid->commit);
+    }
+    if (opts.pack == -1)
+    {
+        printf(", not compressed");
     }
-    id++;
-    printf("%2d %s search code compiled (%ld byte max)\n", id, extension, 
-            maxlen);
+    printf(")\n");
+    memset(&opts, 0, sizeof (opts));
 }
 
 /** EOF */
@@ -22,7 +22,11 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include "conf.h"
+
+int yylex(void);
+void yyerror(void *, char *);
 %}
 
 %union {
@@ -33,6 +37,7 @@
 %token <string> WORD
 %token <string> SPECIFIER
 %token ENDLINE
+%type <string> pattern atom class classbody classatom
 %parse-param {void *a}
 %%
 
@@ -41,23 +46,46 @@ expressionlist: expression
 	| expressionlist expression
 	;
 
-expression: WORD '(' NUMBER ',' SPECIFIER ')' ENDLINE			{config_type($1, $3, $5, NULL, a);}
-	|	WORD '(' NUMBER ',' SPECIFIER ',' SPECIFIER ')' ENDLINE {config_type($1, $3, $5, $7, a);}
-	|	WORD '(' NUMBER ',' SPECIFIER ',' NUMBER ')' ENDLINE 	{config_type($1, $3, $5, $7, a);}
-	|	WORD '(' NUMBER ',' SPECIFIER ',' WORD ')' ENDLINE 		{config_type($1, $3, $5, $7, a);}
-	|	WORD '(' NUMBER ',' WORD ')' ENDLINE					{config_type($1, $3, $5, NULL, a);}
-	|	WORD '(' NUMBER ',' WORD ',' SPECIFIER ')' ENDLINE		{config_type($1, $3, $5, $7, a);}
-	|	WORD '(' NUMBER ',' WORD ',' NUMBER	')' ENDLINE			{config_type($1, $3, $5, $7, a);}
-	|	WORD '(' NUMBER ',' WORD ',' WORD ')' ENDLINE			{config_type($1, $3, $5, $7, a);}
-	|	WORD '(' NUMBER ',' NUMBER ')' ENDLINE					{config_type($1, $3, $5, NULL, a);}
-	|	WORD '(' NUMBER ',' NUMBER ',' SPECIFIER ')' ENDLINE	{config_type($1, $3, $5, $7, a);}
-	|	WORD '(' NUMBER ',' NUMBER ',' NUMBER ')' ENDLINE		{config_type($1, $3, $5, $7, a);}
-	|	WORD '(' NUMBER ',' NUMBER ',' WORD ')' ENDLINE			{config_type($1, $3, $5, $7, a);}
+expression: WORD '(' NUMBER ',' pattern ')' options ENDLINE				{config_type($1, $3, $5, NULL, a);}
+	|	WORD '(' NUMBER ',' pattern ',' pattern ')' options ENDLINE		{config_type($1, $3, $5, $7, a);}
+	;
+
+pattern: atom
+	|	pattern atom													{$$ = config_cat($1, $2);}
+	;
+
+atom: SPECIFIER
+	|	WORD
+	|	NUMBER
+	|	class
+	;
+
+class: '[' classbody ']'												{$$ = config_cat(config_cat(strdup("["), $2), strdup("]"));}
+	;
+
+classbody: classatom
+	|	classbody classatom												{$$ = config_cat($1, $2);}
+	;
+
+classatom: SPECIFIER
+	|	WORD
+	|	NUMBER
+	|	'-'																{$$ = strdup("-");}
+	|	'^'																{$$ = strdup("^");}
+	;
+
+options: /* empty */
+	|	options option
+	;
+
+option: WORD '=' WORD											{config_option($1, $3, a);}
+	|	WORD '=' NUMBER											{config_option($1, $3, a);}
 	;
 
 %%
 #include <stdio.h>
-yyerror(char *s)
+void
+yyerror(void *a, char *s)
 {
 	printf("%s\n", s);
 }
@@ -0,0 +1,301 @@
+/*
+ * dedup.c - duplicate files
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include "nfex.h"
+#include "util.h"
+
+/*
+ * the same installer or image goes by over and over.  every file is
+ * SHA-256'd as it's written (along with any other --hashes) and once it's
+ * done, checked against the ones we've kept.  a repeat either becomes a
+ * hard link to the copy we have (DEDUP_LINK) or goes altogether, its index
+ * entry naming the copy (DEDUP_REF).  every index entry gets the digests.
+ * with a store, what's kept is remembered from one run to the next.  with
+ * -m the table gets a share of it, and forgets the files it's seen least
+ * recently to stay inside that; one of them coming by again is kept anew.
+ */
+int
+dedup_init(ncc_t *ncc, int mode, char *store)
+{
+    dedup_t *dd;
+    FILE *fp;
+    uint64_t size;
+    int i;
+    char hex[SHA256_LEN * 2 + 1], path[FILENAME_BUFFER_SIZE];
+    uint8_t digest[SHA256_LEN];
+    unsigned int x;
+
+    dd        = &(ncc->dedup);
+    dd->mode  = mode;
+    dd->ht    = ecalloc(DEDUP_HT_SIZE, sizeof (dedup_object_t *));
+    dd->limit = ncc->mem_limit / DEDUP_MEM_SHARE;
+    ncc->mem[NFEX_MEM_DEDUP] += DEDUP_HT_SIZE * sizeof (dedup_object_t *);
+    if (store == NULL)
+    {
+        return (1);
+    }
+
+    /** one "digest size path" a line, later lines win */
+    fp = fopen(store, "r");
+    if (fp)
+    {
+        while (fscanf(fp, "%64s %" SCNu64 " %4095[^\n]\n", hex, &size,
+            path) == 3)
+        {
+            for (i = 0; i < SHA256_LEN; i++)
+            {
+                if (sscanf(hex + 2 * i, "%2x", &x) != 1)
+                {
+                    break;
+                }
+                digest[i] = x;
+            }
+            if (i == SHA256_LEN && dedup_add(ncc, digest, size, path) == NULL)
+            {
+                fprintf(stderr, "can't remember %s: %s\n", path, 
+                    strerror(errno));
+                break;
+            }
+        }
+        fclose(fp);
+        printf("%u files already kept in %s\n", dd->nobjects, store);
+    }
+    dd->store = fopen(store, "a");
+    if (dd->store == NULL)
+    {
+        fprintf(stderr, "can't open dedup store %s: %s\n", store,
+            strerror(errno));
+        return (-1);
+    }
+    return (1);
+}
+
+/*
+ * an extraction's file is finished, see if we already have it.  hex is
+ * its digests for the index, the last of them the SHA-256 in digest.
+ */
+void
+dedup_file(extract_list_t *p, char *hex, uint8_t *digest, ncc_t *ncc)
+{
+    size_t n;
+    char *name;
+    char tmp[FILENAME_BUFFER_SIZE];
+    dedup_object_t *o;
+    nfex_profile_t *pr;
+
+    o = dedup_lookup(&(ncc->dedup), digest);
+    if (o && access(o->path, F_OK) == -1)
+    {
+        /** the copy we kept is gone, this one takes its place */
+        o = NULL;
+    }
+    if (o == NULL)
+    {
+        o = dedup_add(ncc, digest, p->nwritten, p->path);
+        if (o == NULL && (ncc->flags & NFEX_VERBOSE))
+        {
+            fprintf(stderr, "can't remember %s: %s\n", p->path, 
+                strerror(errno));
+        }
+        if (o && ncc->dedup.store)
+        {
+            fprintf(ncc->dedup.store, "%s %" PRIu64 " %s\n", 
+                hex + strlen(hex) - 2 * SHA256_LEN, o->size, o->path);
+            fflush(ncc->dedup.store);
+        }
+        extract_index(p, p->path + p->name, hex, ncc);
+        return;
+    }
+
+    dedup_touch(&(ncc->dedup), o);
+    ncc->stats.dups++;
+    ncc->stats.dup_bytes += p->nwritten;
+    name = p->path + p->name;
+    if (ncc->dedup.mode == DEDUP_LINK)
+    {
+        /** swap our copy for a link to the first, it's never missing */
+        snprintf(tmp, sizeof (tmp), "%s.dedup", p->path);
+        if (link(o->path, tmp) == -1 || rename(tmp, p->path) == -1)
+        {
+            if (ncc->flags & NFEX_VERBOSE)
+            {
+                fprintf(stderr, "can't link %s to %s, keeping it: %s\n",
+                    p->path, o->path, strerror(errno));
+            }
+            unlink(tmp);
+        }
+    }
+    else
+    {
+        unlink(p->path);
+        pr   = &(ncc->profile[p->fileid->profile]);
+        n    = strlen(pr->dir[0].path);
+        name = o->path;
+        if (strncmp(name, pr->dir[0].path, n) == 0)
+        {
+            name += n;
+        }
+    }
+    extract_index(p, name, hex, ncc);
+}
+
+static dedup_object_t *
+dedup_lookup(dedup_t *dd, uint8_t *digest)
+{
+    dedup_object_t *o;
+
+    /** it's a SHA-256, any two bytes of it are as good a hash as any */
+    for (o = dd->ht[digest[0] << 8 | digest[1]]; o; o = o->next)
+    {
+        if (memcmp(o->digest, digest, SHA256_LEN) == 0)
+        {
+            return (o);
+        }
+    }
+    return (NULL);
+}
+
+/** remember a file we're keeping, or where it is now if we had it */
+static dedup_object_t *
+dedup_add(ncc_t *ncc, uint8_t *digest, uint64_t size, char *path)
+{
+    char *q;
+    dedup_t *dd;
+    dedup_object_t *o;
+
+    dd = &(ncc->dedup);
+    q  = strdup(path);
+    if (q == NULL)
+    {
+        return (NULL);
+    }
+    o = dedup_lookup(dd, digest);
+    if (o)
+    {
+        ncc->mem[NFEX_MEM_DEDUP] -= strlen(o->path) + 1;
+        ncc->mem[NFEX_MEM_DEDUP] += strlen(q) + 1;
+        free(o->path);
+        o->path = q;
+        o->size = size;
+        dedup_touch(dd, o);
+        dedup_forget(ncc);
+        return (o);
+    }
+    o = malloc(sizeof (*o));
+    if (o == NULL)
+    {
+        free(q);
+        return (NULL);
+    }
+    memcpy(o->digest, digest, SHA256_LEN);
+    o->size  = size;
+    o->path  = q;
+    o->next  = dd->ht[digest[0] << 8 | digest[1]];
+    o->older = NULL;
+    o->newer = NULL;
+    dd->ht[digest[0] << 8 | digest[1]] = o;
+    dd->nobjects++;
+    ncc->mem[NFEX_MEM_DEDUP] += sizeof (*o) + strlen(q) + 1;
+    dedup_touch(dd, o);
+    dedup_forget(ncc);
+
+    return (o);
+}
+
+/** it's the most recently seen now */
+static void
+dedup_touch(dedup_t *dd, dedup_object_t *o)
+{
+    if (dd->newest == o)
+    {
+        return;
+    }
+    if (o->older)
+    {
+        o->older->newer = o->newer;
+    }
+    else if (dd->oldest == o)
+    {
+        dd->oldest = o->newer;
+    }
+    if (o->newer)
+    {
+        o->newer->older = o->older;
+    }
+    o->older = dd->newest;
+    o->newer = NULL;
+    if (dd->newest)
+    {
+        dd->newest->newer = o;
+    }
+    dd->newest = o;
+    if (dd->oldest == NULL)
+    {
+        dd->oldest = o;
+    }
+}
+
+/*
+ * over its share of -m, the files seen least recently are forgotten.  the
+ * one just added is never the one to go.
+ */
+static void
+dedup_forget(ncc_t *ncc)
+{
+    dedup_t *dd;
+    dedup_object_t *o, **pp;
+
+    dd = &(ncc->dedup);
+    while (dd->limit && ncc->mem[NFEX_MEM_DEDUP] > dd->limit &&
+        dd->oldest && dd->oldest != dd->newest)
+    {
+        o = dd->oldest;
+        for (pp = &(dd->ht[o->digest[0] << 8 | o->digest[1]]); *pp != o;
+            pp = &((*pp)->next));
+        *pp = o->next;
+        dd->oldest = o->newer;
+        dd->oldest->older = NULL;
+        ncc->mem[NFEX_MEM_DEDUP] -= sizeof (*o) + strlen(o->path) + 1;
+        dd->nobjects--;
+        ncc->stats.dedup_forgotten++;
+        free(o->path);
+        free(o);
+    }
+}
+
+void
+dedup_free(ncc_t *ncc)
+{
+    uint32_t i;
+    dedup_t *dd;
+    dedup_object_t *o;
+
+    dd = &(ncc->dedup);
+    for (i = 0; dd->ht && i < DEDUP_HT_SIZE; i++)
+    {
+        while ((o = dd->ht[i]))
+        {
+            dd->ht[i] = o->next;
+            free(o->path);
+            free(o);
+        }
+    }
+    free(dd->ht);
+    dd->ht     = NULL;
+    dd->oldest = NULL;
+    dd->newest = NULL;
+    ncc->mem[NFEX_MEM_DEDUP] = 0;
+    if (dd->store)
+    {
+        fclose(dd->store);
+        dd->store = NULL;
+    }
+}
+
+/** EOF */
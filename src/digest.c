@@ -0,0 +1,511 @@
+/*
+ * digest.c - message digests
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "digest.h"
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/** a 1 bit and then zeros up to where the length goes */
+static const uint8_t digest_padding[DIGEST_BLOCK] = {0x80};
+
+/*
+ * every extraction can be hashed as it's written, so its digests go in the
+ * index and nothing downstream has to read the file back to get them
+ */
+void
+digest_init(digest_t *d, int which)
+{
+    d->which = which;
+    if (which & DIGEST_MD5)
+    {
+        md5_init(&(d->md5));
+    }
+    if (which & DIGEST_SHA1)
+    {
+        sha1_init(&(d->sha1));
+    }
+    if (which & DIGEST_SHA256)
+    {
+        sha256_init(&(d->sha256));
+    }
+}
+
+void
+digest_update(digest_t *d, const uint8_t *data, size_t len)
+{
+    if (d->which & DIGEST_MD5)
+    {
+        md5_update(&(d->md5), data, len);
+    }
+    if (d->which & DIGEST_SHA1)
+    {
+        sha1_update(&(d->sha1), data, len);
+    }
+    if (d->which & DIGEST_SHA256)
+    {
+        sha256_update(&(d->sha256), data, len);
+    }
+}
+
+/*
+ * finish up, sum gets the digests as they are and hex (at most 
+ * DIGEST_HEX_MAX) in md5, sha1, sha256 order with ", " between.
+ */
+void
+digest_final(digest_t *d, digest_sum_t *sum, char *hex)
+{
+    char *q;
+
+    q = hex;
+    *q = '\0';
+    sum->which = d->which;
+    if (d->which & DIGEST_MD5)
+    {
+        md5_final(&(d->md5), sum->md5);
+        digest_hex(sum->md5, MD5_LEN, q);
+        q += strlen(q);
+    }
+    if (d->which & DIGEST_SHA1)
+    {
+        q += sprintf(q, "%s", q == hex ? "" : ", ");
+        sha1_final(&(d->sha1), sum->sha1);
+        digest_hex(sum->sha1, SHA1_LEN, q);
+        q += strlen(q);
+    }
+    if (d->which & DIGEST_SHA256)
+    {
+        q += sprintf(q, "%s", q == hex ? "" : ", ");
+        sha256_final(&(d->sha256), sum->sha256);
+        digest_hex(sum->sha256, SHA256_LEN, q);
+    }
+}
+
+void
+md5_init(md5_t *s)
+{
+    s->h[0] = 0x67452301;
+    s->h[1] = 0xefcdab89;
+    s->h[2] = 0x98badcfe;
+    s->h[3] = 0x10325476;
+    s->len  = 0;
+}
+
+void
+md5_update(md5_t *s, const uint8_t *data, size_t len)
+{
+    size_t have, n;
+
+    have    = s->len % DIGEST_BLOCK;
+    s->len += len;
+    if (have)
+    {
+        n = DIGEST_BLOCK - have;
+        if (len < n)
+        {
+            memcpy(s->buf + have, data, len);
+            return;
+        }
+        memcpy(s->buf + have, data, n);
+        md5_block(s, s->buf);
+        data += n;
+        len  -= n;
+    }
+    for (; len >= DIGEST_BLOCK; data += DIGEST_BLOCK, len -= DIGEST_BLOCK)
+    {
+        md5_block(s, data);
+    }
+    memcpy(s->buf, data, len);
+}
+
+void
+md5_final(md5_t *s, uint8_t *digest)
+{
+    int i;
+    uint8_t len[8];
+
+    digest_length(len, s->len * 8, 0);
+    md5_update(s, digest_padding, 1 + (119 - s->len % DIGEST_BLOCK) % 64);
+    md5_update(s, len, 8);
+    for (i = 0; i < 4; i++)
+    {
+        digest[4 * i]     = s->h[i];
+        digest[4 * i + 1] = s->h[i] >> 8;
+        digest[4 * i + 2] = s->h[i] >> 16;
+        digest[4 * i + 3] = s->h[i] >> 24;
+    }
+}
+
+/** the four rounds, unrolled, with their shifts and sines */
+#define MD5_STEP(f, a, b, c, d, x, t, r)                                     \
+    do                                                                       \
+    {                                                                        \
+        (a) += f((b), (c), (d)) + (x) + (t);                                 \
+        (a)  = ROL32((a), (r)) + (b);                                        \
+    } while (0)
+#define MD5_F(x, y, z)  ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z)  ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z)  ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z)  ((y) ^ ((x) | ~(z)))
+
+static void
+md5_block(md5_t *s, const uint8_t *p)
+{
+    int i;
+    uint32_t a, b, c, d, x[16];
+
+    for (i = 0; i < 16; i++)
+    {
+        x[i] = (uint32_t)p[4 * i] | (uint32_t)p[4 * i + 1] << 8 |
+               (uint32_t)p[4 * i + 2] << 16 | (uint32_t)p[4 * i + 3] << 24;
+    }
+    a = s->h[0];
+    b = s->h[1];
+    c = s->h[2];
+    d = s->h[3];
+
+    MD5_STEP(MD5_F, a, b, c, d, x[0],  0xd76aa478, 7);
+    MD5_STEP(MD5_F, d, a, b, c, x[1],  0xe8c7b756, 12);
+    MD5_STEP(MD5_F, c, d, a, b, x[2],  0x242070db, 17);
+    MD5_STEP(MD5_F, b, c, d, a, x[3],  0xc1bdceee, 22);
+    MD5_STEP(MD5_F, a, b, c, d, x[4],  0xf57c0faf, 7);
+    MD5_STEP(MD5_F, d, a, b, c, x[5],  0x4787c62a, 12);
+    MD5_STEP(MD5_F, c, d, a, b, x[6],  0xa8304613, 17);
+    MD5_STEP(MD5_F, b, c, d, a, x[7],  0xfd469501, 22);
+    MD5_STEP(MD5_F, a, b, c, d, x[8],  0x698098d8, 7);
+    MD5_STEP(MD5_F, d, a, b, c, x[9],  0x8b44f7af, 12);
+    MD5_STEP(MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17);
+    MD5_STEP(MD5_F, b, c, d, a, x[11], 0x895cd7be, 22);
+    MD5_STEP(MD5_F, a, b, c, d, x[12], 0x6b901122, 7);
+    MD5_STEP(MD5_F, d, a, b, c, x[13], 0xfd987193, 12);
+    MD5_STEP(MD5_F, c, d, a, b, x[14], 0xa679438e, 17);
+    MD5_STEP(MD5_F, b, c, d, a, x[15], 0x49b40821, 22);
+
+    MD5_STEP(MD5_G, a, b, c, d, x[1],  0xf61e2562, 5);
+    MD5_STEP(MD5_G, d, a, b, c, x[6],  0xc040b340, 9);
+    MD5_STEP(MD5_G, c, d, a, b, x[11], 0x265e5a51, 14);
+    MD5_STEP(MD5_G, b, c, d, a, x[0],  0xe9b6c7aa, 20);
+    MD5_STEP(MD5_G, a, b, c, d, x[5],  0xd62f105d, 5);
+    MD5_STEP(MD5_G, d, a, b, c, x[10], 0x02441453, 9);
+    MD5_STEP(MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14);
+    MD5_STEP(MD5_G, b, c, d, a, x[4],  0xe7d3fbc8, 20);
+    MD5_STEP(MD5_G, a, b, c, d, x[9],  0x21e1cde6, 5);
+    MD5_STEP(MD5_G, d, a, b, c, x[14], 0xc33707d6, 9);
+    MD5_STEP(MD5_G, c, d, a, b, x[3],  0xf4d50d87, 14);
+    MD5_STEP(MD5_G, b, c, d, a, x[8],  0x455a14ed, 20);
+    MD5_STEP(MD5_G, a, b, c, d, x[13], 0xa9e3e905, 5);
+    MD5_STEP(MD5_G, d, a, b, c, x[2],  0xfcefa3f8, 9);
+    MD5_STEP(MD5_G, c, d, a, b, x[7],  0x676f02d9, 14);
+    MD5_STEP(MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20);
+
+    MD5_STEP(MD5_H, a, b, c, d, x[5],  0xfffa3942, 4);
+    MD5_STEP(MD5_H, d, a, b, c, x[8],  0x8771f681, 11);
+    MD5_STEP(MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16);
+    MD5_STEP(MD5_H, b, c, d, a, x[14], 0xfde5380c, 23);
+    MD5_STEP(MD5_H, a, b, c, d, x[1],  0xa4beea44, 4);
+    MD5_STEP(MD5_H, d, a, b, c, x[4],  0x4bdecfa9, 11);
+    MD5_STEP(MD5_H, c, d, a, b, x[7],  0xf6bb4b60, 16);
+    MD5_STEP(MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23);
+    MD5_STEP(MD5_H, a, b, c, d, x[13], 0x289b7ec6, 4);
+    MD5_STEP(MD5_H, d, a, b, c, x[0],  0xeaa127fa, 11);
+    MD5_STEP(MD5_H, c, d, a, b, x[3],  0xd4ef3085, 16);
+    MD5_STEP(MD5_H, b, c, d, a, x[6],  0x04881d05, 23);
+    MD5_STEP(MD5_H, a, b, c, d, x[9],  0xd9d4d039, 4);
+    MD5_STEP(MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11);
+    MD5_STEP(MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16);
+    MD5_STEP(MD5_H, b, c, d, a, x[2],  0xc4ac5665, 23);
+
+    MD5_STEP(MD5_I, a, b, c, d, x[0],  0xf4292244, 6);
+    MD5_STEP(MD5_I, d, a, b, c, x[7],  0x432aff97, 10);
+    MD5_STEP(MD5_I, c, d, a, b, x[14], 0xab9423a7, 15);
+    MD5_STEP(MD5_I, b, c, d, a, x[5],  0xfc93a039, 21);
+    MD5_STEP(MD5_I, a, b, c, d, x[12], 0x655b59c3, 6);
+    MD5_STEP(MD5_I, d, a, b, c, x[3],  0x8f0ccc92, 10);
+    MD5_STEP(MD5_I, c, d, a, b, x[10], 0xffeff47d, 15);
+    MD5_STEP(MD5_I, b, c, d, a, x[1],  0x85845dd1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, x[8],  0x6fa87e4f, 6);
+    MD5_STEP(MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10);
+    MD5_STEP(MD5_I, c, d, a, b, x[6],  0xa3014314, 15);
+    MD5_STEP(MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, x[4],  0xf7537e82, 6);
+    MD5_STEP(MD5_I, d, a, b, c, x[11], 0xbd3af235, 10);
+    MD5_STEP(MD5_I, c, d, a, b, x[2],  0x2ad7d2bb, 15);
+    MD5_STEP(MD5_I, b, c, d, a, x[9],  0xeb86d391, 21);
+
+    s->h[0] += a;
+    s->h[1] += b;
+    s->h[2] += c;
+    s->h[3] += d;
+}
+
+void
+sha1_init(sha1_t *s)
+{
+    s->h[0] = 0x67452301;
+    s->h[1] = 0xefcdab89;
+    s->h[2] = 0x98badcfe;
+    s->h[3] = 0x10325476;
+    s->h[4] = 0xc3d2e1f0;
+    s->len  = 0;
+}
+
+void
+sha1_update(sha1_t *s, const uint8_t *data, size_t len)
+{
+    size_t have, n;
+
+    have    = s->len % DIGEST_BLOCK;
+    s->len += len;
+    if (have)
+    {
+        n = DIGEST_BLOCK - have;
+        if (len < n)
+        {
+            memcpy(s->buf + have, data, len);
+            return;
+        }
+        memcpy(s->buf + have, data, n);
+        sha1_block(s, s->buf);
+        data += n;
+        len  -= n;
+    }
+    for (; len >= DIGEST_BLOCK; data += DIGEST_BLOCK, len -= DIGEST_BLOCK)
+    {
+        sha1_block(s, data);
+    }
+    memcpy(s->buf, data, len);
+}
+
+void
+sha1_final(sha1_t *s, uint8_t *digest)
+{
+    int i;
+    uint8_t len[8];
+
+    digest_length(len, s->len * 8, 1);
+    sha1_update(s, digest_padding, 1 + (119 - s->len % DIGEST_BLOCK) % 64);
+    sha1_update(s, len, 8);
+    for (i = 0; i < 5; i++)
+    {
+        digest[4 * i]     = s->h[i] >> 24;
+        digest[4 * i + 1] = s->h[i] >> 16;
+        digest[4 * i + 2] = s->h[i] >> 8;
+        digest[4 * i + 3] = s->h[i];
+    }
+}
+
+static void
+sha1_block(sha1_t *s, const uint8_t *p)
+{
+    int i;
+    uint32_t a, b, c, d, e, t;
+    uint32_t w[80];
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (; i < 80; i++)
+    {
+        w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    a = s->h[0];
+    b = s->h[1];
+    c = s->h[2];
+    d = s->h[3];
+    e = s->h[4];
+    for (i = 0; i < 80; i++)
+    {
+        if (i < 20)
+        {
+            t = ((b & c) | (~b & d)) + 0x5a827999;
+        }
+        else if (i < 40)
+        {
+            t = (b ^ c ^ d) + 0x6ed9eba1;
+        }
+        else if (i < 60)
+        {
+            t = ((b & c) | (b & d) | (c & d)) + 0x8f1bbcdc;
+        }
+        else
+        {
+            t = (b ^ c ^ d) + 0xca62c1d6;
+        }
+        t += ROL32(a, 5) + e + w[i];
+        e  = d;
+        d  = c;
+        c  = ROL32(b, 30);
+        b  = a;
+        a  = t;
+    }
+    s->h[0] += a;
+    s->h[1] += b;
+    s->h[2] += c;
+    s->h[3] += d;
+    s->h[4] += e;
+}
+
+static const uint32_t sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+void
+sha256_init(sha256_t *s)
+{
+    s->h[0] = 0x6a09e667;
+    s->h[1] = 0xbb67ae85;
+    s->h[2] = 0x3c6ef372;
+    s->h[3] = 0xa54ff53a;
+    s->h[4] = 0x510e527f;
+    s->h[5] = 0x9b05688c;
+    s->h[6] = 0x1f83d9ab;
+    s->h[7] = 0x5be0cd19;
+    s->len  = 0;
+}
+
+/** hash a run of bytes, whole blocks go straight from the caller's buffer */
+void
+sha256_update(sha256_t *s, const uint8_t *data, size_t len)
+{
+    size_t have, n;
+
+    have    = s->len % SHA256_BLOCK;
+    s->len += len;
+    if (have)
+    {
+        n = SHA256_BLOCK - have;
+        if (len < n)
+        {
+            memcpy(s->buf + have, data, len);
+            return;
+        }
+        memcpy(s->buf + have, data, n);
+        sha256_block(s, s->buf);
+        data += n;
+        len  -= n;
+    }
+    for (; len >= SHA256_BLOCK; data += SHA256_BLOCK, len -= SHA256_BLOCK)
+    {
+        sha256_block(s, data);
+    }
+    memcpy(s->buf, data, len);
+}
+
+void
+sha256_final(sha256_t *s, uint8_t *digest)
+{
+    int i;
+    uint8_t len[8];
+
+    digest_length(len, s->len * 8, 1);
+    sha256_update(s, digest_padding, 1 + (119 - s->len % DIGEST_BLOCK) % 64);
+    sha256_update(s, len, 8);
+    for (i = 0; i < 8; i++)
+    {
+        digest[4 * i]     = s->h[i] >> 24;
+        digest[4 * i + 1] = s->h[i] >> 16;
+        digest[4 * i + 2] = s->h[i] >> 8;
+        digest[4 * i + 3] = s->h[i];
+    }
+}
+
+static void
+sha256_block(sha256_t *s, const uint8_t *p)
+{
+    int i;
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    uint32_t w[64];
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (; i < 64; i++)
+    {
+        w[i] = w[i - 16] + w[i - 7] +
+            (ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+            (ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    }
+    a = s->h[0];
+    b = s->h[1];
+    c = s->h[2];
+    d = s->h[3];
+    e = s->h[4];
+    f = s->h[5];
+    g = s->h[6];
+    h = s->h[7];
+    for (i = 0; i < 64; i++)
+    {
+        t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+            ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+            ((a & b) ^ (a & c) ^ (b & c));
+        h  = g;
+        g  = f;
+        f  = e;
+        e  = d + t1;
+        d  = c;
+        c  = b;
+        b  = a;
+        a  = t1 + t2;
+    }
+    s->h[0] += a;
+    s->h[1] += b;
+    s->h[2] += c;
+    s->h[3] += d;
+    s->h[4] += e;
+    s->h[5] += f;
+    s->h[6] += g;
+    s->h[7] += h;
+}
+
+/** the message length in bits the way a digest's last block wants it */
+static void
+digest_length(uint8_t *p, uint64_t bits, int big)
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        p[big ? 7 - i : i] = bits >> (8 * i);
+    }
+}
+
+/** a digest as lower case hex, hex has room for 2 * len + 1 */
+void
+digest_hex(const uint8_t *digest, size_t len, char *hex)
+{
+    size_t i;
+    static const char x[] = "0123456789abcdef";
+
+    for (i = 0; i < len; i++)
+    {
+        hex[2 * i]     = x[digest[i] >> 4];
+        hex[2 * i + 1] = x[digest[i] & 0x0f];
+    }
+    hex[2 * i] = '\0';
+}
+
+/** EOF */
@@ -29,6 +29,7 @@
    by Nick Harbour
 */
 
+#include <sys/statvfs.h>
 #include "nfex.h"
 #include "extract.h"
 #include "util.h"
@@ -50,10 +51,7 @@ const uint8_t *data, size_t size, ncc_t *ncc)
      * set all existing segment values to what they would be with no search 
      * results
      */
-    for (e = *elist; e; e = e->next)
-    {
-        set_segment_marks(e, size);
-    }
+    set_segment_marks(*elist, size);
 
     /** look for new headers in the results set */
     for (r = results; r; r = r->next)
@@ -81,97 +79,728 @@ const uint8_t *data, size_t size, ncc_t *ncc)
     }
 
     /** remove any finished extractions from the list */
-    sweep_extract_list(elist);
+    sweep_extract_list(elist, ncc);
+}
+
+/*
+ * start a new extraction of the given type for a session.  nothing is 
+ * written, the caller decides what goes in it.  types with a validator
+ * don't get a file (or an index entry) until the validator has seen 
+ * enough to vouch for them, and types with a commit= not until they've
+ * got that far or found their end.  until then what's written is held in
+ * memory, so a candidate that goes nowhere never touches the disk.
+ * returns NULL if it couldn't be started or wasn't let in.
+ */
+extract_list_t *
+extract_open(extract_list_t **elist, fileid_t *fileid, ht_node_t *session, 
+ncc_t *ncc)
+{
+    off_t n;
+    extract_list_t *p;
+
+    if (extract_admit(fileid, session, ncc) == 0)
+    {
+        return (NULL);
+    }
+
+    /** add new entry to the front extract linked list */
+    p = malloc(sizeof (*p));
+    if (p == NULL)
+    {
+        fprintf(stderr, "malloc(): %s\n", strerror(errno));
+        return (NULL);
+    }
+    memset(p, 0, sizeof (*p));
+    ncc->mem[NFEX_MEM_EXTRACT] += sizeof (*p);
+
+    p->fileid    = fileid;
+    p->timestamp = time(NULL);
+    p->fd        = -1;
+    p->limit     = fileid->maxlen;
+    p->ip_src    = session->ft.ip_src;
+    p->ip_dst    = session->ft.ip_dst;
+    p->port_src  = session->ft.port_src;
+    p->port_dst  = session->ft.port_dst;
+    p->ts        = ncc->stats.ts_last;
+    p->vetted    = fileid->validate == NULL;
+
+    n = fileid->commit;
+    if (fileid->validate && n < VALIDATE_MAX)
+    {
+        n = VALIDATE_MAX;
+    }
+    if (n > p->limit)
+    {
+        n = p->limit;
+    }
+    if (n && extract_hold(p, n, ncc) == NULL)
+    {
+        if (fileid->validate)
+        {
+            /** nowhere to hold it for a verdict, it's not written unvetted */
+            ncc->stats.validate_skipped++;
+            ncc->mem[NFEX_MEM_EXTRACT] -= sizeof (*p);
+            free(p);
+            return (NULL);
+        }
+        /** only waiting on commit=, it can go straight to a file */
+    }
+    if (fileid->resolve)
+    {
+        /** if this fails we just run out to maxlen */
+        p->resolve = malloc(sizeof (resolve_t));
+        if (p->resolve)
+        {
+            memset(p->resolve, 0, sizeof (resolve_t));
+            fileid->resolve(p->resolve);
+            ncc->mem[NFEX_MEM_SEARCH] += sizeof (resolve_t);
+        }
+    }
+    if (p->pending == NULL && extract_commit(p, ncc) == -1)
+    {
+        if (p->resolve)
+        {
+            free(p->resolve);
+            ncc->mem[NFEX_MEM_SEARCH] -= sizeof (resolve_t);
+        }
+        free(p);
+        ncc->mem[NFEX_MEM_EXTRACT] -= sizeof (*p);
+        return (NULL);
+    }
+
+    p->next = *elist;
+    if (p->next)
+    {
+        p->next->prev = p;
+    }
+    *elist = p;
+
+    /** and on the end of everything that's extracting */
+    p->session = session;
+    p->older   = ncc->extract_newest;
+    if (p->older)
+    {
+        p->older->newer = p;
+    }
+    else
+    {
+        ncc->extract_oldest = p;
+    }
+    ncc->extract_newest = p;
+    ncc->extracting++;
+    fileid->tally->active++;
+
+    return (p);
+}
+
+/*
+ * does a new extraction of this type get to start?  a flow, a type and 
+ * everything together each have a cap on how many can be going at once,
+ * and a type can be held to a rate (in packet time, so a capture file
+ * plays out the same as it did live).  at the global cap a newcomer can 
+ * still bump the oldest extraction of the lowest priority below its own, 
+ * as long as that's in some other flow.  everything here is bounded by 
+ * the caps, however many HEADERs a flow turns up.
+ */
+static int
+extract_admit(fileid_t *fileid, ht_node_t *session, ncc_t *ncc)
+{
+    uint32_t n;
+    uint64_t now, cap;
+    extract_list_t *p, *victim;
+    fileid_tally_t *t;
+
+    t = fileid->tally;
+    t->hits++;
+    if (t->hits % EXTRACT_SAMPLE(t->level))
+    {
+        /** it's been throttled for what it's been turning up */
+        ncc->stats.shed_yield++;
+        goto refuse;
+    }
+    if (ncc->max_flow_extracts)
+    {
+        for (p = session->extract_list, n = 0; p; p = p->next, n++)
+            ;
+        if (n >= ncc->max_flow_extracts)
+        {
+            ncc->stats.shed_flow++;
+            goto refuse;
+        }
+    }
+    if (fileid->max && t->active >= fileid->max)
+    {
+        ncc->stats.shed_type++;
+        goto refuse;
+    }
+    if (fileid->rate)
+    {
+        /** top up the bucket for the time since we last looked */
+        now = (uint64_t)ncc->stats.ts_last.tv_sec * 1000000 + 
+            ncc->stats.ts_last.tv_usec;
+        cap = (uint64_t)fileid->burst * 1000000;
+        if (t->refilled == 0 || now < t->refilled ||
+            now - t->refilled >= cap / fileid->rate)
+        {
+            t->tokens = cap;
+        }
+        else
+        {
+            t->tokens = MIN(cap, t->tokens + 
+                (now - t->refilled) * fileid->rate);
+        }
+        t->refilled = now;
+        if (t->tokens < 1000000)
+        {
+            ncc->stats.shed_rate++;
+            goto refuse;
+        }
+    }
+    if (ncc->max_extracts && ncc->extracting >= ncc->max_extracts)
+    {
+        for (p = ncc->extract_oldest, victim = NULL; p; p = p->newer)
+        {
+            if (p->session != session && 
+                p->fileid->priority < fileid->priority &&
+                (victim == NULL ||
+                p->fileid->priority < victim->fileid->priority))
+            {
+                victim = p;
+            }
+        }
+        if (victim == NULL)
+        {
+            ncc->stats.shed_global++;
+            goto refuse;
+        }
+        extract_shed(victim, ncc);
+        ncc->stats.preempted++;
+    }
+    if (fileid->rate)
+    {
+        t->tokens -= 1000000;
+    }
+    return (1);
+
+refuse:
+    t->refused++;
+    return (0);
+}
+
+/*
+ * an extraction is over, score its type.  it panned out if it became a
+ * file and, for a type with a FOOTER or a length resolver, we saw the end
+ * of it.  one that was cut short from outside, shed, evicted or torn down
+ * with its flow, says nothing about its type unless it got to the end.  a
+ * type whose candidates mostly don't pan out is throttled, to one in 16
+ * and then one in 256, and eased off a step once it does better.  its 
+ * numbers start over at every step so each verdict is on new evidence.
+ */
+static void
+extract_judge(extract_list_t *p, ncc_t *ncc)
+{
+    uint32_t pct;
+    fileid_t *f;
+    fileid_tally_t *t;
+
+    f = p->fileid;
+    t = f->tally;
+    if (p->fd != -1)
+    {
+        t->files++;
+        t->bytes += p->nwritten;
+    }
+    if (p->cut && p->complete == 0)
+    {
+        return;
+    }
+    if (p->fd != -1 && p->rejected == 0 &&
+        (p->complete || (f->footer == 0 && f->resolve == NULL)))
+    {
+        t->kept++;
+        t->wkept++;
+    }
+    else
+    {
+        t->junk++;
+    }
+    if (++t->wjudged < EXTRACT_JUDGE_WINDOW || f->nothrottle)
+    {
+        return;
+    }
+    pct = t->wkept * 100 / t->wjudged;
+    if (pct < EXTRACT_DEMOTE_PCT && t->level < EXTRACT_SUSPENDED)
+    {
+        t->level++;
+        printf("%s: %u of the last %u candidates panned out, now taking 1 in "
+            "%d\n", f->ext, t->wkept, t->wjudged, EXTRACT_SAMPLE(t->level));
+    }
+    else if (pct >= EXTRACT_PROMOTE_PCT && t->level > EXTRACT_NORMAL)
+    {
+        t->level--;
+        printf("%s: %u of the last %u candidates panned out, now taking 1 in "
+            "%d\n", f->ext, t->wkept, t->wjudged, EXTRACT_SAMPLE(t->level));
+    }
+    t->wkept   = 0;
+    t->wjudged = 0;
+}
+
+/** the 'f' key: how each file type is doing */
+void
+extract_dump_types(ncc_t *ncc)
+{
+    uint32_t i;
+    fileid_t *f;
+    fileid_tally_t *t;
+    static char *levels[] = {"normal", "sampled", "suspended"};
+
+    printf("%-3s %-8s %9s %9s %9s %9s %10s  %s\n", "id", "type", "hits",
+        "refused", "kept", "junk", "avg size", "status");
+    for (i = 0; i < ncc->set->nfileids; i++)
+    {
+        f = ncc->set->fileids[i];
+        t = f->tally;
+        printf("%-3d %-8s %9u %9u %9u %9u %10llu  %s%s\n", f->id, f->ext,
+            t->hits, t->refused, t->kept, t->junk, 
+            t->files ? (unsigned long long)(t->bytes / t->files) : 0ULL,
+            levels[t->level], f->nothrottle ? ", never throttled" : "");
+    }
+}
+
+/*
+ * hook a set's fileids up to their types' tallies, before it goes live.
+ * a type we've seen before, at startup or an earlier reload, picks up 
+ * where it left off; tallies are small and only go away at shutdown.
+ */
+void
+extract_tally(srch_set_t *set, ncc_t *ncc)
+{
+    int nth;
+    uint32_t i, j;
+    fileid_t *f;
+    fileid_tally_t *t;
+
+    for (i = 0; i < set->nfileids; i++)
+    {
+        f = set->fileids[i];
+        for (j = 0, nth = 0; j < i; j++)
+        {
+            if (set->fileids[j]->profile == f->profile &&
+                strcmp(set->fileids[j]->ext, f->ext) == 0)
+            {
+                nth++;
+            }
+        }
+        for (t = ncc->tallies; t; t = t->next)
+        {
+            if (t->profile == f->profile && t->nth == nth &&
+                strcmp(t->ext, f->ext) == 0)
+            {
+                break;
+            }
+        }
+        if (t == NULL)
+        {
+            t          = ecalloc(1, sizeof (fileid_tally_t));
+            t->ext     = strdup(f->ext);
+            if (t->ext == NULL)
+            {
+                perror("Error in function extract_tally()");
+                exit(0);
+            }
+            t->profile = f->profile;
+            t->nth     = nth;
+            t->next    = ncc->tallies;
+            ncc->tallies = t;
+        }
+        f->tally = t;
+    }
+}
+
+void
+extract_tally_free(ncc_t *ncc)
+{
+    fileid_tally_t *t, *next;
+
+    for (t = ncc->tallies; t; t = next)
+    {
+        next = t->next;
+        free(t->ext);
+        free(t);
+    }
+    ncc->tallies = NULL;
 }
 
-/* Add a new header match to the list of files being extracted */
+/** cut an extraction short to make room, it keeps what it has so far */
+static void
+extract_shed(extract_list_t *p, ncc_t *ncc)
+{
+    ht_node_t *session;
+
+    session = p->session;
+    if (session->http && session->http->extract == p)
+    {
+        /** the rest of the body just gets skipped */
+        session->http->extract = NULL;
+    }
+    p->cut = 1;
+    extract_close(&(session->extract_list), p, ncc);
+}
+
+/*
+ * Add a new header match to the list of files being extracted.  a HEADER
+ * that started in an earlier packet has a negative offset, its first 
+ * bytes come from what the session carried over from there.
+ */
 static void
 add_extract(extract_list_t **elist, fileid_t *fileid, ht_node_t *session, 
 int offset, int size, ncc_t *ncc)
 {
-    int n;
-    char *q;
     extract_list_t *p;
-    char fname[FILENAME_BUFFER_SIZE] = {'\0'};
 
+    if (offset < 0 && (uint32_t)-offset > session->ncarry)
+    {
+        /** didn't keep enough of it, don't start a file without its start */
+        ncc->stats.packet_errors++;
+        return;
+    }
+    p = extract_open(elist, fileid, session, ncc);
+    if (p == NULL)
+    {
+        return;
+    }
+    if (offset < 0)
+    {
+        extract_write(p, session->carry + session->ncarry + offset, -offset,
+            ncc);
+        offset = 0;
+    }
+
+    p->segment.start = offset;
+    if (p->limit - p->nwritten <= size - offset)
+    {
+        p->segment.end = offset + p->limit - p->nwritten;
+    }
+    else   
+    {
+        p->segment.end = size;
+    }
+}
+
+/** write a run of data to an extraction, stopping at its limit */
+void
+extract_write(extract_list_t *p, const uint8_t *data, size_t size, ncc_t *ncc)
+{
+    p->segment.start = 0;
+    if (p->limit - p->nwritten <= (off_t)size)
+    {
+        p->segment.end = p->limit - p->nwritten;
+        p->finish++;
+    }
+    else
+    {
+        p->segment.end = size;
+    }
+    extract_segment(p, data, ncc);
+}
+
+/** finish an extraction and take it off the list */
+void
+extract_close(extract_list_t **elist, extract_list_t *p, ncc_t *ncc)
+{
+    if (p->pending)
+    {
+        /** whatever we've got is all there is */
+        extract_pending(p, 1, ncc);
+    }
+    p->finish++;
+    sweep_extract_list(elist, ncc);
+}
+
+/*
+ * open the file for an extraction, this is where it gets indexed.  unless
+ * it's being hashed, then it's indexed at the end with its digests.  with
+ * --archive there's no file, it's staged and goes in a segment when done.
+ */
+static int
+extract_commit(extract_list_t *p, ncc_t *ncc)
+{
+    char *q;
+    char fname[FILENAME_BUFFER_SIZE] = {'\0'};
 
     /** open the file descriptor that we'll extract into */
     q = fname;
-    n = open_extract(fileid->ext, session->ft.ip_src, session->ft.port_src,
-            session->ft.ip_dst, session->ft.port_dst, &q, ncc);
-    if (n == -1)
+    if (ncc->output.segment)
+    {
+        p->fd = ARCHIVE_FD;
+        snprintf(fname, sizeof (fname), "the archive");
+    }
+    else
+    {
+        p->fd = open_extract(p->fileid, &(p->ts), &q, ncc);
+    }
+    if (p->fd == -1)
     {
         if (ncc->flags & NFEX_VERBOSE)
         {
-            fprintf(stderr, "error extracting \"%s\" (", fileid->ext);
-            fprintip(stderr, session->ft.ip_src, ncc);
-            fprintf(stderr, ":%d -> ", ntohs(session->ft.port_src));
-            fprintip(stderr, session->ft.ip_dst, ncc);
-            fprintf(stderr, ":%d) to %s\n", ntohs(session->ft.port_dst), fname);
+            fprintf(stderr, "error extracting \"%s\" (", p->fileid->ext);
+            fprintip(stderr, p->ip_src, ncc);
+            fprintf(stderr, ":%d -> ", ntohs(p->port_src));
+            fprintip(stderr, p->ip_dst, ncc);
+            fprintf(stderr, ":%d) to %s\n", ntohs(p->port_dst), fname);
         }
         else
         {
-            fprintf(stderr, "error extracting \"%s\" file\n", fileid->ext);
+            fprintf(stderr, "error extracting \"%s\" file\n", 
+                p->fileid->ext);
         }
-        /** flag for removal */
-        //p->finish++;
-        return;
+        return (-1);
     }
     if (ncc->flags & NFEX_VERBOSE)
     {
-        fprintf(stdout, "extracting \"%s\" (", fileid->ext);
-        fprintip(stdout, session->ft.ip_src, ncc);
-        fprintf(stdout, ":%d -> ", ntohs(session->ft.port_src));
-        fprintip(stdout, session->ft.ip_dst, ncc);
-        fprintf(stdout, ":%d) to %s\n", ntohs(session->ft.port_dst), fname);
+        fprintf(stdout, "extracting \"%s\" (", p->fileid->ext);
+        fprintip(stdout, p->ip_src, ncc);
+        fprintf(stdout, ":%d -> ", ntohs(p->port_src));
+        fprintip(stdout, p->ip_dst, ncc);
+        fprintf(stdout, ":%d) to %s\n", ntohs(p->port_dst), fname);
     }
     ncc->stats.total_files++;
 
-    /** add new entry to the front extract linked list */
-    p = malloc(sizeof (*p));
-    if (p == NULL)
+    if (ncc->digests)
     {
-        fprintf(stderr, "malloc(): %s\n", strerror(errno));
-        return;
+        p->digest = malloc(sizeof (digest_t));
+        if (p->digest)
+        {
+            digest_init(p->digest, ncc->digests);
+            ncc->mem[NFEX_MEM_EXTRACT] += sizeof (digest_t);
+        }
     }
-    memset(p, 0, sizeof (*p));
+    if (p->fd == ARCHIVE_FD)
+    {
+        /** the segment's index gets it all once it's in */
+        return (p->fd);
+    }
+    if (p->digest)
+    {
+        p->path = strdup(fname);
+        if (p->path)
+        {
+            p->name = q - fname;
+            ncc->mem[NFEX_MEM_EXTRACT] += strlen(fname) + 1;
+            return (p->fd);
+        }
+        /** no memory to hang onto its name, so it's just a file */
+        free(p->digest);
+        p->digest = NULL;
+        ncc->mem[NFEX_MEM_EXTRACT] -= sizeof (digest_t);
+    }
+    extract_index(p, q, NULL, ncc);
 
-    p->next      = *elist;
-    p->fileid    = fileid;
-    p->timestamp = time(NULL);
-    p->fd        = n;
-    if (p->next)
+    return (p->fd);
+}
+
+/*
+ * see whether what's pending has earned a file: the validator (if any) 
+ * has to pass it, then it has to reach its commit= size, the end of the
+ * file or its limit.  final says no more data is coming.  returns 1 if
+ * the extraction is now live and the pending data is on disk, 0 if it's
+ * still undecided, -1 if it's been thrown out.
+ */
+static int
+extract_pending(extract_list_t *p, int final, ncc_t *ncc)
+{
+    int v;
+    size_t c;
+
+    if (p->vetted == 0)
     {
-        p->next->prev = p;
+        v = p->fileid->validate(p->pending, MIN(p->npending, VALIDATE_MAX));
+        if (v == VALIDATE_MORE && (final || p->npending >= VALIDATE_MAX))
+        {
+            /** ran out of data before it could make up its mind */
+            v = VALIDATE_BAD;
+        }
+        switch (v)
+        {
+            case VALIDATE_MORE:
+                return (0);
+            case VALIDATE_OK:
+                p->vetted = 1;
+                break;
+            default:
+                if (ncc->flags & NFEX_VERBOSE)
+                {
+                    fprintf(stdout, "rejected \"%s\" (", p->fileid->ext);
+                    fprintip(stdout, p->ip_src, ncc);
+                    fprintf(stdout, ":%d -> ", ntohs(p->port_src));
+                    fprintip(stdout, p->ip_dst, ncc);
+                    fprintf(stdout, ":%d), failed validation\n", 
+                        ntohs(p->port_dst));
+                }
+                ncc->stats.validate_rejects++;
+                p->rejected = 1;
+                goto drop;
+        }
+    }
+    if (p->npending < p->fileid->commit && p->complete == 0 &&
+        (off_t)p->npending < p->limit)
+    {
+        if (final == 0)
+        {
+            return (0);
+        }
+        /** it ended short, nothing to show for it */
+        ncc->stats.uncommitted++;
+        goto drop;
+    }
+    if (extract_commit(p, ncc) == -1)
+    {
+        goto drop;
+    }
+    c = extract_put(p, p->pending, p->npending, ncc);
+    if (c != p->npending)
+    {
+        fprintf(stderr, "error writing fd: %d, wrote %ld of %ld bytes: %s\n",
+            p->fd, c, p->npending, strerror(errno));
+        ncc->stats.extraction_errors++;
+    }
+    else if (p->digest)
+    {
+        digest_update(p->digest, p->pending, p->npending);
     }
+    extract_release(p, ncc);
+    return (1);
 
-    p->segment.start = offset;
-    if (fileid->maxlen <= size - offset)
+drop:
+    extract_release(p, ncc);
+    p->finish++;
+    return (-1);
+}
+
+/*
+ * get a buffer to hold at least size bytes of an extraction.  they come
+ * from a pool of power of two sizes, most candidates are gone before a
+ * packet or two so the same few buffers go around and around.
+ */
+static uint8_t *
+extract_hold(extract_list_t *p, size_t size, ncc_t *ncc)
+{
+    int c;
+    uint8_t *buf;
+
+    for (c = 0; EXTRACT_POOL_SIZE(c) < size; c++)
+        ;
+    buf = ncc->pool[c];
+    if (buf)
     {
-        p->segment.end = offset + fileid->maxlen;
+        /** the spares are chained through their first bytes */
+        memcpy(&(ncc->pool[c]), buf, sizeof (uint8_t *));
+        ncc->npool[c]--;
     }
-    else   
+    else
     {
-        p->segment.end = size;
+        buf = malloc(EXTRACT_POOL_SIZE(c));
+        if (buf == NULL)
+        {
+            return (NULL);
+        }
     }
-    *elist = p;
+    ncc->mem[NFEX_MEM_EXTRACT] += EXTRACT_POOL_SIZE(c);
+    p->pending  = buf;
+    p->npending = 0;
+    p->room     = size;
+    p->hold     = c;
+
+    return (buf);
 }
 
-/** open the next availible filename for writing */
+/** done holding, the buffer goes back in the pool if there's room */
+static void
+extract_release(extract_list_t *p, ncc_t *ncc)
+{
+    ncc->mem[NFEX_MEM_EXTRACT] -= EXTRACT_POOL_SIZE(p->hold);
+    if (ncc->npool[p->hold] < EXTRACT_POOL_KEEP)
+    {
+        memcpy(p->pending, &(ncc->pool[p->hold]), sizeof (uint8_t *));
+        ncc->pool[p->hold] = p->pending;
+        ncc->npool[p->hold]++;
+    }
+    else
+    {
+        free(p->pending);
+    }
+    p->pending = NULL;
+}
+
+/** shutting down, free the spares */
+void
+extract_pool_free(ncc_t *ncc)
+{
+    int c;
+    uint8_t *buf;
+
+    for (c = 0; c < EXTRACT_POOL_N; c++)
+    {
+        while ((buf = ncc->pool[c]))
+        {
+            memcpy(&(ncc->pool[c]), buf, sizeof (uint8_t *));
+            free(buf);
+        }
+        ncc->npool[c] = 0;
+    }
+}
+
+/*
+ * the file types a FOOTER could close right now: everything still being
+ * extracted plus any HEADERs that are about to start an extraction
+ */
+uint32_t
+extract_mask(extract_list_t *elist, srch_results_t *results)
+{
+    uint32_t mask;
+    extract_list_t *p;
+    srch_results_t *r;
+
+    for (mask = 0, p = elist; p; p = p->next)
+    {
+        mask |= SRCH_ID_BIT(p->fileid->id);
+    }
+    for (r = results; r; r = r->next)
+    {
+        if (r->spectype == HEADER)
+        {
+            mask |= SRCH_ID_BIT(r->fileid->id);
+        }
+    }
+    return (mask);
+}
+
+/*
+ * open the next availible filename for writing, in its profile's dir.
+ * on the way back *fname is moved up to the name the index knows it by.
+ */
 static int 
-open_extract(char *ext, uint32_t src_ip, uint16_t src_prt, uint32_t dst_ip, 
-uint16_t dst_prt, char **fname, ncc_t *ncc)
+open_extract(fileid_t *fileid, struct timeval *ts, char **fname, ncc_t *ncc)
 {
     int n;
-    uint8_t ip_addr_s[4], ip_addr_d[4];
-    struct tm *time_machine;
-    char timestamp[50] = {'\0'};
+    nfex_profile_t *pr;
+    nfex_outdir_t *dir;
+
+    pr  = &(ncc->profile[fileid->profile]);
+    dir = extract_dir(pr, ncc);
 
     /** build file name */
     ncc->filenum++;
-    snprintf(*fname, FILENAME_BUFFER_SIZE, "%s%d-%06d.%s", 
-        ncc->output_dir == NULL ? "" : ncc->output_dir, 
-        getpid(), ncc->filenum, ext);
+    n = extract_path(dir, ts, *fname, ncc);
+    if (n == -1)
+    {
+        fprintf(stderr, "error making directory for %s: %s\n", *fname,
+            strerror(errno));
+        ncc->stats.extraction_errors++;
+        return (-1);
+    }
+    snprintf(*fname + n, FILENAME_BUFFER_SIZE - n, "%d-%06llu.%s", 
+        getpid(), (unsigned long long)ncc->filenum, fileid->ext);
 
     /** open file */
     n = open(*fname, O_WRONLY|O_CREAT|O_EXCL, S_IRWXU|S_IRWXG|S_IRWXO);
@@ -182,24 +811,208 @@ uint16_t dst_prt, char **fname, ncc_t *ncc)
         ncc->stats.extraction_errors++;
         return (-1);
     }
+    pr->files++;
+
+    /** named from the index's dir if it's under it, in full otherwise */
+    if (dir == &(pr->dir[0]))
+    {
+        *fname += strlen(dir->path);
+    }
+    return (n);
+}
+
+/** write out an extraction's details to its profile's index file */
+void
+extract_index(extract_list_t *p, char *name, char *digest, ncc_t *ncc)
+{
+    uint8_t ip_addr_s[4], ip_addr_d[4];
+    struct tm *time_machine;
+    char timestamp[50] = {'\0'};
+    nfex_profile_t *pr;
 
-    /** write out details to index file */
-    fprintf(ncc->indexfp, "%s, ", ncc->device ? "live-capture" : ncc->capfname);
-    memcpy(ip_addr_s, &src_ip, 4);
-    memcpy(ip_addr_d, &dst_ip, 4);
+    pr = &(ncc->profile[p->fileid->profile]);
+    fprintf(pr->indexfp, "%s, ", ncc->device ? "live-capture" : ncc->capfname);
+    memcpy(ip_addr_s, &p->ip_src, 4);
+    memcpy(ip_addr_d, &p->ip_dst, 4);
 
-    time_machine = gmtime(&ncc->stats.ts_last.tv_sec);
+    time_machine = gmtime(&p->ts.tv_sec);
     strftime(timestamp, 50, "%Y-%m-%dT%H:%M:%S", time_machine);
 
-    fprintf(ncc->indexfp, 
-           "%s.%ldZ, %d.%d.%d.%d.%d, %d.%d.%d.%d.%d, %d-%06d.%s\n",
-           timestamp, (long)ncc->stats.ts_last.tv_usec,
+    fprintf(pr->indexfp, 
+           "%s.%ldZ, %d.%d.%d.%d.%d, %d.%d.%d.%d.%d, %s",
+           timestamp, (long)p->ts.tv_usec,
            ip_addr_s[0], ip_addr_s[1], ip_addr_s[2], ip_addr_s[3], 
-           ntohs(src_prt),
+           ntohs(p->port_src),
            ip_addr_d[0], ip_addr_d[1], ip_addr_d[2], ip_addr_d[3],
-           ntohs(dst_prt), getpid(), ncc->filenum, ext);
+           ntohs(p->port_dst), name);
+    if (digest)
+    {
+        fprintf(pr->indexfp, ", %s", digest);
+    }
+    fprintf(pr->indexfp, "\n");
+
+    fflush(pr->indexfp);
+}
 
-    fflush(ncc->indexfp);
+/** out to its file, or onto what goes in the archive once it's done */
+static ssize_t
+extract_put(extract_list_t *p, const uint8_t *data, size_t size, ncc_t *ncc)
+{
+    size_t n;
+    uint8_t *stage;
+
+    if (p->fd != ARCHIVE_FD)
+    {
+        return (write(p->fd, data, size));
+    }
+    if (p->nstage + size > p->stagesz)
+    {
+        /** double it, it never needs to be more than its limit */
+        n = p->stagesz ? p->stagesz : ARCHIVE_STAGE_MIN;
+        while (n < p->nstage + size)
+        {
+            n *= 2;
+        }
+        if ((off_t)n > p->limit)
+        {
+            n = MAX((size_t)p->limit, p->nstage + size);
+        }
+        stage = realloc(p->stage, n);
+        if (stage == NULL)
+        {
+            return (-1);
+        }
+        ncc->mem[NFEX_MEM_EXTRACT] += n - p->stagesz;
+        p->stage   = stage;
+        p->stagesz = n;
+    }
+    memcpy(p->stage + p->nstage, data, size);
+    p->nstage += size;
+
+    return (size);
+}
+
+/*
+ * the file's done: close it and, if it's been hashed, index it or see if
+ * it's new.  or it goes in the archive, with whatever digests it has.
+ */
+static void
+extract_done(extract_list_t *p, ncc_t *ncc)
+{
+    char hex[DIGEST_HEX_MAX];
+    digest_sum_t sum;
+
+    memset(&sum, 0, sizeof (sum));
+    if (p->digest)
+    {
+        digest_final(p->digest, &sum, hex);
+    }
+    if (p->fd == ARCHIVE_FD)
+    {
+        archive_put(p, &sum, ncc);
+        return;
+    }
+    close(p->fd);
+    if (p->path == NULL)
+    {
+        /** it was indexed when it was opened */
+        return;
+    }
+    if (ncc->dedup.mode)
+    {
+        dedup_file(p, hex, sum.sha256, ncc);
+        return;
+    }
+    extract_index(p, p->path + p->name, hex, ncc);
+}
+
+/*
+ * which of a profile's output dirs the next file goes in.  either they
+ * take turns, or it's whichever had the most free space last we looked,
+ * which is every NFEX_SPREAD_CHECK files so as not to statvfs() each one,
+ * or every archive segment, they're few enough.
+ */
+nfex_outdir_t *
+extract_dir(nfex_profile_t *pr, ncc_t *ncc)
+{
+    int i, best;
+    struct statvfs vfs;
+
+    if (pr->ndirs == 1)
+    {
+        return (&(pr->dir[0]));
+    }
+    if (ncc->output.spread == NFEX_SPREAD_RR)
+    {
+        i = pr->next;
+        pr->next = (pr->next + 1) % pr->ndirs;
+        return (&(pr->dir[i]));
+    }
+    if (pr->files % NFEX_SPREAD_CHECK == 0 || ncc->output.segment)
+    {
+        for (i = 0; i < pr->ndirs; i++)
+        {
+            if (statvfs(pr->dir[i].path, &vfs) == -1)
+            {
+                pr->dir[i].avail = 0;
+                continue;
+            }
+            pr->dir[i].avail = (uint64_t)vfs.f_bavail * vfs.f_frsize;
+        }
+    }
+    for (i = 1, best = 0; i < pr->ndirs; i++)
+    {
+        if (pr->dir[i].avail > pr->dir[best].avail)
+        {
+            best = i;
+        }
+    }
+    return (&(pr->dir[best]));
+}
+
+/*
+ * put the directory a new file goes in at the front of fname, making it
+ * if it isn't there yet: the output dir, then the hour the file started
+ * in and/or one of 256 subdirs picked by its id.  what's been made is
+ * remembered, so most of the time this is a string compare.  returns how
+ * long the directory is, -1 if it couldn't be made.
+ */
+static int
+extract_path(nfex_outdir_t *dir, struct timeval *ts, char *fname, ncc_t *ncc)
+{
+    int n, h;
+    char bucket[32];
+
+    n = snprintf(fname, FILENAME_BUFFER_SIZE, "%s", dir->path);
+    if (ncc->output.layout & NFEX_LAYOUT_TIME)
+    {
+        strftime(bucket, sizeof (bucket), "%Y/%m/%d/%H/", 
+            gmtime(&ts->tv_sec));
+        n += snprintf(fname + n, FILENAME_BUFFER_SIZE - n, "%s", bucket);
+        if (strcmp(bucket, dir->bucket))
+        {
+            if (mkpath(fname, strlen(dir->path)) == -1)
+            {
+                return (-1);
+            }
+            strcpy(dir->bucket, bucket);
+            memset(dir->made, 0, sizeof (dir->made));
+        }
+    }
+    if (ncc->output.layout & NFEX_LAYOUT_HASH)
+    {
+        /** sequential ids still land all over */
+        h  = (ncc->filenum * 0x9e3779b97f4a7c15ULL) >> 56;
+        n += snprintf(fname + n, FILENAME_BUFFER_SIZE - n, "%02x/", h);
+        if ((dir->made[h / 8] & (1 << (h % 8))) == 0)
+        {
+            if (mkpath(fname, n - 3) == -1)
+            {
+                return (-1);
+            }
+            dir->made[h / 8] |= 1 << (h % 8);
+        }
+    }
     return (n);
 }
 
@@ -215,9 +1028,9 @@ set_segment_marks(extract_list_t *elist, size_t size)
     for (p = elist; p; p = p->next)
     {
         p->segment.start = 0;
-        if (p->fileid->maxlen - p->nwritten < size)
+        if (p->limit - p->nwritten < (off_t)size)
         {
-            p->segment.end = p->fileid->maxlen - p->nwritten;
+            p->segment.end = p->limit - p->nwritten;
             p->finish++;
         }
         else
@@ -244,8 +1057,9 @@ mark_footer(extract_list_t *elist, srch_results_t *footer)
             p->segment.start < footer->offset.start)
         {
             /** XXX this could extend beyond maxlen */
-            p->segment.end = footer->offset.end;
+            p->segment.end = footer->offset.end + 1;
             p->finish++;
+            p->complete = 1;
             break;
         }
     }
@@ -255,13 +1069,63 @@ mark_footer(extract_list_t *elist, srch_results_t *footer)
 static void
 extract_segment(extract_list_t *p, const uint8_t *data, ncc_t *ncc)
 {
-    size_t c, nbytes;
+    size_t c, n, nbytes;
 
     nbytes = p->segment.end - p->segment.start;
+    data  += p->segment.start;
 
     /** update timestamp */
     p->timestamp = time(NULL);
-    c = write(p->fd, data + p->segment.start, nbytes);
+    if (p->resolve)
+    {
+        resolve_feed(p->resolve, data, nbytes, p->nwritten);
+        if (p->resolve->length)
+        {
+            if (p->resolve->length > 0 && p->resolve->length < p->limit)
+            {
+                /** found the real end of the file */
+                p->limit = p->resolve->length;
+                ncc->stats.resolved++;
+            }
+            if (p->resolve->length > 0)
+            {
+                p->complete = 1;
+            }
+            free(p->resolve);
+            p->resolve = NULL;
+            ncc->mem[NFEX_MEM_SEARCH] -= sizeof (resolve_t);
+        }
+    }
+    if (p->nwritten + (off_t)nbytes >= p->limit)
+    {
+        /** don't go past the end, wherever that turned out to be */
+        nbytes = p->limit > p->nwritten ? p->limit - p->nwritten : 0;
+        p->finish++;
+    }
+    if (p->pending)
+    {
+        /** still waiting on a verdict, hold onto it */
+        n = p->room - p->npending;
+        if (n > nbytes)
+        {
+            n = nbytes;
+        }
+        memcpy(p->pending + p->npending, data, n);
+        p->npending += n;
+        p->nwritten += n;
+        if (extract_pending(p, p->finish, ncc) != 1)
+        {
+            return;
+        }
+        data   += n;
+        nbytes -= n;
+    }
+    if (p->fd == -1 || nbytes == 0)
+    {
+        /** rejected, or nothing left over */
+        return;
+    }
+    c = extract_put(p, data, nbytes, ncc);
     if (c != nbytes)
     {
         fprintf(stderr, "error writing fd: %d, wrote %ld of %ld bytes: %s\n", 
@@ -269,20 +1133,28 @@ extract_segment(extract_list_t *p, const uint8_t *data, ncc_t *ncc)
         ncc->stats.extraction_errors++;
         return; 
     }
+    if (p->digest)
+    {
+        digest_update(p->digest, data, nbytes);
+    }
     p->nwritten += nbytes;
-    sync();
+    if (p->fd != ARCHIVE_FD)
+    {
+        sync();
+    }
 }
 
 /** remove all finished extracts from the list */
 static void
-sweep_extract_list(extract_list_t **elist)
+sweep_extract_list(extract_list_t **elist, ncc_t *ncc)
 {
     time_t now;
     extract_list_t *p, *nxt;
 
     now = time(NULL);
-    for (p = *elist; p; p = p->next)
+    for (p = *elist; p; p = nxt)
     {
+        nxt = p->next;
         /** remove all finished or expired extracts */
         if (p->finish || (now - p->timestamp >= SESSION_THRESHOLD))
         {
@@ -300,8 +1172,62 @@ sweep_extract_list(extract_list_t **elist)
             {
                 *elist = p->next;
             }
-            close(p->fd);
+            if (p->older)
+            {
+                p->older->newer = p->newer;
+            }
+            else
+            {
+                ncc->extract_oldest = p->newer;
+            }
+            if (p->newer)
+            {
+                p->newer->older = p->older;
+            }
+            else
+            {
+                ncc->extract_newest = p->older;
+            }
+            ncc->extracting--;
+            p->fileid->tally->active--;
+            extract_judge(p, ncc);
+            if (p->fd != -1)
+            {
+                extract_done(p, ncc);
+            }
+            if (p->digest)
+            {
+                ncc->mem[NFEX_MEM_EXTRACT] -= sizeof (digest_t);
+                free(p->digest);
+            }
+            if (p->path)
+            {
+                ncc->mem[NFEX_MEM_EXTRACT] -= strlen(p->path) + 1;
+                free(p->path);
+            }
+            if (p->stage)
+            {
+                ncc->mem[NFEX_MEM_EXTRACT] -= p->stagesz;
+                free(p->stage);
+            }
+            if (p->pending)
+            {
+                /** went nowhere, it never cost us a file */
+                ncc->stats.uncommitted++;
+                if (p->vetted == 0)
+                {
+                    /** timed out before the validator made up its mind */
+                    ncc->stats.validate_expired++;
+                }
+                extract_release(p, ncc);
+            }
+            if (p->resolve)
+            {
+                free(p->resolve);
+                ncc->mem[NFEX_MEM_SEARCH] -= sizeof (resolve_t);
+            }
             free(p);
+            ncc->mem[NFEX_MEM_EXTRACT] -= sizeof (*p);
         }
     }
 }
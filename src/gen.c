@@ -0,0 +1,306 @@
+/*
+ * gen.c - generated scanners
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include <dlfcn.h>
+#include "nfex.h"
+#include "gen.h"
+#include "util.h"
+
+/** states with matches are entered at their a label */
+#define GEN_LABEL(m, t) ((m)->match[(t)] ? 'a' : 's')
+
+/** the machines that get scanners, and what their symbols are called */
+static srch_machine_t **
+gen_machine(srch_set_t *set, int i, char **name)
+{
+    switch (i)
+    {
+        case 0:
+            *name = "header";
+            return (&(set->srch_machine));
+        default:
+            *name = "footer";
+            return (&(set->foot_machine));
+    }
+}
+
+/*
+ * --emit-c: read a config file (or signature image) the usual way and
+ * write its machines out as C
+ */
+int
+gen_compile(nfex_conf_t *conf, char *fname)
+{
+    int n, i;
+    srch_set_t *set;
+    char from[FILENAME_BUFFER_SIZE];
+
+    set = sigs_new();
+    n   = config_load(set, conf);
+    if (n != -1)
+    {
+        for (i = 0, from[0] = 0; i < conf->n; i++)
+        {
+            snprintf(from + strlen(from), sizeof (from) - strlen(from), 
+                "%s%s", i ? " " : "", conf->fname[i]);
+        }
+        n = gen_emit(set, fname, from);
+    }
+    sigs_release(set);
+
+    return (n);
+}
+
+/** write the scanners for every unanchored machine to fname */
+int
+gen_emit(srch_set_t *set, char *fname, char *from)
+{
+    int i;
+    FILE *fp;
+    char *name;
+    srch_machine_t *m;
+    char tmp[FILENAME_BUFFER_SIZE];
+
+    snprintf(tmp, sizeof (tmp), "%s.%d", fname, getpid());
+    fp = fopen(tmp, "w");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "can't create %s: %s\n", tmp, strerror(errno));
+        return (-1);
+    }
+    fprintf(fp, "/*\n * generated by nfex --emit-c from %s, don't edit.\n"
+        " * build with:  cc -O2 -shared -fPIC -o scanner.so %s\n */\n\n",
+        from, fname);
+    fprintf(fp, "#include <stddef.h>\n#include <stdint.h>\n\n");
+    fprintf(fp, "const uint32_t nfex_gen_version = %d;\n", GEN_VERSION);
+    for (i = 0; i < GEN_MACHINES; i++)
+    {
+        m = *gen_machine(set, i, &name);
+        if (m && m->nstates)
+        {
+            gen_scanner(fp, m, name);
+        }
+    }
+    fprintf(fp, "\n/* EOF */\n");
+    if (ferror(fp) | fclose(fp))
+    {
+        fprintf(stderr, "error writing %s: %s\n", tmp, strerror(errno));
+        unlink(tmp);
+        return (-1);
+    }
+    if (rename(tmp, fname) == -1)
+    {
+        fprintf(stderr, "can't rename %s to %s: %s\n", tmp, fname,
+            strerror(errno));
+        unlink(tmp);
+        return (-1);
+    }
+    printf("wrote generated scanners to %s\n", fname);
+
+    return (1);
+}
+
+/*
+ * one machine's scanner.  a state with matches has two labels: entering
+ * it off a byte (a) hands back to search() to report them, resuming in it
+ * at the start of a buffer (s) carries straight on.
+ */
+static void
+gen_scanner(FILE *fp, srch_machine_t *m, char *name)
+{
+    uint32_t s;
+
+    fprintf(fp, "\nconst uint32_t nfex_gen_%s_nstates = %u;\n", name,
+        m->nstates);
+    fprintf(fp, "const uint64_t nfex_gen_%s_hash = 0x%016llxULL;\n", name,
+        (unsigned long long)search_hash(m));
+    fprintf(fp, "\nsize_t\nnfex_gen_%s(uint32_t *state, const uint8_t *buf, "
+        "size_t len)\n{\n", name);
+    fprintf(fp, "    const uint8_t *p = buf, *end = buf + len;\n\n");
+    fprintf(fp, "    switch (*state)\n    {\n");
+    for (s = 1; s < m->nstates; s++)
+    {
+        fprintf(fp, "        case %u: goto s%u;\n", s, s);
+    }
+    fprintf(fp, "        default: goto s0;\n    }\n");
+    for (s = 0; s < m->nstates; s++)
+    {
+        gen_state(fp, m, s);
+    }
+    fprintf(fp, "}\n");
+
+    printf("%s scanner generated: %u states\n", name, m->nstates);
+}
+
+static void
+gen_state(FILE *fp, srch_machine_t *m, uint32_t s)
+{
+    uint32_t c, d, t, n, ntargets, dflt;
+    uint32_t target[256], count[256];
+    uint8_t done[256];
+
+    if (m->match[s])
+    {
+        fprintf(fp, "a%u:\n    *state = %u;\n    return (p - buf);\n", s, s);
+    }
+    fprintf(fp, "s%u:\n    if (p == end)\n    {\n        *state = %u;\n"
+        "        return (len);\n    }\n", s, s);
+
+    /** the most common next state goes in the default */
+    for (c = 0, ntargets = 0; c < 256; c++)
+    {
+        t = search_next(m, s, c);
+        for (d = 0; d < ntargets && target[d] != t; d++)
+            ;
+        if (d == ntargets)
+        {
+            target[ntargets]  = t;
+            count[ntargets++] = 0;
+        }
+        count[d]++;
+    }
+    for (d = 0, dflt = 0, n = 0; d < ntargets; d++)
+    {
+        if (count[d] > n)
+        {
+            n    = count[d];
+            dflt = target[d];
+        }
+    }
+    if (n == 256)
+    {
+        fprintf(fp, "    p++;\n    goto %c%u;\n", GEN_LABEL(m, dflt), dflt);
+        return;
+    }
+
+    /** everything else is grouped by where it goes */
+    fprintf(fp, "    switch (*p++)\n    {\n");
+    memset(done, 0, sizeof (done));
+    for (c = 0; c < 256; c++)
+    {
+        t = search_next(m, s, c);
+        if (t == dflt || done[c])
+        {
+            continue;
+        }
+        for (d = c, n = 0; d < 256; d++)
+        {
+            if (search_next(m, s, d) != t)
+            {
+                continue;
+            }
+            done[d] = 1;
+            fprintf(fp, "%s case 0x%02x:", n % 4 ? "" :
+                n ? "\n       " : "       ", d);
+            n++;
+        }
+        fprintf(fp, "\n            goto %c%u;\n", GEN_LABEL(m, t), t);
+    }
+    fprintf(fp, "        default:\n            goto %c%u;\n    }\n",
+        GEN_LABEL(m, dflt), dflt);
+}
+
+/*
+ * load a scanner built from --emit-c output and put it in place of the
+ * table walk.  every machine has to be in there and has to be the same
+ * machine we just built or mapped, otherwise it'd report the wrong thing.
+ */
+int
+gen_load(srch_set_t *set, char *fname)
+{
+    int i;
+    void *h;
+    char *name;
+    char sym[64];
+    const uint32_t *version;
+    const uint64_t *hash;
+    srch_machine_t *m;
+    srch_scan_t scan[GEN_MACHINES];
+
+    h = dlopen(fname, RTLD_NOW|RTLD_LOCAL);
+    if (h == NULL)
+    {
+        fprintf(stderr, "can't load scanner %s: %s\n", fname, dlerror());
+        return (-1);
+    }
+    version = dlsym(h, "nfex_gen_version");
+    if (version == NULL || *version != GEN_VERSION)
+    {
+        fprintf(stderr, "%s: not a scanner from this version of nfex\n",
+            fname);
+        goto err;
+    }
+    for (i = 0; i < GEN_MACHINES; i++)
+    {
+        scan[i] = NULL;
+        m = *gen_machine(set, i, &name);
+        if (m == NULL || m->nstates == 0)
+        {
+            continue;
+        }
+        snprintf(sym, sizeof (sym), "nfex_gen_%s_hash", name);
+        hash = dlsym(h, sym);
+        if (hash == NULL || *hash != search_hash(m))
+        {
+            fprintf(stderr, "%s: %s scanner was generated from different "
+                "signatures, regenerate it with --emit-c\n", fname, name);
+            goto err;
+        }
+        snprintf(sym, sizeof (sym), "nfex_gen_%s", name);
+        *(void **)(&scan[i]) = dlsym(h, sym);
+        if (scan[i] == NULL)
+        {
+            fprintf(stderr, "%s: no %s scanner\n", fname, name);
+            goto err;
+        }
+    }
+
+    /** only swap them in once they all check out */
+    for (i = 0; i < GEN_MACHINES; i++)
+    {
+        m = *gen_machine(set, i, &name);
+        if (scan[i])
+        {
+            m->scan = scan[i];
+        }
+    }
+    set->gen = h;
+    printf("using generated scanner %s\n", fname);
+    return (1);
+
+err:
+    dlclose(h);
+    return (-1);
+}
+
+/** put the table walk back and unload the scanner */
+void
+gen_free(srch_set_t *set)
+{
+    int i;
+    char *name;
+    srch_machine_t *m;
+
+    if (set->gen == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < GEN_MACHINES; i++)
+    {
+        m = *gen_machine(set, i, &name);
+        if (m)
+        {
+            m->scan = NULL;
+        }
+    }
+    dlclose(set->gen);
+    set->gen = NULL;
+}
+
+/** EOF */
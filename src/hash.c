@@ -21,10 +21,10 @@
 ht_node_t *
 ht_insert(four_tuple_t *ft, ncc_t *ncc)
 {
-    uint16_t n, j;
+    uint32_t n, j;
     ht_node_t *p;
 
-    n = ht_hash(ft);
+    n = ht_hash(ft, ncc);
 
     if (ncc->ht[n] == NULL)
     {
@@ -37,8 +37,15 @@ ht_insert(four_tuple_t *ft, ncc_t *ncc)
         }
         memcpy(&(ncc->ht[n]->ft), ft, sizeof (four_tuple_t));
         ncc->ht[n]->timestamp    = time(NULL);
-        ncc->ht[n]->srchptr_list = NULL;
+        ncc->ht[n]->set          = ncc->set;
+        ncc->ht[n]->srch_state   = SRCH_START;
+        ncc->ht[n]->foot_state   = SRCH_START;
         ncc->ht[n]->extract_list = NULL;
+        ncc->ht[n]->http         = NULL;
+        ncc->ht[n]->anchor       = NULL;
+        ncc->ht[n]->carry        = NULL;
+        ncc->ht[n]->ncarry       = 0;
+        ncc->ht[n]->has_seq0     = 0;
         ncc->ht[n]->next         = NULL; 
         ncc->ht[n]->prev         = NULL; 
         p = ncc->ht[n];
@@ -63,10 +70,18 @@ ht_insert(four_tuple_t *ft, ncc_t *ncc)
         }
         memcpy(&(p->next->ft), ft, sizeof (four_tuple_t));
         p->next->timestamp    = time(NULL);
-        p->next->srchptr_list = NULL;
+        p->next->set          = ncc->set;
+        p->next->srch_state   = SRCH_START;
+        p->next->foot_state   = SRCH_START;
         p->next->extract_list = NULL;
+        p->next->http         = NULL;
+        p->next->anchor       = NULL;
+        p->next->carry        = NULL;
+        p->next->ncarry       = 0;
+        p->next->has_seq0     = 0;
         p->next->next         = NULL; 
         p->next->prev         = p;
+        p = p->next;
 
         /** update ht stats: chained entry */
         ncc->stats.ht_ic++; 
@@ -83,43 +98,118 @@ ht_insert(four_tuple_t *ft, ncc_t *ncc)
         fprintf(stderr, ":%d\n", ntohs(ft->port_dst));
     }
 
+    /** the session sticks with these signatures until it's done */
+    sigs_hold(p->set);
+    ht_link(p, ncc);
+    ncc->mem[NFEX_MEM_SESSIONS] += sizeof (ht_node_t);
+
     /** update ht stats: total entries */
     ncc->stats.ht_entries++;
     return (p);
 }
 
 
-uint16_t
-ht_hash(four_tuple_t *ft)
+/*
+ * where a flow goes in the session table.  the hash is keyed with a
+ * secret picked at startup, so whoever chooses the addresses and ports we
+ * see can't work out which flows share a bucket and pile them all into
+ * one chain.  the tuple goes in as two words through two multiply and
+ * fold rounds, the way wyhash does it, a few cycles a flow.
+ */
+uint32_t
+ht_hash(four_tuple_t *ft, ncc_t *ncc)
 {
-   int i;
-   uint8_t *p;
-   uint32_t hash;
-
-   /* Fowler–Noll–Vo hash: http://en.wikipedia.org/wiki/Fowler_Noll_Vo_hash */
-   for (hash = 0, i = 0, p = (uint8_t *)ft; i < 12; p++, i++)
-   {
-      hash *= FNV_PRIME;
-      hash ^= (*p);
-   }
-
-   return (hash % NFEX_HT_SIZE);
+    uint64_t a, b;
+
+    a = ((uint64_t)ft->ip_src << 32) | ft->ip_dst;
+    b = ((uint64_t)ft->port_src << 16) | ft->port_dst;
+    a = ht_mix(a ^ ncc->ht_key[0], b ^ ncc->ht_key[1]);
+    a = ht_mix(a ^ ncc->ht_key[2], ncc->ht_key[3]);
+
+    return (a & NFEX_HT_MASK);
 }
 
+/** 64x64 bit multiply, the halves of the product folded together */
+static uint64_t
+ht_mix(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r;
+
+    r = (__uint128_t)a * b;
+    return ((uint64_t)r ^ (uint64_t)(r >> 64));
+#else
+    uint64_t ah, al, bh, bl, hh, hl, lh, ll, lo, hi;
+
+    ah = a >> 32; al = a & 0xffffffff;
+    bh = b >> 32; bl = b & 0xffffffff;
+    hh = ah * bh; hl = ah * bl; lh = al * bh; ll = al * bl;
+    lo = ll + (hl << 32);
+    hi = hh + (hl >> 32) + (lo < ll);
+    ll = lo;
+    lo = ll + (lh << 32);
+    hi += (lh >> 32) + (lo < ll);
+    return (lo ^ hi);
+#endif
+}
+
+/*
+ * pick the session table's hash key.  it only has to be unguessable from
+ * outside, /dev/urandom if there is one and whatever's lying around if
+ * not.
+ */
+void
+ht_seed(ncc_t *ncc)
+{
+    int fd, i;
+    struct timeval tv;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1 || 
+        read(fd, ncc->ht_key, sizeof (ncc->ht_key)) != sizeof (ncc->ht_key))
+    {
+        gettimeofday(&tv, NULL);
+        ncc->ht_key[0] = ((uint64_t)tv.tv_sec << 32) ^ tv.tv_usec;
+        ncc->ht_key[1] = ((uint64_t)getpid() << 32) ^ (uintptr_t)ncc;
+        ncc->ht_key[2] = (uintptr_t)&tv ^ clock();
+        ncc->ht_key[3] = 0x9e3779b97f4a7c15ULL;
+        for (i = 0; i < 4; i++)
+        {
+            ncc->ht_key[(i + 1) % 4] ^= ht_mix(ncc->ht_key[i], 
+                0xa0761d6478bd642fULL);
+        }
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    /** an even multiplier would throw away the bottom bit */
+    ncc->ht_key[3] |= 1;
+}
 
 ht_node_t *
 ht_find(four_tuple_t *ft, ncc_t *ncc)
 {
-    uint16_t n;
+    return (ht_lookup(ft, ht_hash(ft, ncc), ncc));
+}
+
+/** ht_find() for when the caller already has the hash */
+ht_node_t *
+ht_lookup(four_tuple_t *ft, uint32_t n, ncc_t *ncc)
+{
     ht_node_t *p;
 
-    n = ht_hash(ft);
     for (p = ncc->ht[n]; p; p = p->next)
     {
         if (memcmp(ft, &p->ft, sizeof (four_tuple_t)) == 0)
         {
             /** found him, update timestamp */
             p->timestamp = time(NULL);
+            if (p != ncc->ht_newest)
+            {
+                ht_unlink(p, ncc);
+                ht_link(p, ncc);
+            }
             return (p);
         }
     }
@@ -127,11 +217,219 @@ ht_find(four_tuple_t *ft, ncc_t *ncc)
 }
 
 
+/*
+ * the one way a session goes away, whether it went stale, got evicted,
+ * its stream ended or we're shutting down.  anything it was extracting
+ * is finished with what it has and everything it held is let go
+ */
+void
+ht_remove(ht_node_t *p, ncc_t *ncc)
+{
+    uint32_t n;
+    extract_list_t *e;
+
+    /** none of it ends on its own account, it's not held against them */
+    for (e = p->extract_list; e; e = e->next)
+    {
+        e->cut = 1;
+    }
+    /** a body the HTTP parser is extracting is on the list too */
+    http_free(p, ncc);
+    while (p->extract_list)
+    {
+        extract_close(&(p->extract_list), p->extract_list, ncc);
+    }
+    if (ncc->session == p)
+    {
+        ncc->session = NULL;
+    }
+
+    if (p->prev == NULL)
+    {
+        /** first entry in a chain, the next guy (if any) moves up */
+        n = ht_hash(&p->ft, ncc);
+        ncc->ht[n] = p->next;
+        if (p->next)
+        {
+            p->next->prev = NULL;
+            /** update ht stats: a chained entry became non chained */
+            ncc->stats.ht_ic--;
+        }
+        else
+        {
+            /** update ht stats: non chained entry */
+            ncc->stats.ht_nc--;
+        }
+    }
+    else
+    {
+        p->prev->next = p->next;
+        if (p->next)
+        {
+            p->next->prev = p->prev;
+        }
+        /** update ht stats: chained entry */
+        ncc->stats.ht_ic--;
+    }
+    ht_unlink(p, ncc);
+    sigs_release(p->set);
+    if (p->anchor)
+    {
+        free(p->anchor);
+        ncc->mem[NFEX_MEM_SEARCH] -= sizeof (srch_anchor_t);
+    }
+    if (p->carry)
+    {
+        free(p->carry);
+        ncc->mem[NFEX_MEM_SEARCH] -= p->carrysz;
+    }
+    free(p);
+    ncc->mem[NFEX_MEM_SESSIONS] -= sizeof (ht_node_t);
+
+    /** update ht stats: total entries */
+    ncc->stats.ht_entries--;
+}
+
+/** the session was just seen, it goes on the newest end */
+static void
+ht_link(ht_node_t *p, ncc_t *ncc)
+{
+    p->newer = NULL;
+    p->older = ncc->ht_newest;
+    if (p->older)
+    {
+        p->older->newer = p;
+    }
+    else
+    {
+        ncc->ht_oldest = p;
+    }
+    ncc->ht_newest = p;
+}
+
+static void
+ht_unlink(ht_node_t *p, ncc_t *ncc)
+{
+    if (p->older)
+    {
+        p->older->newer = p->newer;
+    }
+    else
+    {
+        ncc->ht_oldest = p->newer;
+    }
+    if (p->newer)
+    {
+        p->newer->older = p->older;
+    }
+    else
+    {
+        ncc->ht_newest = p->older;
+    }
+}
+
+/** everything the flows are holding onto right now */
+uint64_t
+ht_mem(ncc_t *ncc)
+{
+    int i;
+    uint64_t n;
+
+    for (i = 0, n = 0; i < NFEX_MEM_FLOW_N; i++)
+    {
+        n += ncc->mem[i];
+    }
+    return (n);
+}
+
+/*
+ * keep the flows inside the -m budget.  once it's blown, sessions are 
+ * dropped until we're an eighth under it again, least recently seen 
+ * first and ones that aren't extracting anything before ones that are.  
+ * an extraction that gets dropped is finished with whatever it had.
+ */
+void
+ht_govern(ncc_t *ncc)
+{
+    int pass;
+    uint64_t limit, low;
+    ht_node_t *p, *q;
+
+    /** the dedup table's share comes off the top, it keeps itself to it */
+    limit = ncc->mem_limit - MIN(ncc->mem[NFEX_MEM_DEDUP], ncc->mem_limit);
+    if (ncc->mem_limit == 0 || ht_mem(ncc) <= limit)
+    {
+        return;
+    }
+    low = limit - limit / 8;
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (p = ncc->ht_oldest; p && ht_mem(ncc) > low; p = q)
+        {
+            q = p->newer;
+            if (p->extract_list && pass == 0)
+            {
+                continue;
+            }
+            if (p->extract_list)
+            {
+                ncc->stats.evicted_extracting++;
+            }
+            else
+            {
+                ncc->stats.evicted_idle++;
+            }
+            ht_remove(p, ncc);
+        }
+    }
+}
+
+
+/** remember where a stream starts when we see its SYN */
+void
+ht_syn_add(four_tuple_t *ft, uint32_t seq0, ncc_t *ncc)
+{
+    syn_cache_t *p;
+
+    p = &(ncc->syn_cache[ht_hash(ft, ncc) % NFEX_SYN_CACHE]);
+    memcpy(&(p->ft), ft, sizeof (four_tuple_t));
+    p->seq0 = seq0;
+}
+
+/*
+ * figure out the stream offset of a packet from its sequence number, 
+ * either from the session or from the SYN cache.  returns -1 if we never 
+ * saw where the stream started.
+ */
+int64_t
+ht_stream_offset(ht_node_t *p, four_tuple_t *ft, uint32_t seq, ncc_t *ncc)
+{
+    syn_cache_t *s;
+
+    if (p && p->has_seq0)
+    {
+        return ((uint32_t)(seq - p->seq0));
+    }
+    s = &(ncc->syn_cache[ht_hash(ft, ncc) % NFEX_SYN_CACHE]);
+    if (memcmp(ft, &(s->ft), sizeof (four_tuple_t)))
+    {
+        return (-1);
+    }
+    if (p)
+    {
+        /** hang onto it, the cache slot will get reused */
+        p->has_seq0 = 1;
+        p->seq0     = s->seq0;
+    }
+    return ((uint32_t)(seq - s->seq0));
+}
+
+
 void
 ht_dump(ncc_t *ncc)
 {
     time_t now;
-    uint16_t n;
+    uint32_t n;
     ht_node_t *p;
 
     if (ncc->stats.ht_entries == 0)
@@ -157,22 +455,14 @@ ht_dump(ncc_t *ncc)
 }
 
 
+/** let every session go, finishing off whatever they were extracting */
 void
 ht_shutitdown(ncc_t *ncc)
 {
-    uint16_t n;
-    ht_node_t *p, *q;
-
-    for (n = 0; n < NFEX_HT_SIZE; n++)
+    while (ncc->ht_oldest)
     {
-        for (p = ncc->ht[n]; p; p = q->next)
-        {
-            q = p;
-            free (p);
-        }
-        ncc->ht[n] = NULL;
+        ht_remove(ncc->ht_oldest, ncc);
     }
-    ncc->stats.ht_entries = 0;
 }
 
 
@@ -180,9 +470,8 @@ void
 ht_expire_session(ncc_t *ncc)
 {
     time_t now;
-    uint16_t n;
     uint32_t j;
-    ht_node_t *p, **q;
+    ht_node_t *p;
 
     if (ncc->stats.ht_entries == 0)
     {
@@ -192,37 +481,15 @@ ht_expire_session(ncc_t *ncc)
 
     now = time(NULL);
 
-    for (j = 0, n = 0; n < NFEX_HT_SIZE; n++)
+    /** stale sessions are all at the oldest end */
+    for (j = 0; (p = ncc->ht_oldest); j++)
     {
-        for (p = ncc->ht[n]; p; p = p->next)
+        /** if the timestamp is older than SESSION_THRESHOLD, delete */
+        if (now - p->timestamp < SESSION_THRESHOLD)
         {
-            /** if the timestamp is older than SESSION_THRESHOLD, delete */
-            if (now - p->timestamp >= SESSION_THRESHOLD)
-            {
-                if (p->prev == NULL)
-                {
-                    /** first entry in a chain */
-                    free(p);
-                    ncc->ht[n] = NULL;
-		    /** update ht stats: non chained entry */
-                    ncc->stats.ht_nc--;
-                }
-                else
-                {
-                    p->prev->next = p->next;
-                    if (p->next)
-                    {
-                        p->next->prev = p->prev;
-                    }
-                    free(p);
-		    /** update ht stats: chained entry */
-                    ncc->stats.ht_ic--;
-                }
-                j++;
-                /** update ht stats: total entries */
-                ncc->stats.ht_entries--;
-            }
+            break;
         }
+        ht_remove(p, ncc);
     }
     if (j && ncc->flags & NFEX_DEBUG)
     {
@@ -231,33 +498,10 @@ ht_expire_session(ncc_t *ncc)
 }
 
 
-uint32_t
-ht_count_extracts(ncc_t *ncc)
-{
-    uint16_t n, j;
-    ht_node_t *p;
-
-    for (n = 0, j = 0; n < NFEX_HT_SIZE; n++)
-    {
-        for (p = ncc->ht[n]; p; p = p->next)
-        {
-            if (p->extract_list)
-            {
-                if (p->extract_list->fd)
-                {
-                    j++;
-                }
-            }
-        }
-    }
-    return (j);
-}
-
-
 void
 ht_status(ncc_t *ncc)
 {
-    uint16_t n;
+    uint32_t n;
 
     if (ncc->stats.ht_entries == 0)
     {
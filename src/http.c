@@ -0,0 +1,439 @@
+/*
+ * http.c - HTTP/1.x message framing
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include "nfex.h"
+#include "http.h"
+#include "util.h"
+
+static int http_line(http_state_t *, ht_node_t *, ncc_t *);
+static void http_body(http_state_t *, ht_node_t *, const uint8_t *, size_t,
+ncc_t *);
+static void http_body_start(http_state_t *, ht_node_t *);
+static void http_message_end(http_state_t *, ht_node_t *, ncc_t *);
+static int http_method(ht_node_t *, ncc_t *);
+
+/** request methods we'll pick up a flow on */
+static char *http_methods[] =
+{
+    "GET ", "POST ", "PUT ", "HEAD ", "DELETE ", "OPTIONS ", "PATCH ",
+    "CONNECT ", NULL
+};
+
+/*
+ * does this payload look like the start of an HTTP/1.x message?  only
+ * called for flows we're not already following
+ */
+int
+http_sniff(const uint8_t *data, size_t size)
+{
+    int i;
+
+    if (size >= 8 && memcmp(data, "HTTP/1.", 7) == 0)
+    {
+        return (1);
+    }
+    for (i = 0; http_methods[i]; i++)
+    {
+        if (size > strlen(http_methods[i]) &&
+            memcmp(data, http_methods[i], strlen(http_methods[i])) == 0)
+        {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+http_state_t *
+http_new(ncc_t *ncc)
+{
+    http_state_t *h;
+
+    h = malloc(sizeof (http_state_t));
+    if (h == NULL)
+    {
+        fprintf(stderr, "http_new(): malloc(): %s\n", strerror(errno));
+        return (NULL);
+    }
+    memset(h, 0, sizeof (http_state_t));
+    h->state = HTTP_IDLE;
+    h->clen  = -1;
+    ncc->mem[NFEX_MEM_SESSIONS] += sizeof (http_state_t);
+
+    return (h);
+}
+
+/** stop following a flow, any body extraction in progress is finished */
+void
+http_free(ht_node_t *session, ncc_t *ncc)
+{
+    http_state_t *h;
+
+    h = session->http;
+    if (h == NULL)
+    {
+        return;
+    }
+    if (h->extract)
+    {
+        extract_close(&(session->extract_list), h->extract, ncc);
+    }
+    free(h);
+    session->http = NULL;
+    ncc->mem[NFEX_MEM_SESSIONS] -= sizeof (http_state_t);
+}
+
+/*
+ * are we between messages with nothing in flight?  requests still waiting
+ * on their responses keep it around, the other direction needs them
+ */
+int
+http_idle(http_state_t *h)
+{
+    return (h->state == HTTP_IDLE && h->linelen == 0 && h->extract == NULL &&
+        h->mn == 0);
+}
+
+/** FIN or RST, a body that ran to the close is all there */
+void
+http_fin(ht_node_t *session, ncc_t *ncc)
+{
+    if (session->http && session->http->state == HTTP_BODY_CLOSE)
+    {
+        http_message_end(session->http, session, ncc);
+    }
+}
+
+/*
+ * the request a response answers, oldest first off the other direction's
+ * queue.  HTTP_M_OTHER if we never saw it
+ */
+static int
+http_method(ht_node_t *session, ncc_t *ncc)
+{
+    int m;
+    ht_node_t *peer;
+    four_tuple_t ft;
+
+    ft.ip_src   = session->ft.ip_dst;
+    ft.ip_dst   = session->ft.ip_src;
+    ft.port_src = session->ft.port_dst;
+    ft.port_dst = session->ft.port_src;
+    peer = ht_find(&ft, ncc);
+    if (peer == NULL || peer->http == NULL || peer->http->mn == 0)
+    {
+        return (HTTP_M_OTHER);
+    }
+    m = peer->http->methods[peer->http->mhead];
+    peer->http->mhead = (peer->http->mhead + 1) % HTTP_PIPELINE;
+    peer->http->mn--;
+    return (m);
+}
+
+/*
+ * walk a packet worth of data through the HTTP parser.  header lines are
+ * parsed, message bodies are checked against the search machine at their
+ * first byte and are then either extracted or skipped outright.  returns
+ * -1 if the flow doesn't frame like HTTP and we should give up on it.
+ */
+int
+http_process(ht_node_t *session, const uint8_t *data, size_t size,
+ncc_t *ncc)
+{
+    size_t i, n;
+    http_state_t *h;
+
+    h = session->http;
+    for (i = 0; i < size; )
+    {
+        switch (h->state)
+        {
+            case HTTP_BODY:
+            case HTTP_CHUNK_DATA:
+                n = size - i;
+                if (n > h->remaining)
+                {
+                    n = h->remaining;
+                }
+                http_body(h, session, data + i, n, ncc);
+                h->remaining -= n;
+                i += n;
+                if (h->remaining == 0)
+                {
+                    if (h->state == HTTP_BODY)
+                    {
+                        http_message_end(h, session, ncc);
+                    }
+                    else
+                    {
+                        h->state = HTTP_CHUNK_CRLF;
+                    }
+                }
+                break;
+            case HTTP_BODY_CLOSE:
+                /** runs until the flow goes away */
+                http_body(h, session, data + i, size - i, ncc);
+                i = size;
+                break;
+            default:
+                /** everything else is line oriented */
+                if (data[i] == '\n')
+                {
+                    h->line[h->linelen] = '\0';
+                    if (h->linelen && h->line[h->linelen - 1] == '\r')
+                    {
+                        h->line[--h->linelen] = '\0';
+                    }
+                    if (http_line(h, session, ncc) == -1)
+                    {
+                        return (-1);
+                    }
+                    h->linelen = 0;
+                }
+                else if (h->linelen < HTTP_LINE_MAX - 1)
+                {
+                    /** overly long lines are truncated, not fatal */
+                    h->line[h->linelen++] = data[i];
+                }
+                i++;
+                break;
+        }
+    }
+    return (1);
+}
+
+/** handle one complete line in one of the line oriented states */
+static int
+http_line(http_state_t *h, ht_node_t *session, ncc_t *ncc)
+{
+    int m;
+    char *p;
+    uint64_t n;
+
+    switch (h->state)
+    {
+        case HTTP_IDLE:
+            if (h->linelen == 0)
+            {
+                /** stray CRLF between messages */
+                return (1);
+            }
+            if (strncmp(h->line, "HTTP/1.", 7) == 0)
+            {
+                h->response = 1;
+                p = strchr(h->line, ' ');
+                h->status = p ? atoi(p + 1) : 0;
+            }
+            else if (http_sniff((uint8_t *)h->line, h->linelen))
+            {
+                h->response = 0;
+                h->status   = 0;
+
+                /** the response to it is framed by what it asked for */
+                m = HTTP_M_OTHER;
+                if (strncmp(h->line, "HEAD ", 5) == 0)
+                {
+                    m = HTTP_M_HEAD;
+                }
+                else if (strncmp(h->line, "CONNECT ", 8) == 0)
+                {
+                    m = HTTP_M_CONNECT;
+                }
+                if (h->mn == HTTP_PIPELINE)
+                {
+                    /** too far ahead of the responses, lose the oldest */
+                    h->mhead = (h->mhead + 1) % HTTP_PIPELINE;
+                    h->mn--;
+                }
+                h->methods[(h->mhead + h->mn++) % HTTP_PIPELINE] = m;
+            }
+            else
+            {
+                /** lost the framing */
+                return (-1);
+            }
+            h->chunked = 0;
+            h->clen    = -1;
+            h->state   = HTTP_HEADERS;
+            ncc->stats.http_msgs++;
+            break;
+        case HTTP_HEADERS:
+            if (h->linelen)
+            {
+                if (strncasecmp(h->line, "Content-Length:", 15) == 0)
+                {
+                    h->clen = strtoll(h->line + 15, NULL, 10);
+                }
+                else if (strncasecmp(h->line, "Transfer-Encoding:", 18) == 0)
+                {
+                    for (p = h->line + 18; *p; p++)
+                    {
+                        if (strncasecmp(p, "chunked", 7) == 0)
+                        {
+                            h->chunked = 1;
+                            break;
+                        }
+                    }
+                }
+                break;
+            }
+            /** end of headers, figure out how the body is delimited */
+            m = HTTP_M_OTHER;
+            if (h->response && (h->status < 100 || h->status >= 200))
+            {
+                /** a final response, interim ones don't answer anything */
+                m = http_method(session, ncc);
+            }
+            if (h->response &&
+                ((h->status >= 100 && h->status < 200) ||
+                 h->status == 204 || h->status == 304 || m == HTTP_M_HEAD ||
+                 (m == HTTP_M_CONNECT && h->status < 300)))
+            {
+                /** these never carry a body */
+                http_message_end(h, session, ncc);
+            }
+            else if (h->chunked)
+            {
+                http_body_start(h, session);
+                h->state = HTTP_CHUNK_SIZE;
+            }
+            else if (h->clen > 0)
+            {
+                http_body_start(h, session);
+                h->remaining = h->clen;
+                h->state     = HTTP_BODY;
+            }
+            else if (h->clen == -1 && h->response)
+            {
+                http_body_start(h, session);
+                h->state = HTTP_BODY_CLOSE;
+            }
+            else
+            {
+                /** requests without a length have no body */
+                http_message_end(h, session, ncc);
+            }
+            break;
+        case HTTP_CHUNK_SIZE:
+            if (h->linelen == 0)
+            {
+                return (1);
+            }
+            n = strtoull(h->line, &p, 16);
+            if (p == h->line)
+            {
+                return (-1);
+            }
+            if (n == 0)
+            {
+                h->state = HTTP_TRAILERS;
+            }
+            else
+            {
+                h->remaining = n;
+                h->state     = HTTP_CHUNK_DATA;
+            }
+            break;
+        case HTTP_CHUNK_CRLF:
+            if (h->linelen)
+            {
+                return (-1);
+            }
+            h->state = HTTP_CHUNK_SIZE;
+            break;
+        case HTTP_TRAILERS:
+            if (h->linelen == 0)
+            {
+                http_message_end(h, session, ncc);
+            }
+            break;
+        default:
+            break;
+    }
+    return (1);
+}
+
+/** get ready to check the first bytes of a new body */
+static void
+http_body_start(http_state_t *h, ht_node_t *session)
+{
+    h->magic.machine = session->set->body_machine;
+    h->magic.state   = SRCH_START;
+    h->magic.len     = 0;
+}
+
+/*
+ * the first few bytes of a body are walked through the body machine.  if
+ * a HEADER completes there we extract exactly the body, otherwise the 
+ * body is skipped without being scanned at all.
+ */
+static void
+http_body(http_state_t *h, ht_node_t *session, const uint8_t *data,
+size_t size, ncc_t *ncc)
+{
+    size_t i;
+    fileid_t *fileid;
+
+    i = 0;
+    if (h->magic.machine)
+    {
+        fileid = search_anchor(&h->magic, data, size, &i);
+        if (fileid)
+        {
+            h->extract = extract_open(&(session->extract_list), fileid, 
+                session, ncc);
+        }
+        if (h->extract)
+        {
+            /** size it exactly if we know how long the body is */
+            if (!h->chunked && h->clen > 0 && h->clen < h->extract->limit)
+            {
+                h->extract->limit = h->clen;
+            }
+            /** the walk saved everything up to here, this packet included */
+            extract_write(h->extract, h->magic.prefix, h->magic.len, ncc);
+        }
+    }
+
+    if (h->extract == NULL)
+    {
+        ncc->stats.http_bypassed += size - i;
+        return;
+    }
+    if (i < size && h->extract->finish == 0)
+    {
+        extract_write(h->extract, data + i, size - i, ncc);
+    }
+    if (h->extract->finish)
+    {
+        /** the end of the body, or maxlen before it */
+        if (!h->chunked && h->extract->limit == h->clen)
+        {
+            h->extract->complete = 1;
+        }
+        extract_close(&(session->extract_list), h->extract, ncc);
+        h->extract = NULL;
+    }
+}
+
+/** a message is done, close out whatever we were doing with its body */
+static void
+http_message_end(http_state_t *h, ht_node_t *session, ncc_t *ncc)
+{
+    if (h->extract)
+    {
+        /** we saw the whole body */
+        h->extract->complete = 1;
+        extract_close(&(session->extract_list), h->extract, ncc);
+        h->extract = NULL;
+    }
+    h->magic.machine = NULL;
+    h->state         = HTTP_IDLE;
+}
+
+/** EOF */
@@ -10,12 +10,14 @@
 #include "nfex.h"
 
 extern FILE *yyin;
+void yyrestart(FILE *);
 
 ncc_t *
-control_context_init(char *output_dir, char *yyinfname, char *device, 
+control_context_init(nfex_output_t *output, nfex_conf_t *conf, char *device, 
 char *capfname, char *geoip_data, char *bpf, u_int16_t flags, char *errbuf)
 {
     int n;
+    uint32_t i;
     ncc_t *ncc;
     struct rlimit rl;
     struct termios term;
@@ -36,7 +38,9 @@ char *capfname, char *geoip_data, char *bpf, u_int16_t flags, char *errbuf)
     ncc->flags    = flags;
     ncc->device   = device;
     strcpy(ncc->capfname, capfname);
-    strcpy(ncc->output_dir, output_dir);
+    memcpy(&(ncc->output), output, sizeof (nfex_output_t));
+    ncc->packer.codec = output->codec;
+    ncc->packer.fd    = -1;
 
     /** initialize hash table */
     for (n = 0; n < NFEX_HT_SIZE; n++)
@@ -44,38 +48,33 @@ char *capfname, char *geoip_data, char *bpf, u_int16_t flags, char *errbuf)
         /** not needed!@ */
         ncc->ht[n] = NULL;
     }
+    ht_seed(ncc);
 
     /** setup the output directory prefix stuff */
-    if (ncc->output_dir[0])
+    for (n = 0; n < ncc->output.n; n++)
     {
-        if (stat(output_dir, &stat_info) == -1)
+        if (stat(ncc->output.dir[n], &stat_info) == -1)
         {
-            if (mkdir(output_dir, S_IRWXU|S_IRWXG|S_IRWXO) == -1)
+            if (mkdir(ncc->output.dir[n], S_IRWXU|S_IRWXG|S_IRWXO) == -1)
             {
-                fprintf(stderr, "can't create output dir %s:%s\n", output_dir,
-                    strerror(errno));
+                fprintf(stderr, "can't create output dir %s:%s\n", 
+                    ncc->output.dir[n], strerror(errno));
             }
         }
     }
 
-    if (yyinfname[0] == 0)
+    memcpy(&(ncc->conf), conf, sizeof (nfex_conf_t));
+    ncc->set = sigs_new();
+    if (config_load(ncc->set, &(ncc->conf)) == -1)
     {
-        sprintf(ncc->yyinfname, "%s", NFEX_DEFAULT_CONFIG_FILE);
+        goto err;
     }
-    else
+    extract_tally(ncc->set, ncc);
+    if (profile_init(ncc) == -1)
     {
-        strcpy(ncc->yyinfname, yyinfname);
-    }
-
-    yyin = fopen(ncc->yyinfname, "r");
-    if (yyin == NULL)
-    {
-        fprintf(stderr, "can't open config file %s: %s\n", ncc->yyinfname,
-            strerror(errno));
         goto err;
     }
-    printf("loading configuration file...\n");
-    yyparse((void *)ncc);
+    reload_init(ncc);
 
     /** if a pcap file was specified, we go that route */
     if (ncc->capfname[0])
@@ -199,17 +198,6 @@ char *capfname, char *geoip_data, char *bpf, u_int16_t flags, char *errbuf)
         /** nonfatal */
     }
 
-    /** open the index file */
-    snprintf(ncc->indexfname, FILENAME_BUFFER_SIZE, "%s%d-index.txt",
-        ncc->output_dir == NULL ? "" : ncc->output_dir, getpid());
-
-    ncc->indexfp = fopen(ncc->indexfname, "w");
-    if (ncc->indexfp == NULL)
-    {
-        fprintf(stderr, "can't open index file: %s\n", strerror(errno));
-        goto err;
-    }
-
 #if (HAVE_GEOIP)
     /** power up the MaxMind Geo IP targeting stuff */
     if (geoip_data[0] == 0)
@@ -228,8 +216,27 @@ char *capfname, char *geoip_data, char *bpf, u_int16_t flags, char *errbuf)
     }
 #endif /** HAVE_GEOIP */
 
-    printf("what we're working with:\noutput dir:\t%s\nconfig file:\t%s\n", 
-        ncc->output_dir, ncc->yyinfname);
+    printf("what we're working with:\n");
+    for (n = 0; n < MAX(ncc->output.n, 1); n++)
+    {
+        printf("output dir:\t%s\n", ncc->output.dir[n]);
+    }
+    if (ncc->output.layout)
+    {
+        printf("laid out by:\t%s%s%s\n", 
+            ncc->output.layout & NFEX_LAYOUT_TIME ? "hour" : "",
+            ncc->output.layout == (NFEX_LAYOUT_TIME|NFEX_LAYOUT_HASH) ?
+            " and " : "", ncc->output.layout & NFEX_LAYOUT_HASH ? "hash" : "");
+    }
+    if (ncc->output.n > 1)
+    {
+        printf("spread by:\t%s\n", ncc->output.spread == NFEX_SPREAD_SPACE ?
+            "free space" : "turns");
+    }
+    for (n = 0; n < ncc->conf.n; n++)
+    {
+        printf("config file:\t%s\n", ncc->conf.fname[n]);
+    }
     if (ncc->device)
     {
         printf("device\t\t%s\n", ncc->device);
@@ -240,7 +247,18 @@ char *capfname, char *geoip_data, char *bpf, u_int16_t flags, char *errbuf)
         printf("pcap filesize:\t%zu bytes\n", ncc->capfsize); 
     }
     printf("pcap filter:\t%s\n", bpf);
-    printf("index file:\t%s\n", ncc->indexfname);
+    for (i = 0; i < ncc->nprofiles; i++)
+    {
+        if (ncc->nprofiles == 1)
+        {
+            printf("index file:\t%s\n", ncc->profile[i].indexfname);
+        }
+        else
+        {
+            printf("profile %s:\t%s\n", ncc->set->profile[i],
+                ncc->profile[i].indexfname);
+        }
+    }
 #if (HAVE_GEOIP)
     printf("geoIP database:\t%s\n", ncc->geoip_data);
 #endif
@@ -248,6 +266,10 @@ char *capfname, char *geoip_data, char *bpf, u_int16_t flags, char *errbuf)
     {
         printf("verbosity on\n");
     }
+    if (flags & NFEX_HTTP)
+    {
+        printf("HTTP aware extraction on\n");
+    }
 #if (HAVE_GEOIP)
     if (flags & NFEX_GEOIP)
     {
@@ -275,9 +297,178 @@ err:
     return (NULL);
 }
 
+/*
+ * get a set's file types and search machines from the config files,
+ * either by mapping a signature image or by parsing them and building the
+ * machines ourselves.  every config file is a profile and they all build
+ * into the one set of machines.
+ */
+int
+config_load(srch_set_t *set, nfex_conf_t *conf)
+{
+    int n, i;
+    char *p, *q;
+
+    if (conf->n == 1)
+    {
+        n = sigs_load(set, conf->fname[0]);
+        if (n != 0)
+        {
+            return (n);
+        }
+    }
+
+    for (i = 0; i < conf->n; i++)
+    {
+        if (sigs_probe(conf->fname[i]))
+        {
+            fprintf(stderr, "%s: a signature image has to be the only -c, "
+                "compile the config files into one with --compile-sigs\n",
+                conf->fname[i]);
+            return (-1);
+        }
+    }
+
+    for (i = 0; i < conf->n; i++)
+    {
+        yyin = fopen(conf->fname[i], "r");
+        if (yyin == NULL)
+        {
+            fprintf(stderr, "can't open config file %s: %s\n", 
+                conf->fname[i], strerror(errno));
+            return (-1);
+        }
+
+        /** the profile is named after the file, fileids pick it up */
+        p = strrchr(conf->fname[i], '/');
+        p = p ? p + 1 : conf->fname[i];
+        q = set->profile[set->nprofiles];
+        memset(q, 0, SRCH_PROFILE_NAME);
+        snprintf(q, SRCH_PROFILE_NAME, "%s", p);
+        p = strchr(q, '.');
+        if (p && p != q)
+        {
+            *p = 0;
+        }
+        for (n = 0; n < (int)set->nprofiles; n++)
+        {
+            if (strcmp(set->profile[n], q) == 0)
+            {
+                snprintf(q, SRCH_PROFILE_NAME, "%s.%d", set->profile[n], i);
+                break;
+            }
+        }
+        set->nprofiles++;
+
+        printf("loading configuration file %s...\n", conf->fname[i]);
+        yyrestart(yyin);
+        yyparse((void *)set);
+        fclose(yyin);
+    }
+
+    /** now that we have every pattern, build the search machines */
+    search_build(set->srch_machine, 0, set->fileids, "HEADER");
+    search_build(set->foot_machine, 0, set->fileids, "FOOTER");
+    search_build(set->strm_machine, 1, set->fileids, "stream anchored");
+    search_build(set->body_machine, 1, set->fileids, "HTTP body");
+
+    return (1);
+}
+
+/*
+ * give each of the set's profiles somewhere to put its files and an 
+ * index.  a profile goes where its -c said, otherwise in the -o 
+ * directories, or a directory named after it in each of them if there's
+ * more than one profile.  its index goes in the first.
+ */
+static int
+profile_init(ncc_t *ncc)
+{
+    int j, nbases;
+    uint32_t i;
+    char *base[NFEX_OUTPUT_MAX];
+    nfex_profile_t *pr;
+
+    /** one -c can be an image holding several profiles */
+    for (j = 0; j < ncc->output.n; j++)
+    {
+        base[j] = ncc->output.dir[j];
+    }
+    nbases = ncc->output.n;
+    if (nbases == 0)
+    {
+        /** the cwd */
+        base[nbases++] = "";
+    }
+    if (ncc->conf.n == 1 && ncc->conf.dir[0])
+    {
+        base[0] = ncc->conf.dir[0];
+        nbases  = 1;
+        if (base[0][0] && mkdir(base[0], S_IRWXU|S_IRWXG|S_IRWXO) == -1 &&
+            errno != EEXIST)
+        {
+            fprintf(stderr, "can't create output dir %s: %s\n", base[0],
+                strerror(errno));
+            return (-1);
+        }
+    }
+
+    ncc->nprofiles = ncc->set->nprofiles;
+    for (i = 0; i < ncc->nprofiles; i++)
+    {
+        /** no segments until there's something to put in them */
+        ncc->profile[i].archive.fd  = -1;
+        ncc->profile[i].archive.ifd = -1;
+    }
+    for (i = 0; i < ncc->nprofiles; i++)
+    {
+        pr = &(ncc->profile[i]);
+        pr->ndirs = ncc->conf.n > 1 && ncc->conf.dir[i] ? 1 : nbases;
+        for (j = 0; j < pr->ndirs; j++)
+        {
+            if (ncc->conf.n > 1 && ncc->conf.dir[i])
+            {
+                snprintf(pr->dir[j].path, sizeof (pr->dir[j].path), "%s",
+                    ncc->conf.dir[i]);
+            }
+            else if (ncc->nprofiles > 1)
+            {
+                snprintf(pr->dir[j].path, sizeof (pr->dir[j].path), "%s%s/",
+                    base[j], ncc->set->profile[i]);
+            }
+            else
+            {
+                snprintf(pr->dir[j].path, sizeof (pr->dir[j].path), "%s",
+                    base[j]);
+            }
+            if (pr->dir[j].path[0] && 
+                mkdir(pr->dir[j].path, S_IRWXU|S_IRWXG|S_IRWXO) == -1 &&
+                errno != EEXIST)
+            {
+                fprintf(stderr, "can't create output dir %s: %s\n",
+                    pr->dir[j].path, strerror(errno));
+                return (-1);
+            }
+        }
+
+        snprintf(pr->indexfname, sizeof (pr->indexfname), "%s%d-index.txt",
+            pr->dir[0].path, getpid());
+        pr->indexfp = fopen(pr->indexfname, "w");
+        if (pr->indexfp == NULL)
+        {
+            fprintf(stderr, "can't open index file %s: %s\n", 
+                pr->indexfname, strerror(errno));
+            return (-1);
+        }
+    }
+    return (1);
+}
+
 void
 control_context_destroy(ncc_t *ncc)
 {
+    uint32_t i;
+
     if (ncc->p)
     {
         pcap_close(ncc->p);
@@ -292,7 +483,24 @@ control_context_destroy(ncc_t *ncc)
         GeoIP_delete(ncc->gi);
     }
 #endif /** HAVE_GEOIP */
+    reload_stop(ncc);
     ht_shutitdown(ncc);
+    extract_pool_free(ncc);
+    dedup_free(ncc);
+    sigs_release(ncc->set);
+    extract_tally_free(ncc);
+    for (i = 0; i < ncc->nprofiles; i++)
+    {
+        if (ncc->profile[i].indexfp)
+        {
+            fclose(ncc->profile[i].indexfp);
+        }
+    }
+    archive_stop(ncc);
+    for (i = 0; i < NFEX_BATCH; i++)
+    {
+        free(ncc->batch[i].data);
+    }
 
     /** log_close(ncc); */
 
@@ -12,20 +12,44 @@
 #include "nfex.h"
 #include "config.h"
 #include "util.h"
+#include "compress.h"
+
+static struct option long_options[] =
+{
+    {"compile-sigs", required_argument, NULL, 'C'},
+    {"emit-c",       required_argument, NULL, 'E'},
+    {"scanner",      required_argument, NULL, 'S'},
+    {"bench",        no_argument,       NULL, 'B'},
+    {"soak",         required_argument, NULL, 'K'},
+    {"layout",       required_argument, NULL, 'L'},
+    {"spread",       required_argument, NULL, 'P'},
+    {"dedup",        required_argument, NULL, 'U'},
+    {"dedup-store",  required_argument, NULL, 'Q'},
+    {"hashes",       required_argument, NULL, 'A'},
+    {"archive",      required_argument, NULL, 'Y'},
+    {"compress",     required_argument, NULL, 'Z'},
+    {NULL,           0,                 NULL, 0}
+};
 
 int
 main(int argc, char *argv[])
 {
-    int c, n;
+    int c, n, bench, passes, dedup, digests;
+    uint64_t mem_limit;
+    uint32_t max_extracts, max_flow_extracts;
     ncc_t *ncc;
     char *device, *p;
     u_int16_t flags;
     char capfname[128];
-    char yyinfname[128];
+    nfex_conf_t conf;
+    char sigsfname[128];
+    char genfname[128];
+    char scanfname[128];
+    char storefname[128];
 #if (HAVE_GEOIP)
     char geoip_data[128];
 #endif /** HAVE_GEOIP */
-    char output_dir[128];
+    nfex_output_t output;
     char bpf[128];
     char errbuf[PCAP_ERRBUF_SIZE];
 
@@ -35,18 +59,45 @@ main(int argc, char *argv[])
     }
 
     flags = 0;
+    bench = 0;
+    passes = 0;
+    dedup = DEDUP_OFF;
+    digests = 0;
+    mem_limit = 0;
+    max_extracts = 0;
+    max_flow_extracts = 0;
     device = NULL;
     memset(bpf,        0, sizeof (bpf));
     memset(capfname,   0, sizeof (capfname));
-    memset(yyinfname,  0, sizeof (yyinfname));
-    memset(output_dir, 0, sizeof (output_dir));
+    memset(&conf,      0, sizeof (conf));
+    memset(sigsfname,  0, sizeof (sigsfname));
+    memset(genfname,   0, sizeof (genfname));
+    memset(scanfname,  0, sizeof (scanfname));
+    memset(storefname, 0, sizeof (storefname));
+    memset(&output, 0, sizeof (output));
 #if (HAVE_GEOIP)
     memset(geoip_data, 0, sizeof (geoip_data));
 #endif /** HAVE_GEOIP */
-    while ((c = getopt(argc, argv, "c:Dd:G:gf:o:hVv")) != EOF)
+    while ((c = getopt_long(argc, argv, "c:Dd:G:gf:Hm:o:hVvx:X:", long_options,
+            NULL)) != EOF)
     {
         switch (c)
         {
+            case 'C':
+                strncpy(sigsfname, optarg, 127);
+                break;
+            case 'E':
+                strncpy(genfname, optarg, 127);
+                break;
+            case 'S':
+                strncpy(scanfname, optarg, 127);
+                break;
+            case 'B':
+                bench = 1;
+                break;
+            case 'K':
+                passes = atoi(optarg);
+                break;
             case 'f':
                 strncpy(capfname, optarg, 127);
                 break;
@@ -57,7 +108,33 @@ main(int argc, char *argv[])
                 device = strdup(optarg);
                 break;
             case 'c':
-                strncpy(yyinfname, optarg, 127);
+                if (conf.n == SRCH_PROFILE_MAX)
+                {
+                    fprintf(stderr, "too many -c files, %d at most\n",
+                        SRCH_PROFILE_MAX);
+                    return (EXIT_FAILURE);
+                }
+                /** file[,outdir] */
+                conf.fname[conf.n] = strdup(optarg);
+                p = strchr(conf.fname[conf.n], ',');
+                if (p)
+                {
+                    *p++ = 0;
+                    conf.dir[conf.n] = emalloc(strlen(p) + 2);
+                    strcpy(conf.dir[conf.n], p);
+                    if (p[0] && p[strlen(p) - 1] != '/')
+                    {
+                        strcat(conf.dir[conf.n], "/");
+                    }
+                }
+                conf.n++;
+                break;
+            case 'H':
+                flags |= NFEX_HTTP;
+                break;
+            case 'm':
+                /** in MB */
+                mem_limit = strtoull(optarg, NULL, 10) << 20;
                 break;
 #if (HAVE_GEOIP)
             case 'G':
@@ -68,15 +145,126 @@ main(int argc, char *argv[])
                 break;
 #endif /** HAVE_GEOIP */
             case 'o':
+                if (output.n == NFEX_OUTPUT_MAX)
+                {
+                    fprintf(stderr, "at most %d -o directories\n",
+                        NFEX_OUTPUT_MAX);
+                    return (EXIT_FAILURE);
+                }
+                p = output.dir[output.n++];
                 if (optarg[strlen(optarg) - 1] != '/')
                 {
-                    strncpy(output_dir, optarg, 126);
-                    output_dir[strlen(optarg)] = '/';
-                    output_dir[strlen(optarg) + 1] = '\0';
+                    strncpy(p, optarg, 126);
+                    n        = strlen(p);
+                    p[n]     = '/';
+                    p[n + 1] = '\0';
+                }
+                else
+                {
+                    strncpy(p, optarg, 127); 
+                }
+                break;
+            case 'L':
+                for (p = strtok(optarg, ","); p; p = strtok(NULL, ","))
+                {
+                    if (strcmp(p, "time") == 0)
+                    {
+                        output.layout |= NFEX_LAYOUT_TIME;
+                    }
+                    else if (strcmp(p, "hash") == 0)
+                    {
+                        output.layout |= NFEX_LAYOUT_HASH;
+                    }
+                    else if (strcmp(p, "flat"))
+                    {
+                        fprintf(stderr, "--layout is flat, time, hash or "
+                            "time,hash\n");
+                        return (EXIT_FAILURE);
+                    }
+                }
+                break;
+            case 'P':
+                if (strcmp(optarg, "rr") == 0)
+                {
+                    output.spread = NFEX_SPREAD_RR;
+                }
+                else if (strcmp(optarg, "space") == 0)
+                {
+                    output.spread = NFEX_SPREAD_SPACE;
+                }
+                else
+                {
+                    fprintf(stderr, "--spread is rr or space\n");
+                    return (EXIT_FAILURE);
+                }
+                break;
+            case 'U':
+                if (strcmp(optarg, "link") == 0)
+                {
+                    dedup = DEDUP_LINK;
+                }
+                else if (strcmp(optarg, "ref") == 0)
+                {
+                    dedup = DEDUP_REF;
+                }
+                else
+                {
+                    fprintf(stderr, "--dedup is link or ref\n");
+                    return (EXIT_FAILURE);
+                }
+                break;
+            case 'Q':
+                strncpy(storefname, optarg, 127);
+                break;
+            case 'A':
+                for (p = strtok(optarg, ","); p; p = strtok(NULL, ","))
+                {
+                    if (strcmp(p, "md5") == 0)
+                    {
+                        digests |= DIGEST_MD5;
+                    }
+                    else if (strcmp(p, "sha1") == 0)
+                    {
+                        digests |= DIGEST_SHA1;
+                    }
+                    else if (strcmp(p, "sha256") == 0)
+                    {
+                        digests |= DIGEST_SHA256;
+                    }
+                    else
+                    {
+                        fprintf(stderr, "--hashes is any of md5, sha1 and "
+                            "sha256\n");
+                        return (EXIT_FAILURE);
+                    }
+                }
+                break;
+            case 'Y':
+                if (atoi(optarg) <= 0)
+                {
+                    fprintf(stderr, "--archive is a segment size in MB\n");
+                    return (EXIT_FAILURE);
+                }
+                output.segment = (uint64_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'Z':
+                if (strcmp(optarg, "zstd") == 0)
+                {
+                    output.codec = ARCHIVE_ZSTD;
+                }
+                else if (strcmp(optarg, "lz4") == 0)
+                {
+                    output.codec = ARCHIVE_LZ4;
                 }
                 else
                 {
-                    strncpy(output_dir, optarg, 127); 
+                    fprintf(stderr, "--compress is zstd or lz4\n");
+                    return (EXIT_FAILURE);
+                }
+                if (!compress_available(output.codec))
+                {
+                    fprintf(stderr, "nfex wasn't built with %s\n", optarg);
+                    return (EXIT_FAILURE);
                 }
                 break;
             case 'h':
@@ -89,22 +277,74 @@ main(int argc, char *argv[])
                 printf("%s v%s\n", PACKAGE, VERSION);
                 return (EXIT_SUCCESS);
                 break;
+            case 'x':
+                max_extracts = atoi(optarg);
+                break;
+            case 'X':
+                max_flow_extracts = atoi(optarg);
+                break;
             default:
                 usage(argv[0]);
                 break;
         }
     }
 
+    if (conf.n == 0)
+    {
+        conf.fname[conf.n++] = NFEX_DEFAULT_CONFIG_FILE;
+    }
+
+    /** compile the config files into a signature image and we're done */
+    if (sigsfname[0])
+    {
+        return (sigs_compile(&conf, sigsfname) == -1 ? EXIT_FAILURE :
+            EXIT_SUCCESS);
+    }
+
+    /** or just see how it does */
+    if (bench)
+    {
+        return (sigs_bench(&conf) == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    /** or into C for a generated scanner */
+    if (genfname[0])
+    {
+        return (gen_compile(&conf, genfname) == -1 ? EXIT_FAILURE :
+            EXIT_SUCCESS);
+    }
+
     /** build bpf filter string, if arguments remain, use that. */
     p = bpf;
     build_bpf_filter(&argv[optind], &p);
 
+    if (storefname[0] && dedup == DEDUP_OFF)
+    {
+        fprintf(stderr, "--dedup-store goes with --dedup\n");
+        return (EXIT_FAILURE);
+    }
+    if (output.segment && dedup)
+    {
+        fprintf(stderr, "--dedup works on files, not an --archive\n");
+        return (EXIT_FAILURE);
+    }
+    if (output.codec && output.segment == 0)
+    {
+        fprintf(stderr, "--compress is for the segments of an --archive\n");
+        return (EXIT_FAILURE);
+    }
+    if (passes > 0 && capfname[0] == 0)
+    {
+        fprintf(stderr, "--soak replays a capture file, it needs -f\n");
+        return (EXIT_FAILURE);
+    }
+
     printf("nfex - realtime network file extraction engine\n");
 #if (HAVE_GEOIP)
-    ncc = control_context_init(output_dir, yyinfname, device, capfname, 
+    ncc = control_context_init(&output, &conf, device, capfname, 
             geoip_data, bpf, flags, errbuf);
 #else
-    ncc = control_context_init(output_dir, yyinfname, device, capfname, 
+    ncc = control_context_init(&output, &conf, device, capfname, 
             NULL, bpf, flags, errbuf);
 #endif /** HAVE_GEOIP */
 
@@ -113,16 +353,38 @@ main(int argc, char *argv[])
         fprintf(stderr, "can't initialize program.\n");
         return (EXIT_FAILURE);
     }
+    strcpy(ncc->scanfname, scanfname);
+    ncc->mem_limit = mem_limit;
+    ncc->max_extracts = max_extracts;
+    ncc->max_flow_extracts = max_flow_extracts;
+    /** dedup goes by SHA-256, so it's always worked out */
+    ncc->digests = digests | (dedup ? DIGEST_SHA256 : 0);
+    if ((scanfname[0] && gen_load(ncc->set, scanfname) == -1) ||
+        (dedup && dedup_init(ncc, dedup, 
+        storefname[0] ? storefname : NULL) == -1))
+    {
+        fprintf(stderr, "can't initialize program.\n");
+        control_context_destroy(ncc);
+        return (EXIT_FAILURE);
+    }
 
     printf("program initialized, now the game can start...\n");
 
-    the_game(ncc);
+    n = 1;
+    if (passes)
+    {
+        n = soak(ncc, bpf, passes);
+    }
+    else
+    {
+        the_game(ncc);
+    }
 
     stats(ncc, NFEX_STATS_CLOSEOUT);
     control_context_destroy(ncc);
     printf("program completed, normal exit\n");
 
-    return(EXIT_SUCCESS);
+    return(n == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
 void
@@ -131,15 +393,45 @@ usage(char *progname)
     printf("Usage: %s [options] [[-D <device>] || [-F <file>]] [expression]\n"
            "  -f <file>       specify an input capture file\n"
            "  -d <device>     to specify a network device\n"
-           "  -c <file>       specify configuration file\n"
+           "  -c <file>[,<DIRECTORY>]\n"
+           "                  specify configuration file or signature image,\n"
+           "                  repeat for more profiles, each with its own "
+           "output\n"
+           "  -H              follow HTTP/1.x framing to size extractions\n"
+           "  -m <MB>         hold flow state to this, dropping the least "
+           "recently seen\n"
 #if (HAVE_GEOIP)
            "  -G              specify path to MaxMind geoIP database\n"
            "  -g              toggle geoIP mode on\n"
 #endif /** HAVE_GEOIP */
-           "  -o <DIRECTORY>  dump files here instead of cwd\n"
+           "  -o <DIRECTORY>  dump files here instead of cwd, repeat to "
+           "spread them out\n"
            "  -V              display the version number\n"
            "  -v              toggle verbose mode on\n"
+           "  -x <N>          extract at most N files at once\n"
+           "  -X <N>          and at most N from any one flow\n"
            "  -h              this\n"
+           "  --compile-sigs <file>  write the -c config out as a signature "
+           "image\n"
+           "  --emit-c <file>        write the -c config out as C for a "
+           "generated scanner\n"
+           "  --scanner <file.so>    search with a generated scanner\n"
+           "  --bench                report the -c config's machine sizes "
+           "and speeds\n"
+           "  --soak <passes>        replay the -f file, checking nothing "
+           "leaks\n"
+           "  --layout <how>         flat, or subdirs by time, hash or "
+           "time,hash\n"
+           "  --spread <how>         across -o dirs: rr or space\n"
+           "  --dedup <how>          keep repeated files once: link or "
+           "ref\n"
+           "  --dedup-store <file>   and remember them across runs\n"
+           "  --hashes <which>       index each file's md5, sha1 and/or "
+           "sha256\n"
+           "  --archive <MB>         append files to segments this big, "
+           "see nfex_ar\n"
+           "  --compress <how>       compress finished segments: zstd or "
+           "lz4\n"
            "  expression is a bpf filter ala tcpdump / pcap\n", progname);
     exit(1);    
 }
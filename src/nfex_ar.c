@@ -0,0 +1,342 @@
+/*
+ * nfex_ar.c - read nfex archive segments
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+/*
+ * nfex --archive puts files in segments, NNN-SSSSSS.nfa, each with an index,
+ * NNN-SSSSSS.nfi (see archive.h), or NNN-SSSSSS.nfz once --compress has been
+ * at it.  this lists what's in a segment, pulls files out of it by id and
+ * checks them against their digests.  the ids in a segment only go up, so
+ * finding one is a binary search of the index and one read from the
+ * segment, decompressed on the way out if need be.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include "config.h"
+#include "archive.h"
+#include "compress.h"
+
+archive_record_t *ar_load(char *, uint32_t *, uint32_t *);
+int ar_find(const void *, const void *);
+int ar_copy(int, archive_record_t *, int);
+void ar_list(archive_record_t *);
+void usage(char *);
+
+int
+main(int argc, char *argv[])
+{
+    int c, n, sfd, ofd, check;
+    uint32_t i, nrecs, flags;
+    uint64_t id;
+    archive_record_t *recs, *rec, key;
+    char *wfname, *xdir;
+    char stem[4096], fname[4096];
+
+    check  = 0;
+    id     = 0;
+    wfname = NULL;
+    xdir   = NULL;
+    while ((c = getopt(argc, argv, "htvw:x:X:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                break;
+            case 't':
+                check = 1;
+                break;
+            case 'v':
+                printf("%s v%s\n", PACKAGE, VERSION);
+                return (EXIT_SUCCESS);
+            case 'w':
+                wfname = optarg;
+                break;
+            case 'x':
+                id = strtoull(optarg, NULL, 10);
+                if (id == 0)
+                {
+                    fprintf(stderr, "file ids start at 1\n");
+                    return (EXIT_FAILURE);
+                }
+                break;
+            case 'X':
+                xdir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                break;
+        }
+    }
+    if (optind != argc - 1 || (wfname && id == 0))
+    {
+        usage(argv[0]);
+    }
+
+    /** the segment or its index, or what they're both named from */
+    snprintf(stem, sizeof (stem), "%s", argv[optind]);
+    n = strlen(stem);
+    if (n > 4 && (strcmp(stem + n - 4, ARCHIVE_SEGMENT) == 0 ||
+        strcmp(stem + n - 4, ARCHIVE_PACKED) == 0 ||
+        strcmp(stem + n - 4, ARCHIVE_INDEX) == 0))
+    {
+        stem[n - 4] = '\0';
+    }
+
+    snprintf(fname, sizeof (fname), "%s%s", stem, ARCHIVE_INDEX);
+    recs = ar_load(fname, &nrecs, &flags);
+    if (recs == NULL)
+    {
+        return (EXIT_FAILURE);
+    }
+    snprintf(fname, sizeof (fname), "%s%s", stem, 
+        (flags & ARCHIVE_F_PACKED) ? ARCHIVE_PACKED : ARCHIVE_SEGMENT);
+    sfd = open(fname, O_RDONLY);
+    if (sfd == -1)
+    {
+        fprintf(stderr, "can't open segment %s: %s\n", fname,
+            strerror(errno));
+        free(recs);
+        return (EXIT_FAILURE);
+    }
+
+    /** one file, to stdout or -w */
+    if (id)
+    {
+        key.id = id;
+        rec = bsearch(&key, recs, nrecs, sizeof (*recs), ar_find);
+        if (rec == NULL)
+        {
+            fprintf(stderr, "no file %llu in %s\n", (unsigned long long)id,
+                fname);
+            return (EXIT_FAILURE);
+        }
+        ofd = STDOUT_FILENO;
+        if (wfname)
+        {
+            ofd = open(wfname, O_WRONLY|O_CREAT|O_TRUNC,
+                S_IRWXU|S_IRWXG|S_IRWXO);
+            if (ofd == -1)
+            {
+                fprintf(stderr, "can't open %s: %s\n", wfname,
+                    strerror(errno));
+                return (EXIT_FAILURE);
+            }
+        }
+        n = ar_copy(sfd, rec, ofd);
+        if (n == 0)
+        {
+            fprintf(stderr, "file %llu doesn't match its digests\n",
+                (unsigned long long)id);
+        }
+        free(recs);
+        close(sfd);
+        return (n == 1 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    /** everything, checked, listed or written out */
+    for (i = 0, c = 0; i < nrecs; i++)
+    {
+        rec = &(recs[i]);
+        if (xdir)
+        {
+            snprintf(fname, sizeof (fname), "%s/%llu.%s", xdir,
+                (unsigned long long)rec->id, rec->ext);
+            ofd = open(fname, O_WRONLY|O_CREAT|O_TRUNC,
+                S_IRWXU|S_IRWXG|S_IRWXO);
+            if (ofd == -1)
+            {
+                fprintf(stderr, "can't open %s: %s\n", fname,
+                    strerror(errno));
+                return (EXIT_FAILURE);
+            }
+            n = ar_copy(sfd, rec, ofd);
+            close(ofd);
+        }
+        else if (check)
+        {
+            n = ar_copy(sfd, rec, -1);
+        }
+        else
+        {
+            ar_list(rec);
+            continue;
+        }
+        if (n != 1)
+        {
+            fprintf(stderr, "file %llu %s\n", (unsigned long long)rec->id,
+                n == 0 ? "doesn't match its digests" : "couldn't be read");
+            c++;
+        }
+    }
+    if (check || xdir)
+    {
+        printf("%u files, %d bad\n", nrecs, c);
+    }
+    free(recs);
+    close(sfd);
+    return (c ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/** read in a segment's index, the records follow the header */
+archive_record_t *
+ar_load(char *fname, uint32_t *nrecs, uint32_t *flags)
+{
+    int fd;
+    struct stat st;
+    archive_header_t h;
+    archive_record_t *recs;
+
+    fd = open(fname, O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "can't open index %s: %s\n", fname, strerror(errno));
+        return (NULL);
+    }
+    if (read(fd, &h, sizeof (h)) != sizeof (h) || fstat(fd, &st) == -1 ||
+        memcmp(h.magic, ARCHIVE_MAGIC, sizeof (h.magic)) ||
+        h.version != ARCHIVE_VERSION || h.record != sizeof (*recs))
+    {
+        fprintf(stderr, "%s isn't an nfex archive index this knows\n",
+            fname);
+        close(fd);
+        return (NULL);
+    }
+
+    /** a record cut short by a crash is left off */
+    *flags = h.flags;
+    *nrecs = (st.st_size - sizeof (h)) / sizeof (*recs);
+    recs   = malloc(*nrecs * sizeof (*recs) + 1);
+    if (recs == NULL)
+    {
+        fprintf(stderr, "malloc(): %s\n", strerror(errno));
+        close(fd);
+        return (NULL);
+    }
+    if (read(fd, recs, *nrecs * sizeof (*recs)) !=
+        (ssize_t)(*nrecs * sizeof (*recs)))
+    {
+        fprintf(stderr, "can't read index %s: %s\n", fname, strerror(errno));
+        free(recs);
+        close(fd);
+        return (NULL);
+    }
+    close(fd);
+    return (recs);
+}
+
+int
+ar_find(const void *a, const void *b)
+{
+    const archive_record_t *x = a, *y = b;
+
+    return (x->id < y->id ? -1 : x->id > y->id);
+}
+
+/*
+ * copy a file out of the segment to ofd, or nowhere if it's -1, checking
+ * it against whatever digests it has on the way.  returns 1 if it's good,
+ * 0 if it doesn't match, -1 if it couldn't be read or written.
+ */
+int
+ar_copy(int sfd, archive_record_t *rec, int ofd)
+{
+    digest_t d;
+    digest_sum_t sum;
+    char hex[DIGEST_HEX_MAX];
+
+    digest_init(&d, rec->digests);
+    if (decompress_object(sfd, rec, ofd, &d) == -1)
+    {
+        return (-1);
+    }
+    digest_final(&d, &sum, hex);
+    if (((rec->digests & DIGEST_MD5) &&
+        memcmp(sum.md5, rec->md5, MD5_LEN)) ||
+        ((rec->digests & DIGEST_SHA1) &&
+        memcmp(sum.sha1, rec->sha1, SHA1_LEN)) ||
+        ((rec->digests & DIGEST_SHA256) &&
+        memcmp(sum.sha256, rec->sha256, SHA256_LEN)))
+    {
+        return (0);
+    }
+    return (1);
+}
+
+/** a line per file, laid out like nfex's own index */
+void
+ar_list(archive_record_t *rec)
+{
+    int i;
+    time_t t;
+    uint8_t s[4], d[4];
+    char timestamp[50];
+    char hex[SHA256_LEN * 2 + 1];
+    static char *codecs[] = {"raw", "zstd", "lz4"};
+
+    memcpy(s, &rec->ip_src, 4);
+    memcpy(d, &rec->ip_dst, 4);
+    t = rec->ts_sec;
+    strftime(timestamp, sizeof (timestamp), "%Y-%m-%dT%H:%M:%S", gmtime(&t));
+
+    printf("%llu, %s.%ldZ, %d.%d.%d.%d.%d, %d.%d.%d.%d.%d, %s, %llu, %llu, "
+        "%llu, %s", (unsigned long long)rec->id, timestamp, 
+        (long)rec->ts_usec, s[0], s[1], s[2], s[3], ntohs(rec->port_src),
+        d[0], d[1], d[2], d[3], ntohs(rec->port_dst), rec->ext,
+        (unsigned long long)rec->offset, (unsigned long long)rec->length,
+        (unsigned long long)rec->stored, 
+        rec->codec <= ARCHIVE_LZ4 ? codecs[rec->codec] : "?");
+    for (i = 0; i < 3; i++)
+    {
+        if (i == 0 && (rec->digests & DIGEST_MD5))
+        {
+            digest_hex(rec->md5, MD5_LEN, hex);
+        }
+        else if (i == 1 && (rec->digests & DIGEST_SHA1))
+        {
+            digest_hex(rec->sha1, SHA1_LEN, hex);
+        }
+        else if (i == 2 && (rec->digests & DIGEST_SHA256))
+        {
+            digest_hex(rec->sha256, SHA256_LEN, hex);
+        }
+        else
+        {
+            continue;
+        }
+        printf(", %s", hex);
+    }
+    printf("\n");
+}
+
+void
+usage(char *progname)
+{
+    printf("Usage: %s [-htv] [-x id [-w file]] [-X dir] segment\n"
+           "  (none)     list the files in the segment\n"
+           "  -t         check every file against its digests\n"
+           "  -x id      write file id to stdout\n"
+           "  -w file    or to file\n"
+           "  -X dir     write every file to dir as id.ext\n"
+           "  segment    its .nfa, .nfz or .nfi, or the name they share\n",
+           progname);
+    exit(1);
+}
+
+/** EOF */
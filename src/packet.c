@@ -10,24 +10,86 @@
 
 #include "nfex.h"
 #include "config.h"
+#include "util.h"
 #include <libnet.h>
 
+/*
+ * the pcap callback.  the packet is copied into the batch, which gets
+ * worked through once pcap_dispatch() is done (or it's full) so its
+ * payloads can be searched together
+ */
 void
 process_packet(u_char *user, const struct pcap_pkthdr *header, 
 const u_char *packet)
 {
     ncc_t *ncc;
-    uint8_t *payload;
-    four_tuple_t ft;
-    int32_t payload_size;
-    srch_results_t *results;
+    nfex_packet_t *pkt;
+
+    ncc = (ncc_t *)user;
+    pkt = &(ncc->batch[ncc->nbatch++]);
+    if (pkt->size < header->caplen)
+    {
+        pkt->data = erealloc(pkt->data, header->caplen);
+        ncc->mem[NFEX_MEM_PACKETS] += header->caplen - pkt->size;
+        pkt->size = header->caplen;
+    }
+    memcpy(pkt->data, packet, header->caplen);
+    memcpy(&(pkt->header), header, sizeof (struct pcap_pkthdr));
+
+    if (ncc->nbatch == NFEX_BATCH)
+    {
+        packet_flush(ncc);
+    }
+}
+
+/*
+ * process everything in the batch, in the order it came in.  the whole
+ * batch is parsed and its session table lookups started first, so by the
+ * time a packet's turn comes its session is in cache rather than each
+ * packet waiting on its own misses.  once it's done the flows are held to
+ * the memory budget, nothing in the batch points at a session by then.
+ */
+void
+packet_flush(ncc_t *ncc)
+{
+    int i;
+    nfex_packet_t *pkt;
+
+    for (i = 0; i < ncc->nbatch; i++)
+    {
+        packet_parse(ncc, &(ncc->batch[i]));
+    }
+    packet_warm(ncc);
+    packet_prescan(ncc);
+    for (i = 0; i < ncc->nbatch; i++)
+    {
+        pkt = &(ncc->batch[i]);
+        if (pkt->payload || pkt->syn || pkt->fin)
+        {
+            packet_process(ncc, pkt);
+        }
+        free_results_list(&(pkt->lane.results));
+    }
+    ncc->nbatch = 0;
+    ht_govern(ncc);
+}
+
+/** find the flow and payload, a packet with neither is done with here */
+static void
+packet_parse(ncc_t *ncc, nfex_packet_t *pkt)
+{
     struct libnet_ipv4_hdr *ip;
     struct libnet_tcp_hdr  *tcp;
     uint16_t ip_hl, tcp_hl, header_cruft;
 
-    ncc = (ncc_t *)user;
+    pkt->payload      = NULL;
+    pkt->payload_size = 0;
+    pkt->syn          = 0;
+    pkt->fin          = 0;
+    pkt->scanned      = 0;
+    pkt->lane.results = NULL;
 
-    ip     = (struct libnet_ipv4_hdr *)(packet + LIBNET_ETH_H);
+    ip     = (struct libnet_ipv4_hdr *)(pkt->data + LIBNET_ETH_H);
     ip_hl  = ip->ip_hl << 2;
 
     /** this is a trival fix to handle IP options */
@@ -40,7 +102,8 @@ const u_char *packet)
     switch (ip->ip_p)
     {
         case IPPROTO_TCP:
-            tcp    = (struct libnet_tcp_hdr *)(packet + LIBNET_ETH_H + ip_hl);
+            tcp    = (struct libnet_tcp_hdr *)(pkt->data + LIBNET_ETH_H + 
+                ip_hl);
             tcp_hl = tcp->th_off << 2;
             header_cruft = LIBNET_ETH_H + ip_hl + tcp_hl;
             break;
@@ -49,38 +112,486 @@ const u_char *packet)
     }
 
     ncc->stats.total_packets++;
-    ncc->stats.total_bytes += (header->len + sizeof (struct pcap_pkthdr));
+    ncc->stats.total_bytes += (pkt->header.len + sizeof (struct pcap_pkthdr));
+
+    /** four tuple information aka "a session" */
+    pkt->ft.ip_src   = ip->ip_src.s_addr;
+    pkt->ft.ip_dst   = ip->ip_dst.s_addr;
+    pkt->ft.port_src = tcp->th_sport;
+    pkt->ft.port_dst = tcp->th_dport;
+    pkt->seq         = ntohl(tcp->th_seq);
+    pkt->syn         = (tcp->th_flags & TH_SYN) != 0;
+    pkt->fin         = (tcp->th_flags & (TH_FIN|TH_RST)) != 0;
+
+    /** the bucket now, the session in it once everyone's been parsed */
+    pkt->hash        = ht_hash(&(pkt->ft), ncc);
+    NFEX_PREFETCH(&(ncc->ht[pkt->hash]));
+    if (ncc->set->anch_depth)
+    {
+        NFEX_PREFETCH(&(ncc->syn_cache[pkt->hash % NFEX_SYN_CACHE]));
+    }
 
-    payload_size = header->len - header_cruft;
-    if (payload_size <= 0)
+    /** only what we copied, a short capture doesn't get read past */
+    pkt->payload_size = MIN(pkt->header.len, pkt->header.caplen) - 
+        header_cruft;
+    if (pkt->payload_size <= 0)
     {
         /** not an error per se, just no payload */
+        pkt->payload_size = 0;
+        return;
+    }
+    pkt->payload = pkt->data + header_cruft;
+}
+
+/** the buckets should be in by now, start on the sessions in them */
+static void
+packet_warm(ncc_t *ncc)
+{
+    int i;
+    ht_node_t *p;
+    nfex_packet_t *pkt;
+
+    for (i = 0; i < ncc->nbatch; i++)
+    {
+        pkt = &(ncc->batch[i]);
+        if (pkt->payload == NULL)
+        {
+            continue;
+        }
+        p = ncc->ht[pkt->hash];
+        if (p)
+        {
+            NFEX_PREFETCH(p);
+            NFEX_PREFETCH((uint8_t *)p + sizeof (ht_node_t) - 1);
+        }
+    }
+}
+
+/*
+ * run the batch's HEADER searches ahead of time, a lane per packet so 
+ * different flows' payloads are walked together.  each search starts
+ * where its flow's will when the packet's turn comes, if nothing changes
+ * the flow in between: from the last packet of the flow in the batch, 
+ * the session's state or the start.  packet_search() checks, and if the
+ * guess was wrong that packet is searched again.
+ */
+static void
+packet_prescan(ncc_t *ncc)
+{
+    int i, j, n, more;
+    ht_node_t *session;
+    srch_set_t *set;
+    nfex_packet_t *pkt, *prev;
+    srch_lane_t *lanes[NFEX_BATCH];
+
+    /** the first packet of each flow goes in round 0, the next in 1... */
+    for (i = 0, more = 0; i < ncc->nbatch; i++)
+    {
+        pkt = &(ncc->batch[i]);
+        pkt->round = -1;
+        if (pkt->payload == NULL)
+        {
+            continue;
+        }
+        for (j = i - 1; j >= 0; j--)
+        {
+            prev = &(ncc->batch[j]);
+            if (prev->payload && memcmp(&(prev->ft), &(pkt->ft), 
+                sizeof (four_tuple_t)) == 0)
+            {
+                break;
+            }
+        }
+        if (j >= 0)
+        {
+            /** only if the flow's last one was scanned too */
+            if (prev->round >= 0)
+            {
+                pkt->round = prev->round + 1;
+                pkt->prev  = j;
+                more       = MAX(more, pkt->round);
+            }
+            continue;
+        }
+
+        session = ht_lookup(&(pkt->ft), pkt->hash, ncc);
+        set     = session ? session->set : ncc->set;
+        if (session && session->extract_list)
+        {
+            /** whatever it's extracting is next to be needed */
+            NFEX_PREFETCH(session->extract_list);
+        }
+        if (set->srch_machine == NULL || ((ncc->flags & NFEX_HTTP) && 
+            ((session && session->http) || 
+            (session == NULL && http_sniff(pkt->payload, pkt->payload_size)))))
+        {
+            /** HTTP flows go message by message, not through here */
+            continue;
+        }
+        pkt->round        = 0;
+        pkt->prev         = -1;
+        pkt->lane.machine = set->srch_machine;
+        pkt->lane.state   = session ? session->srch_state : SRCH_START;
+    }
+
+    for (j = 0; j <= more; j++)
+    {
+        for (i = 0, n = 0; i < ncc->nbatch; i++)
+        {
+            pkt = &(ncc->batch[i]);
+            if (pkt->round != j)
+            {
+                continue;
+            }
+            if (pkt->prev >= 0)
+            {
+                /** carries on from the flow's last packet */
+                prev = &(ncc->batch[pkt->prev]);
+                pkt->lane.machine = prev->lane.machine;
+                pkt->lane.state   = prev->lane.state;
+            }
+            pkt->lane.buf = pkt->payload;
+            pkt->lane.len = pkt->payload_size;
+            pkt->state0   = pkt->lane.state;
+            pkt->scanned  = 1;
+            lanes[n++]    = &(pkt->lane);
+        }
+        search_batch(lanes, n);
+    }
+}
+
+/** the HEADER search for a packet, from the prescan if it guessed right */
+static srch_results_t *
+packet_search(ncc_t *ncc, nfex_packet_t *pkt, srch_machine_t *m, 
+uint32_t *state)
+{
+    srch_results_t *results;
+
+    if (pkt->scanned && pkt->lane.machine == m && pkt->state0 == *state)
+    {
+        results = pkt->lane.results;
+        pkt->lane.results = NULL;
+        *state = pkt->lane.state;
+        return (results);
+    }
+    if (pkt->scanned)
+    {
+        ncc->stats.rescans++;
+    }
+    return (search(m, state, pkt->payload, pkt->payload_size, 
+        SRCH_MASK_ALL));
+}
+
+/*
+ * a HEADER the search is partway through when a packet ends finishes in 
+ * a later one, and its first bytes are gone by then.  the session keeps
+ * the last few bytes it saw, as many as a HEADER can have before its 
+ * last, so an extraction can start from them.
+ */
+static void
+packet_carry(ht_node_t *session, const uint8_t *payload, size_t size, 
+ncc_t *ncc)
+{
+    uint32_t room, keep;
+
+    room = session->set->srch_machine ? 
+        session->set->srch_machine->maxlen : 0;
+    room = room ? room - 1 : 0;
+    if (session->srch_state == SRCH_START || room == 0)
+    {
+        if (session->carry)
+        {
+            free(session->carry);
+            session->carry  = NULL;
+            session->ncarry = 0;
+            ncc->mem[NFEX_MEM_SEARCH] -= session->carrysz;
+        }
         return;
     }
+    if (session->carry == NULL)
+    {
+        session->carry = malloc(room);
+        if (session->carry == NULL)
+        {
+            return;
+        }
+        session->ncarry  = 0;
+        session->carrysz = room;
+        ncc->mem[NFEX_MEM_SEARCH] += room;
+    }
+    if (size >= room)
+    {
+        memcpy(session->carry, payload + size - room, room);
+        session->ncarry = room;
+        return;
+    }
+    /** a short packet, what's kept from before moves up to make room */
+    keep = MIN(session->ncarry, room - size);
+    memmove(session->carry, session->carry + session->ncarry - keep, keep);
+    memcpy(session->carry + keep, payload, size);
+    session->ncarry = keep + size;
+}
+
+/** one packet's worth of session tracking, searching and extracting */
+static void
+packet_process(ncc_t *ncc, nfex_packet_t *pkt)
+{
+    srch_set_t *set;
+    uint8_t *payload;
+    four_tuple_t ft;
+    int32_t payload_size;
+    srch_results_t *results, *footers, *r;
+    srch_anchor_t scratch, *anchor;
+    extract_list_t *e;
+    fileid_t *fileid;
+    int64_t offset;
+    uint32_t seq, mask, state;
+    size_t used;
 
-    payload = (uint8_t *)(packet + header_cruft);
+    ft           = pkt->ft;
+    seq          = pkt->seq;
+    payload      = pkt->payload;
+    payload_size = pkt->payload_size;
+
+    if (pkt->syn && ncc->set->anch_depth)
+    {
+        /** remember where the stream starts for anchored signatures */
+        ht_syn_add(&ft, seq + 1, ncc);
+    }
+    if (payload == NULL)
+    {
+        if (pkt->fin && (ncc->session = ht_lookup(&ft, pkt->hash, ncc)))
+        {
+            /** the stream's over, and so is anything we were doing with it */
+            http_fin(ncc->session, ncc);
+            ht_remove(ncc->session, ncc);
+        }
+        return;
+    }
 
     /** copy over timestamp */
-    ncc->stats.ts_last.tv_sec  = header->ts.tv_sec;
-    ncc->stats.ts_last.tv_usec = header->ts.tv_usec;
+    ncc->stats.ts_last.tv_sec  = pkt->header.ts.tv_sec;
+    ncc->stats.ts_last.tv_usec = pkt->header.ts.tv_usec;
 
-    /** four tuple information aka "a session" */
-    ft.ip_src   = ip->ip_src.s_addr;
-    ft.ip_dst   = ip->ip_dst.s_addr;
-    ft.port_src = tcp->th_sport;
-    ft.port_dst = tcp->th_dport;
+    /*
+     * stateless fast path: if we aren't already tracking this flow, scan
+     * the payload from the root of the search machine first and only
+     * materialize a session if the scan left us mid-pattern or turned up
+     * something to extract
+     */
+    ncc->session = ht_lookup(&ft, pkt->hash, ncc);
 
-    /** attempt to add this session to the session table */
-    ncc->session = ht_insert(&ft, ncc);
+    /** a flow sticks with the signatures it started with */
+    set = ncc->session ? ncc->session->set : ncc->set;
 
-    /** pass payload to search interface to sift for our yumyums */
-    results = search(ncc->srch_machine, &(ncc->session->srchptr_list), payload, 
-        payload_size);
+    /*
+     * HTTP flows are followed message by message instead, bodies are only
+     * checked at their first byte and everything else is skipped
+     */
+    if ((ncc->flags & NFEX_HTTP) && 
+        ((ncc->session && ncc->session->http) || 
+        (ncc->session == NULL && http_sniff(payload, payload_size))))
+    {
+        if (ncc->session == NULL)
+        {
+            ncc->session = ht_insert(&ft, ncc);
+            if (ncc->session == NULL)
+            {
+                ncc->stats.packet_errors++;
+                return;
+            }
+        }
+        if (ncc->session->http == NULL)
+        {
+            /** framing takes over, nothing's fed from the scan after this */
+            while (ncc->session->extract_list)
+            {
+                ncc->session->extract_list->cut = 1;
+                extract_close(&(ncc->session->extract_list), 
+                    ncc->session->extract_list, ncc);
+            }
+            ncc->session->http = http_new(ncc);
+        }
+        if (ncc->session->http && 
+            http_process(ncc->session, payload, payload_size, ncc) == 1)
+        {
+            goto done;
+        }
+        /** doesn't frame like HTTP after all, go back to scanning */
+        http_free(ncc->session, ncc);
+    }
+
+    /** where this packet sits in its stream, if anything cares */
+    offset = -1;
+    if (set->anch_depth)
+    {
+        offset = ht_stream_offset(ncc->session, &ft, seq, ncc);
+    }
+
+    /*
+     * stream anchored HEADERs only get a look at the first few bytes of a
+     * stream, either fresh at offset 0 or picking up a walk that ran off
+     * the end of the last packet
+     */
+    anchor = NULL;
+    fileid = NULL;
+    used   = 0;
+    if (set->strm_machine && offset >= 0)
+    {
+        if (ncc->session && ncc->session->anchor && 
+            offset > ncc->session->anchor->len)
+        {
+            /** missed part of the stream, this walk is going nowhere */
+            free(ncc->session->anchor);
+            ncc->session->anchor = NULL;
+            ncc->mem[NFEX_MEM_SEARCH] -= sizeof (srch_anchor_t);
+        }
+        if (ncc->session && ncc->session->anchor && 
+            offset == ncc->session->anchor->len)
+        {
+            anchor = ncc->session->anchor;
+        }
+        else if (offset == 0 && ncc->session && ncc->session->anchor)
+        {
+            /** the start again, retransmitted or overlapping, walk it over */
+            anchor          = ncc->session->anchor;
+            anchor->machine = set->strm_machine;
+            anchor->state   = SRCH_START;
+            anchor->len     = 0;
+        }
+        else if (offset == 0)
+        {
+            scratch.machine = set->strm_machine;
+            scratch.state   = SRCH_START;
+            scratch.len     = 0;
+            anchor          = &scratch;
+        }
+        if (anchor)
+        {
+            fileid = search_anchor(anchor, payload, payload_size, &used);
+        }
+    }
+
+    if (ncc->session == NULL)
+    {
+        state   = SRCH_START;
+        results = packet_search(ncc, pkt, set->srch_machine, &state);
+        search_window(&results, offset);
+        if (results == NULL && state == SRCH_START && fileid == NULL &&
+            (anchor == NULL || anchor->machine == NULL))
+        {
+            /** nothing interesting, don't bother keeping state */
+            ncc->stats.ht_stateless++;
+            return;
+        }
+
+        /** attempt to add this session to the session table */
+        ncc->session = ht_insert(&ft, ncc);
+        if (ncc->session == NULL)
+        {
+            free_results_list(&results);
+            ncc->stats.packet_errors++;
+            return;
+        }
+        ncc->session->srch_state = state;
+        if (offset >= 0 && ncc->session->has_seq0 == 0)
+        {
+            ncc->session->has_seq0 = 1;
+            ncc->session->seq0     = seq - offset;
+        }
+    }
+    else
+    {
+        /** pass payload to search interface to sift for our yumyums */
+        results = packet_search(ncc, pkt, set->srch_machine, 
+            &(ncc->session->srch_state));
+        search_window(&results, offset);
+    }
+
+    if (anchor)
+    {
+        if (fileid)
+        {
+            e = extract_open(&(ncc->session->extract_list), fileid, 
+                ncc->session, ncc);
+            if (e && anchor->len > used)
+            {
+                /** the part of the HEADER that came in earlier packets */
+                extract_write(e, anchor->prefix, anchor->len - used, ncc);
+            }
+        }
+        if (anchor->machine && anchor == &scratch)
+        {
+            /** ran off the end of the packet mid HEADER, hold onto it */
+            ncc->session->anchor = malloc(sizeof (srch_anchor_t));
+            if (ncc->session->anchor)
+            {
+                memcpy(ncc->session->anchor, &scratch, sizeof (scratch));
+                ncc->mem[NFEX_MEM_SEARCH] += sizeof (srch_anchor_t);
+            }
+        }
+        else if (anchor->machine == NULL && anchor == ncc->session->anchor)
+        {
+            free(ncc->session->anchor);
+            ncc->session->anchor = NULL;
+            ncc->mem[NFEX_MEM_SEARCH] -= sizeof (srch_anchor_t);
+        }
+    }
+
+    /*
+     * FOOTERs are only looked for on behalf of extractions that are open
+     * (or about to be), a flow with nothing going on doesn't need them
+     */
+    mask = extract_mask(ncc->session->extract_list, results);
+    if (mask)
+    {
+        footers = search(set->foot_machine, &(ncc->session->foot_state), 
+            payload, payload_size, mask);
+        if (results)
+        {
+            for (r = results; r->next; r = r->next);
+            r->next = footers;
+            if (footers)
+            {
+                footers->prev = r;
+            }
+        }
+        else
+        {
+            results = footers;
+        }
+    }
+    else
+    {
+        ncc->session->foot_state = SRCH_START;
+    }
 
     extract(&(ncc->session->extract_list), results, ncc->session, payload, 
         payload_size, ncc);
+    if (ncc->session->extract_list == NULL)
+    {
+        /** nothing left for a FOOTER to close */
+        ncc->session->foot_state = SRCH_START;
+    }
+    packet_carry(ncc->session, payload, payload_size, ncc);
 
     free_results_list(&results);
+
+done:
+    /** the end of the stream, or no partial matches and nothing extracting */
+    if (pkt->fin)
+    {
+        http_fin(ncc->session, ncc);
+        ht_remove(ncc->session, ncc);
+    }
+    else if (ncc->session->srch_state == SRCH_START && 
+        ncc->session->foot_state == SRCH_START &&
+        ncc->session->extract_list == NULL &&
+        ncc->session->anchor == NULL &&
+        (ncc->session->http == NULL || http_idle(ncc->session->http)))
+    {
+        ht_remove(ncc->session, ncc);
+    }
 }
 
 /** EOF */
@@ -0,0 +1,187 @@
+/*
+ * reload.c - signature reloads
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include <sys/wait.h>
+#include "nfex.h"
+
+/*
+ * on SIGHUP (or 'R') the config file is parsed and built in a child
+ * process, which writes it out as a signature image and exits.  the child
+ * can take as long as it likes and die on a bad config without bothering
+ * us; once it's done we map its image and make it the current set.
+ * sessions that are in the middle of something keep the set they started
+ * with, it goes away when the last of them does.
+ */
+static volatile sig_atomic_t reload_pending;
+
+void
+reload_init(ncc_t *ncc)
+{
+    ncc->reload_pid = 0;
+    ncc->reload_fd  = -1;
+    snprintf(ncc->reload_image, sizeof (ncc->reload_image),
+        "%s.nfex-reload-%d.sigs", ncc->output.dir[0], getpid());
+    signal(SIGHUP, reload_signal);
+}
+
+void
+reload_signal(int sig)
+{
+    reload_pending = 1;
+}
+
+/** kick off a rebuild of the config file */
+void
+reload_start(ncc_t *ncc)
+{
+    int fds[2];
+    pid_t pid;
+
+    if (ncc->reload_pid)
+    {
+        printf("signature reload already in progress\n");
+        return;
+    }
+    if (pipe(fds) == -1)
+    {
+        fprintf(stderr, "can't reload signatures: pipe(): %s\n",
+            strerror(errno));
+        return;
+    }
+    printf("reloading signatures from %s%s...\n", ncc->conf.fname[0],
+        ncc->conf.n > 1 ? " and the other profiles" : "");
+
+    /** don't let the child write out our buffered output again */
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    switch (pid)
+    {
+        case -1:
+            fprintf(stderr, "can't reload signatures: fork(): %s\n",
+                strerror(errno));
+            close(fds[0]);
+            close(fds[1]);
+            return;
+        case 0:
+            /** the write end closes when we exit, that's the signal */
+            close(fds[0]);
+            signal(SIGHUP, SIG_IGN);
+            pid = sigs_compile(&(ncc->conf), ncc->reload_image) == -1;
+            fflush(stdout);
+            _exit(pid ? EXIT_FAILURE : EXIT_SUCCESS);
+        default:
+            close(fds[1]);
+            ncc->reload_pid = pid;
+            ncc->reload_fd  = fds[0];
+            break;
+    }
+}
+
+/*
+ * called from the main loop between batches of packets.  starts a reload
+ * if one was asked for and swaps in the result of one that's finished,
+ * block waits for the rebuild to exit (its fd is readable so it already
+ * has).  returns 1 if the signatures changed.
+ */
+int
+reload_poll(ncc_t *ncc, int block)
+{
+    int status;
+    uint32_t i;
+    pid_t pid;
+    srch_set_t *set;
+
+    if (reload_pending)
+    {
+        reload_pending = 0;
+        reload_start(ncc);
+    }
+    if (ncc->reload_pid == 0)
+    {
+        return (0);
+    }
+    pid = waitpid(ncc->reload_pid, &status, block ? 0 : WNOHANG);
+    if (pid == 0)
+    {
+        /** still building */
+        return (0);
+    }
+    close(ncc->reload_fd);
+    ncc->reload_fd  = -1;
+    ncc->reload_pid = 0;
+    if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+    {
+        fprintf(stderr, "signature reload failed, keeping the current "
+            "signatures\n");
+        unlink(ncc->reload_image);
+        return (0);
+    }
+
+    set = sigs_new();
+    if (sigs_load(set, ncc->reload_image) != 1)
+    {
+        fprintf(stderr, "signature reload failed, keeping the current "
+            "signatures\n");
+        sigs_release(set);
+        unlink(ncc->reload_image);
+        return (0);
+    }
+    /** the mapping outlives the name */
+    unlink(ncc->reload_image);
+    for (i = 0; i < set->nprofiles && i < ncc->nprofiles; i++)
+    {
+        if (strcmp(set->profile[i], ncc->set->profile[i]))
+        {
+            break;
+        }
+    }
+    if (i != ncc->nprofiles || i != set->nprofiles)
+    {
+        /** outputs are set up once, at startup */
+        fprintf(stderr, "signature reload changes the profiles, restart "
+            "nfex to pick them up, keeping the current signatures\n");
+        sigs_release(set);
+        return (0);
+    }
+    if (ncc->scanfname[0] && gen_load(set, ncc->scanfname) == -1)
+    {
+        fprintf(stderr, "reloaded signatures will run without the "
+            "generated scanner\n");
+    }
+
+    /** the types it keeps go on counting where they were */
+    extract_tally(set, ncc);
+
+    /** new flows get the new set, the old one goes with its last flow */
+    sigs_release(ncc->set);
+    ncc->set = set;
+    ncc->stats.reloads++;
+    printf("signatures reloaded, %d file types\n", set->nfileids);
+
+    return (1);
+}
+
+/** shutting down, don't leave a rebuild running */
+void
+reload_stop(ncc_t *ncc)
+{
+    if (ncc->reload_pid == 0)
+    {
+        return;
+    }
+    kill(ncc->reload_pid, SIGTERM);
+    waitpid(ncc->reload_pid, NULL, 0);
+    close(ncc->reload_fd);
+    unlink(ncc->reload_image);
+    ncc->reload_pid = 0;
+    ncc->reload_fd  = -1;
+}
+
+/** EOF */
@@ -0,0 +1,464 @@
+/*
+ * resolve.c - file length resolution
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include "nfex.h"
+#include "resolve.h"
+
+/*
+ * without a FOOTER an extraction runs all the way out to maxlen.  most
+ * formats say how long they are somewhere in their structure, so these
+ * follow that structure as the bytes go by and come up with the real
+ * length.  a resolver asks for a field (so many bytes at such and such an
+ * offset into the file) and gets called back once it's been read, from
+ * there it either asks for the next field or comes up with an answer.
+ */
+
+#define LE16(p) ((uint16_t)((p)[0] | (p)[1] << 8))
+#define LE32(p) ((uint32_t)((p)[0] | (p)[1] << 8 | (p)[2] << 16 |           \
+                 (uint32_t)(p)[3] << 24))
+#define LE64(p) ((uint64_t)LE32(p) | (uint64_t)LE32((p) + 4) << 32)
+#define BE32(p) ((uint32_t)((uint32_t)(p)[0] << 24 | (p)[1] << 16 |         \
+                 (p)[2] << 8 | (p)[3]))
+
+static resolver_t resolvers[] =
+{
+    {"exe",  resolve_pe_start},
+    {"dll",  resolve_pe_start},
+    {"png",  resolve_png_start},
+    {"zip",  resolve_zip_start},
+    {"avi",  resolve_riff_start},
+    {"wav",  resolve_riff_start},
+    {"webp", resolve_riff_start},
+    {"pdf",  resolve_pdf_start},
+    {NULL,   NULL}
+};
+
+/** find the resolver for a file extension, NULL if there isn't one */
+resolve_start_t
+resolve_lookup(char *ext)
+{
+    int i;
+
+    for (i = 0; resolvers[i].ext; i++)
+    {
+        if (strcasecmp(resolvers[i].ext, ext) == 0)
+        {
+            return (resolvers[i].start);
+        }
+    }
+    return (NULL);
+}
+
+/*
+ * hand a resolver the next run of bytes of its file, off is where they
+ * sit in the file.  runs have to come in order and without gaps.
+ */
+void
+resolve_feed(resolve_t *r, const uint8_t *data, size_t len, off_t off)
+{
+    size_t i, n;
+
+    if (r->scan)
+    {
+        r->scan(r, data, len, off);
+        return;
+    }
+    while (r->length == 0)
+    {
+        if (r->want + (off_t)r->have < off)
+        {
+            /** asked for something we've already gone by */
+            r->length = RESOLVE_FAIL;
+            break;
+        }
+        i = r->want + r->have - off;
+        if (i >= len)
+        {
+            break;
+        }
+        n = r->wantlen - r->have;
+        if (n > len - i)
+        {
+            n = len - i;
+        }
+        memcpy(r->field + r->have, data + i, n);
+        r->have += n;
+        if (r->have < r->wantlen)
+        {
+            break;
+        }
+        r->have = 0;
+        r->step(r);
+    }
+}
+
+/** ask for the next field */
+static void
+resolve_want(resolve_t *r, off_t off, size_t len)
+{
+    r->want    = off;
+    r->wantlen = len;
+    r->have    = 0;
+}
+
+/*
+ * step a pattern match along by one byte, m is how much of the pattern
+ * has matched so far.  returns 1 when the whole thing has matched.
+ */
+static int
+resolve_match(const char *pat, uint8_t *m, uint8_t c)
+{
+    int k, len;
+
+    len = strlen(pat);
+    if (pat[*m] == c)
+    {
+        if (++(*m) == len)
+        {
+            *m = 0;
+            return (1);
+        }
+        return (0);
+    }
+    /** fall back to the longest bit of what we've seen that still fits */
+    for (k = *m; k > 0; k--)
+    {
+        if (pat[k - 1] == c && memcmp(pat, pat + *m - k + 1, k - 1) == 0)
+        {
+            break;
+        }
+    }
+    *m = k;
+    return (0);
+}
+
+/*
+ * PE: the end of the last section's raw data or the end of the
+ * certificate table (which lives in the overlay past the sections),
+ * whichever is further out
+ */
+enum
+{
+    PE_LFANEW,
+    PE_HEADER,
+    PE_MAGIC,
+    PE_DIRS,
+    PE_SECTION
+};
+
+static void
+resolve_pe_start(resolve_t *r)
+{
+    r->step  = resolve_pe;
+    r->state = PE_LFANEW;
+    resolve_want(r, 0x3c, 4);
+}
+
+static void
+resolve_pe(resolve_t *r)
+{
+    uint32_t off, size;
+
+    switch (r->state)
+    {
+        case PE_LFANEW:
+            off = LE32(r->field);
+            if (off < 0x40 || off > 0x10000)
+            {
+                r->length = RESOLVE_FAIL;
+                return;
+            }
+            r->state = PE_HEADER;
+            resolve_want(r, off, 24);
+            break;
+        case PE_HEADER:
+            if (memcmp(r->field, "PE\0\0", 4))
+            {
+                r->length = RESOLVE_FAIL;
+                return;
+            }
+            /** number of sections, optional header and its size */
+            r->count = LE16(r->field + 6);
+            r->base  = r->want + 24;
+            r->pos   = r->base + LE16(r->field + 20);
+            r->end   = r->pos + 40 * r->count;
+            if (r->count == 0 || r->count > 96)
+            {
+                r->length = RESOLVE_FAIL;
+                return;
+            }
+            r->state = PE_MAGIC;
+            resolve_want(r, r->base, 2);
+            break;
+        case PE_MAGIC:
+            /** where the data directories are depends on PE32 or PE32+ */
+            switch (LE16(r->field))
+            {
+                case 0x10b:
+                    off = 92;
+                    break;
+                case 0x20b:
+                    off = 108;
+                    break;
+                default:
+                    r->length = RESOLVE_FAIL;
+                    return;
+            }
+            r->n = 0;
+            if (r->base + off + 44 <= r->pos)
+            {
+                /** NumberOfRvaAndSizes and the first five directories */
+                r->state = PE_DIRS;
+                resolve_want(r, r->base + off, 44);
+            }
+            else
+            {
+                r->state = PE_SECTION;
+                resolve_want(r, r->pos, 40);
+            }
+            break;
+        case PE_DIRS:
+            if (LE32(r->field) > 4)
+            {
+                /** the security directory holds a file offset, not an RVA */
+                off  = LE32(r->field + 4 + 4 * 8);
+                size = LE32(r->field + 4 + 4 * 8 + 4);
+                if (off && size && (off_t)off + size > r->end)
+                {
+                    r->end = (off_t)off + size;
+                }
+            }
+            r->state = PE_SECTION;
+            resolve_want(r, r->pos, 40);
+            break;
+        case PE_SECTION:
+            size = LE32(r->field + 16);
+            off  = LE32(r->field + 20);
+            if (size && (off_t)off + size > r->end)
+            {
+                r->end = (off_t)off + size;
+            }
+            if (++r->n == r->count)
+            {
+                r->length = r->end;
+                return;
+            }
+            resolve_want(r, r->pos + 40 * r->n, 40);
+            break;
+    }
+}
+
+/** PNG: walk the chunks out to IEND */
+static void
+resolve_png_start(resolve_t *r)
+{
+    r->step  = resolve_png;
+    r->state = 0;
+    resolve_want(r, 0, 8);
+}
+
+static void
+resolve_png(resolve_t *r)
+{
+    uint32_t len;
+
+    if (r->state == 0)
+    {
+        /** the stock config matches from "PNG", past the leading 0x89 */
+        r->pos   = r->field[0] == 0x89 ? 8 : 7;
+        r->state = 1;
+        resolve_want(r, r->pos, 8);
+        return;
+    }
+    len = BE32(r->field);
+    if (len > 0x7fffffff)
+    {
+        r->length = RESOLVE_FAIL;
+        return;
+    }
+    if (memcmp(r->field + 4, "IEND", 4) == 0)
+    {
+        r->length = r->pos + 12;
+        return;
+    }
+    r->pos += 12 + len;
+    resolve_want(r, r->pos, 8);
+}
+
+/*
+ * ZIP: walk the local file headers, then the central directory, out to
+ * the end of central directory record.  entries that use a data
+ * descriptor don't say how big they are up front so we give up on those.
+ */
+enum
+{
+    ZIP_SIG,
+    ZIP_LOCAL,
+    ZIP_CENTRAL,
+    ZIP_END,
+    ZIP_END64
+};
+
+static void
+resolve_zip_start(resolve_t *r)
+{
+    r->step  = resolve_zip;
+    r->state = ZIP_SIG;
+    r->pos   = 0;
+    resolve_want(r, 0, 4);
+}
+
+static void
+resolve_zip(resolve_t *r)
+{
+    uint32_t csize;
+
+    switch (r->state)
+    {
+        case ZIP_SIG:
+            if (memcmp(r->field, "PK\x03\x04", 4) == 0)
+            {
+                r->state = ZIP_LOCAL;
+                resolve_want(r, r->pos + 4, 26);
+            }
+            else if (memcmp(r->field, "PK\x01\x02", 4) == 0)
+            {
+                r->state = ZIP_CENTRAL;
+                resolve_want(r, r->pos + 4, 42);
+            }
+            else if (memcmp(r->field, "PK\x05\x06", 4) == 0)
+            {
+                r->state = ZIP_END;
+                resolve_want(r, r->pos + 4, 18);
+            }
+            else if (memcmp(r->field, "PK\x06\x06", 4) == 0)
+            {
+                r->state = ZIP_END64;
+                resolve_want(r, r->pos + 4, 8);
+            }
+            else if (memcmp(r->field, "PK\x06\x07", 4) == 0)
+            {
+                /** zip64 locator, fixed size */
+                r->pos += 20;
+                resolve_want(r, r->pos, 4);
+            }
+            else
+            {
+                r->length = RESOLVE_FAIL;
+            }
+            return;
+        case ZIP_LOCAL:
+            csize = LE32(r->field + 14);
+            if ((LE16(r->field + 2) & 0x08) || csize == 0xffffffff)
+            {
+                /** data descriptor or zip64, size isn't here */
+                r->length = RESOLVE_FAIL;
+                return;
+            }
+            r->pos += 30 + (off_t)csize + LE16(r->field + 22) +
+                LE16(r->field + 24);
+            break;
+        case ZIP_CENTRAL:
+            r->pos += 46 + LE16(r->field + 24) + LE16(r->field + 26) +
+                LE16(r->field + 28);
+            break;
+        case ZIP_END:
+            r->length = r->pos + 22 + LE16(r->field + 16);
+            return;
+        case ZIP_END64:
+            r->pos += 12 + (off_t)LE64(r->field);
+            break;
+    }
+    r->state = ZIP_SIG;
+    resolve_want(r, r->pos, 4);
+}
+
+/** RIFF (avi, wav, webp): the size is right there in the header */
+static void
+resolve_riff_start(resolve_t *r)
+{
+    r->step = resolve_riff;
+    resolve_want(r, 0, 8);
+}
+
+static void
+resolve_riff(resolve_t *r)
+{
+    uint32_t size;
+
+    if (memcmp(r->field, "RIFF", 4) == 0)
+    {
+        size = LE32(r->field + 4);
+    }
+    else if (memcmp(r->field, "RIFX", 4) == 0)
+    {
+        size = BE32(r->field + 4);
+    }
+    else
+    {
+        r->length = RESOLVE_FAIL;
+        return;
+    }
+    /** chunks are padded out to an even length */
+    r->length = 8 + (off_t)size + (size & 1);
+}
+
+/*
+ * PDF: there's no length field so we scan for the %%EOF that closes out
+ * the trailer after startxref.  linearized files have a first page
+ * trailer of their own up front, so they end at the second one.
+ */
+static void
+resolve_pdf_start(resolve_t *r)
+{
+    r->scan  = resolve_pdf;
+    r->state = 0;               /* seen a startxref since the last %%EOF */
+    r->n     = 0;               /* %%EOFs seen */
+    r->count = 1;               /* %%EOFs to expect */
+}
+
+static void
+resolve_pdf(resolve_t *r, const uint8_t *data, size_t len, off_t off)
+{
+    size_t i;
+
+    for (i = 0; i < len && r->length == 0; i++)
+    {
+        if (off + (off_t)i < 1024 &&
+            resolve_match("/Linearized", &r->m[2], data[i]))
+        {
+            r->count = 2;
+        }
+        if (resolve_match("startxref", &r->m[1], data[i]))
+        {
+            r->state = 1;
+        }
+        if (resolve_match("%%EOF", &r->m[0], data[i]) && r->state)
+        {
+            r->state = 0;
+            if (++r->n < r->count)
+            {
+                continue;
+            }
+            /** take the end of line with it if we can see it */
+            r->length = off + i + 1;
+            if (i + 1 < len && data[i + 1] == '\r')
+            {
+                r->length++;
+                i++;
+            }
+            if (i + 1 < len && data[i + 1] == '\n')
+            {
+                r->length++;
+            }
+        }
+    }
+}
+
+/** EOF */
@@ -29,420 +29,1076 @@
    by Nick Harbour
 */
 
+#include <ctype.h>
 #include "nfex.h"
 #include "util.h"
 #include "search.h"
 #include "conf.h"
 
-static size_t currlen;
-
-void
-search_compile(srch_node_t **srch_tree, int id, char *ext, u_long maxlen, 
-char *spec, spectype_t type)
+/*
+ * parse a HEADER or FOOTER and add it to a machine.  a specifier is a run
+ * of positions, each one a literal byte, an escape (\xHH, \n, \t, \r, \0,
+ * \\), the \? wildcard or a byte class like [\x00-\x1f] or [^abc].  the
+ * machine isn't usable until search_build() has been run on it.  returns
+ * the number of bytes the pattern matches.
+ */
+size_t
+search_compile(srch_machine_t **machine, fileid_t *fileid, char *spec,
+spectype_t type)
 {
-    srch_node_t *p;
-    int ch, i, speclen;
-    char c, code[3] = {'\0'};
+    srch_pattern_t *p;
+    int i, c, speclen;
+    size_t n;
 
     /** length of the raw HEADER or FOOTER (specifier) from config file */
     speclen = strlen(spec);
     if (speclen == 0)
     {
-        return;
+        return (0);
     }
 
-    /** is this the first node? */
-    if (*srch_tree == NULL)
+    /** is this the first pattern? */
+    if (*machine == NULL)
     {
-        *srch_tree = new_srch_node(TABLE);
+        *machine = ecalloc(1, sizeof (srch_machine_t));
+        (*machine)->last = &((*machine)->patterns);
     }
 
-    i       = 0;
-    currlen = 0;
-    p       = *srch_tree;
+    p           = ecalloc(1, sizeof (srch_pattern_t));
+    p->class    = ecalloc(speclen, sizeof (srch_class_t));
+    p->fileid   = fileid;
+    p->spectype = type;
+    p->spec     = strdup(spec);
 
     /** step through the HEADER or FOOTER and process it piece by piece */
-    while (i < speclen)
+    for (i = 0, n = 0; i < speclen; n++)
     {
-        if (spec[i] == '\\')
+        if (spec[i] == '[')
         {
-            if (i + 1 >= speclen)
-            {
-                error("dangling \'\\\' in file type specifier");
-            }
-            switch (spec[++i])
-            {
-                case '\\':
-                    p = add_simple(p, '\\', speclen - i, id, ext, maxlen, type);
-                    break;
-                case 'x':
-                    if (i + 2 >= speclen)
-                    {
-                        error("invalid hex code in file type specifier");
-                    }
-                    code[0] = spec[++i];
-                    code[1] = spec[++i];
-                    sscanf(code, "%02x", &ch);
-                    c = (char)ch;
-                    p = add_simple(p, c, speclen - i, id, ext, maxlen, type);
-                    break;
-                case 'n':
-                    p = add_simple(p, '\n', speclen - i, id, ext, maxlen, type);
-                    break;
-                case 't':
-                    p = add_simple(p, '\t', speclen - i, id, ext, maxlen, type);
-                    break;
-                case 'r':
-                    p = add_simple(p, '\r', speclen - i, id, ext, maxlen, type);
-                    break;
-                case '0':
-                    p = add_simple(p, '\0', speclen - i, id, ext, maxlen, type);
-                    break;
-                case '?':
-                    p = add_wildcard(p, speclen - i, id, ext, maxlen, type);
-                    break;
-                default:
-                    error("invalid escape character in file format specifier");
-                    break;
-            }
+            parse_class(spec, &i, speclen, p->class[n]);
+        }
+        else if (spec[i] == '\\' && i + 1 < speclen && spec[i + 1] == '?')
+        {
+            /** matches anything */
+            memset(p->class[n], 0xff, sizeof (srch_class_t));
+            i += 2;
         }
         else
         {
-            p = add_simple(p, spec[i], speclen - i, id, ext, maxlen, type);
+            c = parse_byte(spec, &i, speclen);
+            SRCH_CLASS_SET(p->class[n], c);
         }
-        i++;
     }
+    p->len = n;
 
-    /** this assumes node_ptr is pointing to a COMPLETE node */
-    p->data.fileid.len = currlen;
-}
+    /** keep them in config file order */
+    *((*machine)->last) = p;
+    (*machine)->last    = &(p->next);
 
+    return (n);
+}
 
-static srch_node_t *
-new_srch_node(srch_nodetype_t nodetype)
+/** parse one literal or escaped byte out of a specifier */
+static int
+parse_byte(char *spec, int *i, int speclen)
 {
-    srch_node_t *p;
-
-    //XXX will this break? orig code: p = ecalloc(sizeof (srch_node_t), 1);
-    p = ecalloc(1, sizeof (srch_node_t));
-    p->nodetype = nodetype;
+    int c;
+    char code[3] = {'\0'};
 
-    return (p);
+    if (spec[*i] != '\\')
+    {
+        return ((uint8_t)spec[(*i)++]);
+    }
+    if (*i + 1 >= speclen)
+    {
+        error("dangling \'\\\' in file type specifier\n");
+    }
+    (*i)++;
+    switch (spec[(*i)++])
+    {
+        case '\\':
+            return ('\\');
+        case 'x':
+            if (*i + 1 >= speclen || !isxdigit(spec[*i]) ||
+                !isxdigit(spec[*i + 1]))
+            {
+                error("invalid hex code in file type specifier\n");
+            }
+            code[0] = spec[(*i)++];
+            code[1] = spec[(*i)++];
+            sscanf(code, "%02x", &c);
+            return (c);
+        case 'n':
+            return ('\n');
+        case 't':
+            return ('\t');
+        case 'r':
+            return ('\r');
+        case '0':
+            return ('\0');
+        case '?':
+            error("wildcard inside a byte class in file type specifier\n");
+            break;
+        default:
+            error("invalid escape character in file format specifier\n");
+            break;
+    }
+    return (-1);
 }
 
-
-static srch_node_t *
-add_simple(srch_node_t *node, uint8_t c, int remaining, int id, char *ext, 
-unsigned long maxlen, spectype_t type)
+/** parse a byte class, [...] or [^...] with single bytes and lo-hi ranges */
+static int
+parse_class(char *spec, int *i, int speclen, srch_class_t class)
 {
-    srch_node_t *p, *q;
-    
-    currlen++;
+    int lo, hi, c, negate;
 
-    if (remaining == 1)
-    {   
-        /** if remaining is 1 then we need to point to a COMPLETE node */
-        p                     = new_srch_node(COMPLETE);
-        p->spectype           = type;
-        p->data.fileid.id     = id;
-        p->data.fileid.ext    = ext;
-        p->data.fileid.maxlen = maxlen;
-        node->data.table[c]   = p;
-        q                     = p;
+    (*i)++;
+    negate = 0;
+    if (*i < speclen && spec[*i] == '^')
+    {
+        negate = 1;
+        (*i)++;
     }
-    else if (node->data.table[c] == NULL)
+    memset(class, 0, sizeof (srch_class_t));
+    while (*i < speclen && spec[*i] != ']')
     {
-        p                   = new_srch_node(TABLE);
-        node->data.table[c] = p;
-        q                   = p;
+        lo = hi = parse_byte(spec, i, speclen);
+        if (*i + 1 < speclen && spec[*i] == '-' && spec[*i + 1] != ']')
+        {
+            (*i)++;
+            hi = parse_byte(spec, i, speclen);
+            if (hi < lo)
+            {
+                error("backwards range in byte class in file type "
+                      "specifier\n");
+            }
+        }
+        for (c = lo; c <= hi; c++)
+        {
+            SRCH_CLASS_SET(class, c);
+        }
     }
-    else
+    if (*i >= speclen)
     {
-        q = node->data.table[c];
+        error("unterminated byte class in file type specifier\n");
     }
-
-    return (q);
+    (*i)++;
+    if (negate)
+    {
+        for (c = 0; c < (int)sizeof (srch_class_t); c++)
+        {
+            class[c] = ~class[c];
+        }
+    }
+    for (c = 0; c < (int)sizeof (srch_class_t); c++)
+    {
+        if (class[c])
+        {
+            return (1);
+        }
+    }
+    error("empty byte class in file type specifier\n");
+    return (0);
 }
 
-
-static srch_node_t *
-add_wildcard(srch_node_t *node, int remaining, int id, char *ext, unsigned long maxlen, spectype_t type)
+/*
+ * turn the patterns in a machine into a DFA.  the NFA is just the patterns
+ * laid end to end, position i of a pattern meaning i bytes of it have
+ * matched.  a DFA state is a set of those positions (subset construction).
+ * unanchored machines can start a match at any byte so the start of every
+ * pattern is implicitly in every state; anchored ones only start at the
+ * first byte and go SRCH_DEAD once nothing can match.  name is used for
+ * diagnostics.
+ */
+void
+search_build(srch_machine_t *m, int anchored, fileid_t **fileids, char *name)
 {
-    srch_node_t *p;
-    int i;
-    
-    currlen++;
-
-    if (remaining == 1)
-    {   
-        /** if remaining is 1 then we need to point to a COMPLETE node */
-        p                     = new_srch_node(COMPLETE);
-        p->spectype           = type;
-        p->data.fileid.id     = id;
-        p->data.fileid.ext    = ext;
-        p->data.fileid.maxlen = maxlen;
-        for (i = 0; i < 256; i++)
-        {
-            /** a specific char trumps a wildcard */
-            if (node->data.table[i] == NULL)
+    srch_build_t b;
+    srch_pattern_t *p;
+    uint32_t s, q, i, j, k, k2, c, n, *next, *set, *mrg, t, row[256];
+
+    if (m == NULL)
+    {
+        return;
+    }
+    m->anchored = anchored;
+    m->fileids  = fileids;
+
+    memset(&b, 0, sizeof (b));
+    for (m->npos = 0, p = m->patterns; p; p = p->next)
+    {
+        p->base  = m->npos;
+        m->npos += p->len + 1;
+    }
+    b.pos = ecalloc(m->npos, sizeof (srch_pattern_t *));
+    for (p = m->patterns; p; p = p->next)
+    {
+        for (i = 0; i <= p->len; i++)
+        {
+            b.pos[p->base + i] = p;
+        }
+        /** where a fresh match of this pattern goes on each byte */
+        for (c = 0; c < 256; c++)
+        {
+            if (SRCH_CLASS_ISSET(p->class[0], c))
             {
-                /** shhh, that indicates a slight "feature" */
-                node->data.table[i] = p;  
+                b.start[c] = erealloc(b.start[c],
+                    (b.nstart[c] + 1) * sizeof (uint32_t));
+                b.start[c][b.nstart[c]++] = p->base + 1;
             }
         }
-        return (p);
     }
-    else
+    b.hashsize = 1024;
+    b.hash     = ecalloc(b.hashsize, sizeof (uint32_t));
+    b.poolsize = 4 * m->npos;
+    b.pool     = ecalloc(b.poolsize, sizeof (uint32_t));
+    next       = ecalloc(m->npos, sizeof (uint32_t));
+    mrg        = ecalloc(2 * m->npos, sizeof (uint32_t));
+    set        = ecalloc(m->npos, sizeof (uint32_t));
+
+    /** the start state */
+    n = 0;
+    if (anchored)
     {
-        p = new_srch_node(TABLE);
-        for (i = 0; i < 256; i++)
+        for (p = m->patterns; p; p = p->next)
         {
-            if (node->data.table[i] == NULL)
+            next[n++] = p->base;
+        }
+    }
+    dfa_state(m, &b, next, n, name);
+
+    /** states are numbered as they're found, so this is a breadth walk */
+    for (s = 0; s < m->nstates; s++)
+    {
+        /** the set moves around as the pool grows, work from a copy */
+        k = b.setlen[s];
+        memcpy(set, b.pool + b.set[s], k * sizeof (uint32_t));
+        for (c = 0; c < 256; c++)
+        {
+            n = 0;
+            for (i = 0; i < k; i++)
             {
-                node->data.table[i] = p;
+                q = set[i];
+                p = b.pos[q];
+                if (q - p->base < p->len &&
+                    SRCH_CLASS_ISSET(p->class[q - p->base], c))
+                {
+                    next[n++] = q + 1;
+                }
+            }
+            /**
+             * both runs are sorted already, merge them so the set stays
+             * sorted with each position in at most once
+             */
+            k2 = anchored ? 0 : b.nstart[c];
+            for (i = 0, q = 0, j = 0; i < n || q < k2; )
+            {
+                if (q == k2 || (i < n && next[i] < b.start[c][q]))
+                {
+                    t = next[i++];
+                }
+                else
+                {
+                    t = b.start[c][q++];
+                }
+                if (j == 0 || mrg[j - 1] != t)
+                {
+                    mrg[j++] = t;
+                }
+            }
+            if (j == 0)
+            {
+                row[c] = anchored ? SRCH_DEAD : SRCH_START;
+                continue;
+            }
+            n      = m->nstates;
+            row[c] = dfa_state(m, &b, mrg, j, name);
+            if (m->nstates > n)
+            {
+                /** remember where it was found, for picking its default */
+                b.par[row[c]]  = s;
+                b.parc[row[c]] = c;
             }
         }
-        return (p);
+        dfa_row(m, &b, s, row);
+    }
+
+    /** small machines go faster as a full table and still fit in cache */
+    if (m->nstates <= SRCH_DENSE_MAX)
+    {
+        dfa_dense(m);
+    }
+    printf("%s machine built: %d states, %s (%ld KB)\n", name, m->nstates,
+        m->table ? "full table" : "compressed", (long)search_size(m) / 1024);
+
+    for (c = 0; c < 256; c++)
+    {
+        free(b.start[c]);
+    }
+    free(b.pos);
+    free(b.pool);
+    free(b.set);
+    free(b.setlen);
+    free(b.hash);
+    free(b.par);
+    free(b.parc);
+    free(next);
+    free(mrg);
+    free(set);
+}
+
+/** free a machine, the tables stay put if they're in a signature image */
+void
+search_free(srch_machine_t *m)
+{
+    srch_pattern_t *p, *nxt;
+
+    if (m == NULL)
+    {
+        return;
+    }
+    for (p = m->patterns; p; p = nxt)
+    {
+        nxt = p->next;
+        free(p->class);
+        free(p->spec);
+        free(p);
     }
+    if (m->mapped == 0)
+    {
+        free(m->table);
+        free(m->base);
+        free(m->def);
+        free(m->next);
+        free(m->check);
+        free(m->match);
+        free(m->matches);
+    }
+    free(m);
 }
 
 /*
- * the overall search interface.  You call this bad boy and give it a
- * pointer to your data buffer (i.e. a packet)
+ * find the DFA state for a set of positions, making a new one if it's not
+ * been seen before.  a new state matches every pattern it has the last
+ * position of.
  */
-srch_results_t *
-search(srch_node_t *tree, srchptr_list_t **srchptr_list, uint8_t *buf, 
-size_t len)
+static uint32_t
+dfa_state(srch_machine_t *m, srch_build_t *b, uint32_t *set, uint32_t n,
+char *name)
 {
-    srch_results_t *p;
-    int i;
-    
-    /** called once for every byte of data in the payload */
-    for (p = NULL, i = 0; i < len; i++)
+    uint32_t h, i, s;
+    srch_pattern_t *p;
+
+    if ((m->nstates + 1) * 2 > b->hashsize)
     {
-        /** can this be optimized, can we run on blocks of data? */
-        update_search(tree, srchptr_list, &p, buf[i], i); 
+        dfa_rehash(m, b);
+    }
+    for (h = 2166136261U, i = 0; i < n; i++)
+    {
+        h = (h ^ set[i]) * 16777619U;
+    }
+    for (h &= b->hashsize - 1; b->hash[h]; h = (h + 1) & (b->hashsize - 1))
+    {
+        s = b->hash[h] - 1;
+        if (b->setlen[s] == n &&
+            memcmp(b->pool + b->set[s], set, n * sizeof (uint32_t)) == 0)
+        {
+            return (s);
+        }
     }
 
-    return (p);
+    if (m->nstates == SRCH_STATE_MAX)
+    {
+        dfa_overflow(m, name);
+    }
+    s = m->nstates++;
+    b->hash[h] = s + 1;
+    if (s == b->size)
+    {
+        b->size     = b->size ? b->size * 2 : 64;
+        m->base     = erealloc(m->base, b->size * sizeof (uint32_t));
+        m->def      = erealloc(m->def, b->size * sizeof (uint32_t));
+        m->match    = erealloc(m->match, b->size * sizeof (uint32_t));
+        b->set      = erealloc(b->set, b->size * sizeof (uint32_t));
+        b->setlen   = erealloc(b->setlen, b->size * sizeof (uint32_t));
+        b->par      = erealloc(b->par, b->size * sizeof (uint32_t));
+        b->parc     = erealloc(b->parc, b->size * sizeof (uint8_t));
+    }
+    if (b->npool + n > b->poolsize)
+    {
+        b->poolsize = (b->poolsize + n) * 2;
+        b->pool     = erealloc(b->pool, b->poolsize * sizeof (uint32_t));
+    }
+    memcpy(b->pool + b->npool, set, n * sizeof (uint32_t));
+    b->set[s]    = b->npool;
+    b->setlen[s] = n;
+    b->npool    += n;
+
+    m->match[s] = 0;
+    for (i = 0; i < n; i++)
+    {
+        p = b->pos[set[i]];
+        if (set[i] - p->base != p->len)
+        {
+            continue;
+        }
+        if (m->match[s] == 0)
+        {
+            m->match[s] = m->nmatches + 1;
+        }
+        else
+        {
+            m->matches[m->nmatches - 1].last = 0;
+        }
+        m->matches = erealloc(m->matches, 
+            (m->nmatches + 1) * sizeof (srch_match_t));
+        m->matches[m->nmatches].fileid   = p->fileid->id;
+        m->matches[m->nmatches].spectype = p->spectype;
+        m->matches[m->nmatches].len      = p->len;
+        m->matches[m->nmatches].last     = 1;
+        m->nmatches++;
+        m->maxlen = MAX(m->maxlen, p->len);
+    }
+    return (s);
 }
 
+/** double the set hash and put every state back in it */
 static void
-add_srchptr(srchptr_list_t **srchptr_list, srch_node_t *node)
+dfa_rehash(srch_machine_t *m, srch_build_t *b)
 {
-    srchptr_list_t *p, *q;
-
-    p = ecalloc(1, sizeof (srchptr_list_t));
-
-    /** make this guy the front of the list */
-    p->next = *srchptr_list;
+    uint32_t h, i, s, *set;
 
-    if (p->next)
+    free(b->hash);
+    b->hashsize *= 2;
+    b->hash      = ecalloc(b->hashsize, sizeof (uint32_t));
+    for (s = 0; s < m->nstates; s++)
     {
-        /** fix pointer linkage */
-        p->next->prev = p;
+        set = b->pool + b->set[s];
+        for (h = 2166136261U, i = 0; i < b->setlen[s]; i++)
+        {
+            h = (h ^ set[i]) * 16777619U;
+        }
+        for (h &= b->hashsize - 1; b->hash[h]; h = (h + 1) & (b->hashsize - 1))
+            ;
+        b->hash[h] = s + 1;
     }
-    p->node       = node;
-    *srchptr_list = p;
-
-    //for (q = p->next; q && q != p; q = q->next) ;
 }
 
+/*
+ * store state s's row.  the default tried first is where s's parent's
+ * default goes on the byte that led to s, which for plain strings is the
+ * failure state and differs from s in only a byte or two.  whichever of
+ * that and the start state needs fewer slots wins.
+ */
 static void
-remv_srchptr(srchptr_list_t **srchptr_list, srchptr_list_t *p)
+dfa_row(srch_machine_t *m, srch_build_t *b, uint32_t s, uint32_t *row)
 {
-    if (p->prev)
+    uint32_t c, d, u, n, nu, nd, base, exc[256];
+
+    d = SRCH_EMPTY;
+    if (s != SRCH_START)
+    {
+        u = SRCH_START;
+        if (b->par[s] != SRCH_START && m->def[b->par[s]] != SRCH_EMPTY)
+        {
+            u = search_next(m, m->def[b->par[s]], b->parc[s]);
+            if (u == SRCH_DEAD || u >= s)
+            {
+                u = SRCH_START;
+            }
+        }
+        for (c = 0, n = 0, nu = 0, nd = 0; c < 256; c++)
+        {
+            n  += row[c] != search_next(m, SRCH_START, c);
+            nu += row[c] != search_next(m, u, c);
+            nd += row[c] != SRCH_DEAD;
+        }
+        d = nu < n ? u : SRCH_START;
+        if (m->anchored && nd <= nu && nd <= n)
+        {
+            /** mostly SRCH_DEAD, no default and what isn't stored is dead */
+            d = SRCH_EMPTY;
+        }
+    }
+    for (c = 0, n = 0; c < 256; c++)
     {
-        p->prev->next = p->next;
+        if (d == SRCH_EMPTY ? (s == SRCH_START || row[c] != SRCH_DEAD) :
+            row[c] != search_next(m, d, c))
+        {
+            exc[n++] = c;
+        }
     }
 
-    if (p->next)
+    /** first fit into the free slots */
+    base = 0;
+    if (n)
     {
-        p->next->prev = p->prev;
+        base = b->lofree > exc[0] ? b->lofree - exc[0] : 0;
     }
+    for (c = 0; c < n; )
+    {
+        if (base + exc[c] < b->combsize && 
+            m->check[base + exc[c]] != SRCH_EMPTY)
+        {
+            base++;
+            c = 0;
+            continue;
+        }
+        c++;
+    }
+    if (base + 256 > b->combsize)
+    {
+        c = b->combsize;
+        b->combsize = (base + 256) * 2;
+        m->next     = erealloc(m->next, b->combsize * sizeof (uint32_t));
+        m->check    = erealloc(m->check, b->combsize * sizeof (uint32_t));
+        for (; c < b->combsize; c++)
+        {
+            m->check[c] = SRCH_EMPTY;
+        }
+    }
+    for (c = 0; c < n; c++)
+    {
+        m->next[base + exc[c]]  = row[exc[c]];
+        m->check[base + exc[c]] = s;
+    }
+    m->base[s] = base;
+    m->def[s]  = d;
+    if (base + 256 > m->ncomb)
+    {
+        m->ncomb = base + 256;
+    }
+    while (b->lofree < b->combsize && m->check[b->lofree] != SRCH_EMPTY)
+    {
+        b->lofree++;
+    }
+}
+
+/** trade a compressed machine for a full table */
+static void
+dfa_dense(srch_machine_t *m)
+{
+    uint32_t s, c, (*table)[256];
 
-    if (*srchptr_list == p)
+    table = emalloc(m->nstates * sizeof (table[0]));
+    for (s = 0; s < m->nstates; s++)
     {
-        *srchptr_list = p->next;
+        for (c = 0; c < 256; c++)
+        {
+            table[s][c] = search_next(m, s, c);
+        }
     }
+    m->table = table;
+    free(m->base);
+    free(m->def);
+    free(m->next);
+    free(m->check);
+    m->base  = NULL;
+    m->def   = NULL;
+    m->next  = NULL;
+    m->check = NULL;
+    m->ncomb = 0;
+}
 
-    free(p);
+/** a machine got too big to build, point at the likely culprits */
+static void
+dfa_overflow(srch_machine_t *m, char *name)
+{
+    srch_pattern_t *p;
+    size_t i;
+    int c, n, bits;
+
+    fprintf(stderr, "%s machine needs more than %d states, the wildcards "
+        "and byte classes in these are the likely cause:\n", name,
+        SRCH_STATE_MAX);
+    for (p = m->patterns; p; p = p->next)
+    {
+        for (n = 0, i = 0; i < p->len; i++)
+        {
+            for (bits = 0, c = 0; c < 256; c++)
+            {
+                bits += SRCH_CLASS_ISSET(p->class[i], c) ? 1 : 0;
+            }
+            n += bits > 1;
+        }
+        if (n)
+        {
+            fprintf(stderr, "    %s %s: %s (%d of %ld bytes)\n",
+                p->fileid->ext, p->spectype == HEADER ? "HEADER" : "FOOTER",
+                p->spec, n, (long)p->len);
+        }
+    }
+    error("search machine too large, try anchoring or trimming wildcards\n");
 }
 
 /*
- * I sincerely apologize for this function.  This is called once for every 
- * byte of data so I don't want to waste cycles with layers and layers of 
- * function calls. The end result is a long, complex and unmaintainable 
- * function that is quick
- *
- * The inner demon of the search mechanism.  This updates all state machine 
- * pointers with the current character and fixes the search results list 
- * appropriately
- *
- * FIXME: perhaps make this inline for speed
+ * the overall search interface.  You call this bad boy and give it a
+ * pointer to your data buffer (i.e. a packet).  state is where the last
+ * buffer of the flow left off.  mask is a set of SRCH_ID_BITs, only
+ * patterns for those file types are reported.
  */
-static void
-update_search(srch_node_t *tree, srchptr_list_t **srchptr_list, 
-srch_results_t **results, uint8_t c, int offset)
+srch_results_t *
+search(srch_machine_t *m, uint32_t *state, uint8_t *buf, size_t len,
+uint32_t mask)
 {
-    srch_node_t *node;
-    srchptr_list_t *ptr;
-    srchptr_list_t *nxt;
+    srch_results_t *p;
+    uint32_t s, c;
+    int i;
 
-    if (*srchptr_list)
-    {   
-        /** start by updating existing threads */
-        for (ptr = *srchptr_list; ptr; ptr = nxt)
+    if (m == NULL)
+    {
+        /** nothing compiled into this machine */
+        return (NULL);
+    }
+
+    if (m->scan)
+    {
+        /** the generated scanner runs until something matches */
+        for (p = NULL, s = *state, i = 0; i < len; )
         {
-            nxt = ptr->next;
-            if (ptr->node->data.table[c])
+            i += m->scan(&s, buf + i, len - i);
+            if (m->match[s])
             {
-                srch_node_t *node = ptr->node->data.table[c];
-                switch (node->nodetype)
-                {
-                    case TABLE:
-                        ptr->node = node;
-                        break;
-                    case COMPLETE:
-                        add_result(results, &node->data.fileid, node->spectype,
-                            offset);
-                        remv_srchptr(srchptr_list, ptr);
-                        break;
-                    default:
-                        error("Unknown node type");
-                        break;
-                }
+                add_matches(&p, m, s, mask, i - 1);
             }
-            else
+        }
+        *state = s;
+        return (p);
+    }
+
+    if (m->table == NULL)
+    {
+        /** compressed, follow defaults until a state has the byte */
+        for (p = NULL, s = *state, i = 0; i < len; i++)
+        {
+            c = buf[i];
+            while (m->check[m->base[s] + c] != s)
+            {
+                s = m->def[s];
+            }
+            s = m->next[m->base[s] + c];
+            if (m->match[s])
             {
-                remv_srchptr(srchptr_list, ptr);
+                add_matches(&p, m, s, mask, i);
             }
         }
+        *state = s;
+        return (p);
     }
 
-    /** now see if we want to start a new thread (i.e. a new potential match) */
-    if (tree->data.table[c])
+    /** one lookup per byte, whatever's in the machine */
+    for (p = NULL, s = *state, i = 0; i < len; i++)
     {
-        node = tree->data.table[c];
-        switch (node->nodetype)
+        s = m->table[s][buf[i]];
+        if (m->match[s])
         {
-            case TABLE:
-                /** this should be 99.99% of them */
-                add_srchptr(srchptr_list, node);
-                break;
-            case COMPLETE:
-                /** In the unlikely event of a one byte header */
-                add_result(results, &node->data.fileid, node->spectype, offset);
-                break;
-            default:
-                error("Unknown node type");
-                break;     
+            add_matches(&p, m, s, mask, i);
         }
     }
+    *state = s;
+
+    return (p);
 }
 
-static void
-update_search2(srch_node_t *tree, srchptr_list_t **srchptr_list, 
-srch_results_t **results, uint8_t c, int offset)
+/*
+ * search a batch of independent buffers, SRCH_LANES at a time.  walking
+ * one buffer every lookup waits on the one before it, so the loads go
+ * one at a time; taking a byte from each buffer in turn gives the cpu
+ * several walks to overlap.  a lane's buffer is searched from its state 
+ * with every file type in the mask, its results and where it ended up 
+ * come back in the lane.
+ */
+void
+search_batch(srch_lane_t **lanes, int n)
 {
-    if (*srchptr_list)
-    {   /** start by updating existing threads */
-        srchptr_list_t *ptr;
-        srchptr_list_t *nxt = NULL, *prv = NULL;
-                
-        for (ptr = *srchptr_list; ptr; prv = ptr, nxt = ptr->next, ptr = nxt)
-        {
-            if (ptr->node->data.table[c])
+    int k, nact, next;
+    uint32_t s, c, state[SRCH_LANES];
+    size_t j, run, pos[SRCH_LANES];
+    srch_machine_t *m;
+    srch_lane_t *l, *act[SRCH_LANES];
+
+    for (nact = 0, next = 0; ; )
+    {
+        /** keep the lanes full while there are buffers waiting */
+        while (nact < SRCH_LANES && next < n)
+        {
+            l = lanes[next++];
+            l->results = NULL;
+            if (l->machine == NULL || l->machine->scan || l->len == 0)
             {
-                srch_node_t *node = ptr->node->data.table[c];
-                switch (node->nodetype)
-                {
-                    case TABLE:
-                        ptr->node = node;
-                        break;
-                    case COMPLETE:
-                        add_result(results, &node->data.fileid, node->spectype,
-                            offset);
-                    
-                        /* remove thread from list */
-                        if (prv)
-                        {
-                            prv->next = nxt;
-                        }
-                        else
-                        {
-                            *srchptr_list = nxt;
-                        }
-                        if (nxt)
-                        {
-                            nxt->prev = prv;
-                        }
-                        free(ptr);
-                        break;
-                    default:
-                        error("Unknown node type");
-                        break;
-                }
+                /** nothing to interleave, a generated scanner goes alone */
+                l->results = search(l->machine, &(l->state), l->buf, l->len,
+                    SRCH_MASK_ALL);
+                continue;
             }
-            else
-            { /*remove thread from list */
-                if (prv)
+            act[nact]   = l;
+            state[nact] = l->state;
+            pos[nact++] = 0;
+        }
+        if (nact == 0)
+        {
+            break;
+        }
+
+        /** a byte from each in turn, as far as the shortest goes */
+        for (run = act[0]->len - pos[0], k = 1; k < nact; k++)
+        {
+            if (act[k]->len - pos[k] < run)
+            {
+                run = act[k]->len - pos[k];
+            }
+        }
+        m = act[0]->machine;
+        for (k = 1; k < nact && act[k]->machine == m; k++)
+            ;
+        if (k == SRCH_LANES)
+        {
+            /** the usual case, one machine shared by every lane */
+            search_lanes(m, act, state, pos, run);
+            j = run;
+        }
+        else
+        {
+            j = 0;
+        }
+        for (; j < run; j++)
+        {
+            for (k = 0; k < nact; k++)
+            {
+                m = act[k]->machine;
+                c = act[k]->buf[pos[k] + j];
+                s = state[k];
+                if (m->table)
                 {
-                    prv->next = nxt;
+                    s = m->table[s][c];
                 }
                 else
                 {
-                    *srchptr_list = nxt;
+                    while (m->check[m->base[s] + c] != s)
+                    {
+                        s = m->def[s];
+                    }
+                    s = m->next[m->base[s] + c];
                 }
-                if (nxt)
+                state[k] = s;
+                if (m->match[s])
                 {
-                    nxt->prev = prv;
+                    add_matches(&(act[k]->results), m, s, SRCH_MASK_ALL, 
+                        pos[k] + j);
                 }
-                free(ptr);
             }
         }
+
+        /** retire the ones that are done, the last lane fills the gap */
+        for (k = 0; k < nact; )
+        {
+            pos[k] += run;
+            if (pos[k] < act[k]->len)
+            {
+                k++;
+                continue;
+            }
+            act[k]->state = state[k];
+            nact--;
+            act[k]   = act[nact];
+            state[k] = state[nact];
+            pos[k]   = pos[nact];
+        }
     }
+}
 
-    /* now see if we want to start a new thread (i.e. a new potential match) */
-    if (tree->data.table[c])
+/*
+ * run SRCH_LANES lanes through the same machine for len bytes each.  the
+ * states are kept apart so they stay in registers and the compiler can 
+ * see the walks don't depend on each other.
+ */
+static void
+search_lanes(srch_machine_t *m, srch_lane_t **act, uint32_t *state, 
+size_t *pos, size_t len)
+{
+    size_t j;
+    uint32_t s0, s1, s2, s3, s4, s5, s6, s7;
+    uint32_t *match, *base, *def, *next, *check;
+    uint8_t *b0, *b1, *b2, *b3, *b4, *b5, *b6, *b7;
+    uint32_t (*table)[256];
+
+    table = m->table;
+    match = m->match;
+    base  = m->base;
+    def   = m->def;
+    next  = m->next;
+    check = m->check;
+    s0 = state[0]; b0 = act[0]->buf + pos[0];
+    s1 = state[1]; b1 = act[1]->buf + pos[1];
+    s2 = state[2]; b2 = act[2]->buf + pos[2];
+    s3 = state[3]; b3 = act[3]->buf + pos[3];
+    s4 = state[4]; b4 = act[4]->buf + pos[4];
+    s5 = state[5]; b5 = act[5]->buf + pos[5];
+    s6 = state[6]; b6 = act[6]->buf + pos[6];
+    s7 = state[7]; b7 = act[7]->buf + pos[7];
+    for (j = 0; j < len; j++)
     {
-        srch_node_t *node = tree->data.table[c];
-        srchptr_list_t *ptr;
+        if (table)
+        {
+            s0 = table[s0][b0[j]];
+            s1 = table[s1][b1[j]];
+            s2 = table[s2][b2[j]];
+            s3 = table[s3][b3[j]];
+            s4 = table[s4][b4[j]];
+            s5 = table[s5][b5[j]];
+            s6 = table[s6][b6[j]];
+            s7 = table[s7][b7[j]];
+        }
+        else
+        {
+            SRCH_LANE_STEP(s0, b0[j]);
+            SRCH_LANE_STEP(s1, b1[j]);
+            SRCH_LANE_STEP(s2, b2[j]);
+            SRCH_LANE_STEP(s3, b3[j]);
+            SRCH_LANE_STEP(s4, b4[j]);
+            SRCH_LANE_STEP(s5, b5[j]);
+            SRCH_LANE_STEP(s6, b6[j]);
+            SRCH_LANE_STEP(s7, b7[j]);
+        }
+        if (match[s0] | match[s1] | match[s2] | match[s3] | 
+            match[s4] | match[s5] | match[s6] | match[s7])
+        {
+            /** rare, sort out who it was */
+            SRCH_LANE_MATCH(0);
+            SRCH_LANE_MATCH(1);
+            SRCH_LANE_MATCH(2);
+            SRCH_LANE_MATCH(3);
+            SRCH_LANE_MATCH(4);
+            SRCH_LANE_MATCH(5);
+            SRCH_LANE_MATCH(6);
+            SRCH_LANE_MATCH(7);
+        }
+    }
+    state[0] = s0; state[1] = s1; state[2] = s2; state[3] = s3;
+    state[4] = s4; state[5] = s5; state[6] = s6; state[7] = s7;
+}
 
-        switch (node->nodetype)
+/** where state s goes on byte c, however the machine is stored */
+uint32_t
+search_next(srch_machine_t *m, uint32_t s, uint8_t c)
+{
+    if (m->table)
+    {
+        return (m->table[s][c]);
+    }
+    while (m->check[m->base[s] + c] != s)
+    {
+        s = m->def[s];
+        if (s == SRCH_EMPTY)
+        {
+            /** an anchored row with no default */
+            return (SRCH_DEAD);
+        }
+    }
+    return (m->next[m->base[s] + c]);
+}
+
+/** bytes of transitions and matches a machine takes */
+size_t
+search_size(srch_machine_t *m)
+{
+    size_t n;
+
+    n = m->nstates * sizeof (uint32_t) + m->nmatches * sizeof (srch_match_t);
+    if (m->table)
+    {
+        return (n + m->nstates * sizeof (m->table[0]));
+    }
+    return (n + m->nstates * 2 * sizeof (uint32_t) + 
+        m->ncomb * 2 * sizeof (uint32_t));
+}
+
+/*
+ * how fast a machine scans a buffer, in MB/s.  the buffer is cut up into
+ * packet sized pieces, like the real thing, and searched either one after
+ * the other or as batches of independent pieces
+ */
+double
+search_bench(srch_machine_t *m, uint8_t *buf, size_t len, int batch)
+{
+    int k;
+    uint32_t s;
+    size_t i;
+    double t;
+    srch_results_t *r;
+    srch_lane_t lane[SRCH_BENCH_BATCH], *lanes[SRCH_BENCH_BATCH];
+    struct timeval start, end, diff;
+
+    gettimeofday(&start, NULL);
+    for (s = SRCH_START, i = 0; batch == 0 && i < len; i += 1500)
+    {
+        r = search(m, &s, buf + i, len - i < 1500 ? len - i : 1500,
+            SRCH_MASK_ALL);
+        free_results_list(&r);
+    }
+    for (i = 0; batch && i < len; )
+    {
+        for (k = 0; k < SRCH_BENCH_BATCH && i < len; k++, i += 1500)
         {
-        case TABLE:            /* this should be 99.99% of them */
-            if (*srchptr_list == NULL)
+            lane[k].machine = m;
+            lane[k].state   = SRCH_START;
+            lane[k].buf     = buf + i;
+            lane[k].len     = len - i < 1500 ? len - i : 1500;
+            lanes[k]        = &lane[k];
+        }
+        search_batch(lanes, k);
+        while (k--)
+        {
+            free_results_list(&(lane[k].results));
+        }
+    }
+    gettimeofday(&end, NULL);
+    PTIMERSUB(&end, &start, &diff);
+    t = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+    return (t > 0 ? len / t / (1024 * 1024) : 0);
+}
+
+/** report the matches of state s that are in mask, found at offset i */
+static void
+add_matches(srch_results_t **p, srch_machine_t *m, uint32_t s, uint32_t mask,
+int i)
+{
+    srch_match_t *match;
+
+    for (match = &(m->matches[m->match[s] - 1]); ; match++)
+    {
+        if (SRCH_ID_BIT(match->fileid) & mask)
+        {
+            add_result(p, m->fileids[match->fileid], match->spectype, 
+                match->len, i);
+        }
+        if (match->last)
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * fingerprint of a machine's transitions and which states match, so a
+ * generated scanner can be checked against the machine it came from
+ */
+uint64_t
+search_hash(srch_machine_t *m)
+{
+    uint64_t h;
+    uint32_t s, c;
+
+    /** FNV-1a, over 32 bit words */
+    h = 0xcbf29ce484222325ULL;
+    for (s = 0; s < m->nstates; s++)
+    {
+        for (c = 0; c < 256; c++)
+        {
+            h = (h ^ search_next(m, s, c)) * 0x100000001b3ULL;
+        }
+        h = (h ^ (m->match[s] != 0)) * 0x100000001b3ULL;
+    }
+    return (h);
+}
+
+/*
+ * walk a buffer through a search machine anchored at the first byte of 
+ * whatever is being checked (a stream, a body).  there's only ever one
+ * path to follow so this is a handful of table lookups, not a scan.  the
+ * bytes walked are saved in the anchor so a match that spans packets can
+ * still be written out.  returns the fileid of a HEADER that completed
+ * and sets used to the number of bytes consumed, or NULL with a->machine
+ * set to NULL if the walk died.
+ */
+fileid_t *
+search_anchor(srch_anchor_t *a, const uint8_t *buf, size_t len, size_t *used)
+{
+    size_t i;
+    fileid_t *fileid;
+    srch_match_t *match;
+
+    for (i = 0; i < len && a->machine; i++)
+    {
+        if (a->len == SRCH_ANCHOR_MAX)
+        {
+            /** too long to be one of ours */
+            a->machine = NULL;
+            break;
+        }
+        a->prefix[a->len++] = buf[i];
+        a->state = search_next(a->machine, a->state, buf[i]);
+        if (a->state == SRCH_DEAD)
+        {
+            a->machine = NULL;
+            break;
+        }
+        if (a->machine->match[a->state] == 0)
+        {
+            continue;
+        }
+        for (match = &(a->machine->matches[a->machine->match[a->state] - 1]);
+            ; match++)
+        {
+            if (match->spectype == HEADER)
             {
-                *srchptr_list = ecalloc(1, sizeof **srchptr_list);
-                (*srchptr_list)->next = NULL;
-                (*srchptr_list)->prev = NULL;
-                ptr = *srchptr_list;
+                fileid     = a->machine->fileids[match->fileid];
+                a->machine = NULL;
+                *used      = i + 1;
+                return (fileid);
             }
-            else
+            if (match->last)
             {
-                for (ptr = *srchptr_list; ptr->next; ptr = ptr->next);
-                ptr->next = emalloc(sizeof *ptr->next);
-                ptr->next->prev = ptr;
-                ptr = ptr->next;
-                ptr->next = NULL;
+                break;
             }
-            ptr->node = node;
-            break;
-        case COMPLETE:       /* In the unlikely event of a one byte header */
-            add_result(results, &node->data.fileid, node->spectype, offset);
-            break;
-        default:
-            error("Unknown node type");
-            break;     
         }
     }
+    *used = i;
+    return (NULL);
+}
+
+/*
+ * drop HEADERs that are only allowed in the first few bytes of a stream
+ * but showed up later (or somewhere we can't place), offset is the stream
+ * offset of the start of the buffer the results were found in or -1
+ */
+void
+search_window(srch_results_t **results, int64_t offset)
+{
+    srch_results_t *p, *nxt;
+
+    for (p = *results; p; p = nxt)
+    {
+        nxt = p->next;
+        if (p->spectype != HEADER || p->fileid->anchor != ANCHOR_WITHIN)
+        {
+            continue;
+        }
+        if (offset >= 0 && offset + p->offset.start < p->fileid->window)
+        {
+            continue;
+        }
+        if (p->prev)
+        {
+            p->prev->next = p->next;
+        }
+        if (p->next)
+        {
+            p->next->prev = p->prev;
+        }
+        if (*results == p)
+        {
+            *results = p->next;
+        }
+        free(p);
+    }
 }
 
 /* Add a result to a results list, allocating as needed */
 static void 
 add_result(srch_results_t **results, fileid_t *fileid, spectype_t spectype, 
-int offset)
+size_t len, int offset)
 {
     srch_results_t **ptr, *prev = NULL;
 
@@ -457,10 +1113,10 @@ int offset)
         
     *ptr = emalloc(sizeof **ptr);
     (*ptr)->next = NULL;
-    (*ptr)->prev = NULL;
+    (*ptr)->prev = prev;
     (*ptr)->fileid = fileid;
     (*ptr)->spectype = spectype;
-    (*ptr)->offset.start = offset - (fileid->len - 1);
+    (*ptr)->offset.start = offset - ((int)len - 1);
     (*ptr)->offset.end = offset;
 }
 
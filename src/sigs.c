@@ -0,0 +1,603 @@
+/*
+ * sigs.c - precompiled signature images
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include <sys/mman.h>
+#include "nfex.h"
+#include "sigs.h"
+#include "util.h"
+
+#define SIGS_ROUND(n) (((n) + SIGS_ALIGN - 1) & ~((uint64_t)SIGS_ALIGN - 1))
+
+/** a fresh, empty signature set held by whoever asked for it */
+srch_set_t *
+sigs_new()
+{
+    srch_set_t *set;
+
+    set       = ecalloc(1, sizeof (srch_set_t));
+    set->refs = 1;
+
+    return (set);
+}
+
+void
+sigs_hold(srch_set_t *set)
+{
+    set->refs++;
+}
+
+/** let go of a set, the last one out frees it and anything it mapped */
+void
+sigs_release(srch_set_t *set)
+{
+    int i;
+    uint32_t j;
+
+    if (set == NULL || --set->refs)
+    {
+        return;
+    }
+    gen_free(set);
+    for (i = 0; i < SIGS_MACHINES; i++)
+    {
+        search_free(*sigs_machine(set, i));
+    }
+    for (j = 0; j < set->nfileids; j++)
+    {
+        free(set->fileids[j]->ext);
+        free(set->fileids[j]);
+    }
+    free(set->fileids);
+    if (set->image)
+    {
+        munmap(set->image, set->image_size);
+    }
+    free(set);
+}
+
+/** the machines in the order they go in an image */
+static srch_machine_t **
+sigs_machine(srch_set_t *set, int i)
+{
+    switch (i)
+    {
+        case 0:
+            return (&(set->srch_machine));
+        case 1:
+            return (&(set->foot_machine));
+        case 2:
+            return (&(set->strm_machine));
+        default:
+            return (&(set->body_machine));
+    }
+}
+
+/*
+ * --compile-sigs: read a config file the usual way, build its machines
+ * and write the lot out as an image for later runs to map
+ */
+int
+sigs_compile(nfex_conf_t *conf, char *fname)
+{
+    int n;
+    srch_set_t *set;
+
+    set = sigs_new();
+    n   = config_load(set, conf);
+    if (n != -1)
+    {
+        n = sigs_write(set, fname);
+    }
+    sigs_release(set);
+
+    return (n);
+}
+
+/*
+ * --bench: how big each unanchored machine is and how fast it scans
+ * random bytes, to see how a signature set scales.  anchored machines
+ * only ever walk a few bytes per flow.
+ */
+int
+sigs_bench(nfex_conf_t *conf)
+{
+    int i;
+    uint8_t *buf;
+    uint32_t x, k;
+    srch_set_t *set;
+    srch_machine_t *m;
+
+    set = sigs_new();
+    if (config_load(set, conf) == -1)
+    {
+        sigs_release(set);
+        return (-1);
+    }
+    buf = emalloc(SIGS_BENCH_SIZE);
+    for (x = 2463534242U, k = 0; k < SIGS_BENCH_SIZE; k++)
+    {
+        /** xorshift, so every run scans the same bytes */
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[k] = x;
+    }
+    for (i = 0; i < 2; i++)
+    {
+        m = *sigs_machine(set, i);
+        if (m == NULL || m->nstates == 0)
+        {
+            continue;
+        }
+        printf("%s machine: %d states, %s, %ld KB, %.1f MB/s, "
+            "%.1f MB/s batched\n", i ? "FOOTER" : "HEADER", m->nstates, 
+            m->table ? "full table" : "compressed", 
+            (long)search_size(m) / 1024,
+            search_bench(m, buf, SIGS_BENCH_SIZE, 0),
+            search_bench(m, buf, SIGS_BENCH_SIZE, 1));
+    }
+    free(buf);
+    sigs_release(set);
+
+    return (1);
+}
+
+/** write the fileid table and search machines out as an image */
+int
+sigs_write(srch_set_t *set, char *fname)
+{
+    int fd, i;
+    uint8_t *buf;
+    uint32_t j;
+    uint64_t off;
+    ssize_t c;
+    size_t left;
+    srch_machine_t *m;
+    struct sigs_header *h;
+    struct sigs_fileid *f;
+    char tmp[FILENAME_BUFFER_SIZE];
+
+    /** lay it out */
+    h   = ecalloc(1, sizeof (struct sigs_header));
+    off = SIGS_ROUND(sizeof (struct sigs_header));
+    h->fileids = off;
+    off += set->nfileids * sizeof (struct sigs_fileid);
+    for (j = 0; j < set->nfileids; j++)
+    {
+        off += strlen(set->fileids[j]->ext) + 1;
+    }
+    off = SIGS_ROUND(off);
+    for (i = 0; i < SIGS_MACHINES; i++)
+    {
+        m = *sigs_machine(set, i);
+        if (m == NULL || m->nstates == 0)
+        {
+            continue;
+        }
+        h->machine[i].present  = 1;
+        h->machine[i].anchored = m->anchored;
+        h->machine[i].nstates  = m->nstates;
+        h->machine[i].nmatches = m->nmatches;
+        h->machine[i].ncomb    = m->ncomb;
+        if (m->table)
+        {
+            h->machine[i].table = off;
+            off = SIGS_ROUND(off + (uint64_t)m->nstates * 
+                sizeof (m->table[0]));
+        }
+        else
+        {
+            h->machine[i].base  = off;
+            off = SIGS_ROUND(off + (uint64_t)m->nstates * sizeof (uint32_t));
+            h->machine[i].def   = off;
+            off = SIGS_ROUND(off + (uint64_t)m->nstates * sizeof (uint32_t));
+            h->machine[i].next  = off;
+            off = SIGS_ROUND(off + (uint64_t)m->ncomb * sizeof (uint32_t));
+            h->machine[i].check = off;
+            off = SIGS_ROUND(off + (uint64_t)m->ncomb * sizeof (uint32_t));
+        }
+        h->machine[i].match    = off;
+        off = SIGS_ROUND(off + (uint64_t)m->nstates * sizeof (uint32_t));
+        h->machine[i].matches  = off;
+        off = SIGS_ROUND(off + (uint64_t)m->nmatches * sizeof (srch_match_t));
+    }
+    memcpy(h->magic, SIGS_MAGIC, sizeof (h->magic));
+    h->version    = SIGS_VERSION;
+    h->bom        = SIGS_BOM;
+    h->size       = off;
+    h->nfileids   = set->nfileids;
+    h->anch_depth = set->anch_depth;
+    h->nprofiles  = set->nprofiles;
+    memcpy(h->profile, set->profile, sizeof (h->profile));
+
+    /** fill it in */
+    buf = ecalloc(1, h->size);
+    memcpy(buf, h, sizeof (struct sigs_header));
+    f   = (struct sigs_fileid *)(buf + h->fileids);
+    off = h->fileids + set->nfileids * sizeof (struct sigs_fileid);
+    for (j = 0; j < set->nfileids; j++)
+    {
+        f[j].id      = set->fileids[j]->id;
+        f[j].ext     = off;
+        f[j].maxlen  = set->fileids[j]->maxlen;
+        f[j].window  = set->fileids[j]->window;
+        f[j].anchor  = set->fileids[j]->anchor;
+        f[j].profile = set->fileids[j]->profile;
+        f[j].max      = set->fileids[j]->max;
+        f[j].rate     = set->fileids[j]->rate;
+        f[j].burst    = set->fileids[j]->burst;
+        f[j].priority = set->fileids[j]->priority;
+        f[j].commit   = set->fileids[j]->commit;
+        f[j].flags   = (set->fileids[j]->validate ? SIGS_VALIDATE : 0) |
+                       (set->fileids[j]->resolve  ? SIGS_RESOLVE  : 0) |
+                       (set->fileids[j]->footer   ? SIGS_FOOTER   : 0) |
+                       (set->fileids[j]->nothrottle ? SIGS_NOTHROTTLE : 0) |
+                       (set->fileids[j]->nopack   ? SIGS_NOPACK   : 0);
+        strcpy((char *)buf + off, set->fileids[j]->ext);
+        off += strlen(set->fileids[j]->ext) + 1;
+    }
+    for (i = 0; i < SIGS_MACHINES; i++)
+    {
+        if (h->machine[i].present == 0)
+        {
+            continue;
+        }
+        m = *sigs_machine(set, i);
+        if (m->table)
+        {
+            memcpy(buf + h->machine[i].table, m->table,
+                m->nstates * sizeof (m->table[0]));
+        }
+        else
+        {
+            memcpy(buf + h->machine[i].base, m->base,
+                m->nstates * sizeof (uint32_t));
+            memcpy(buf + h->machine[i].def, m->def,
+                m->nstates * sizeof (uint32_t));
+            memcpy(buf + h->machine[i].next, m->next,
+                m->ncomb * sizeof (uint32_t));
+            memcpy(buf + h->machine[i].check, m->check,
+                m->ncomb * sizeof (uint32_t));
+        }
+        memcpy(buf + h->machine[i].match, m->match,
+            m->nstates * sizeof (uint32_t));
+        memcpy(buf + h->machine[i].matches, m->matches,
+            m->nmatches * sizeof (srch_match_t));
+    }
+
+    /** write it beside the real thing and move it into place */
+    snprintf(tmp, sizeof (tmp), "%s.%d", fname, getpid());
+    fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if (fd == -1)
+    {
+        fprintf(stderr, "can't create %s: %s\n", tmp, strerror(errno));
+        free(buf);
+        free(h);
+        return (-1);
+    }
+    for (left = h->size; left; left -= c)
+    {
+        c = write(fd, buf + h->size - left, left);
+        if (c == -1)
+        {
+            fprintf(stderr, "error writing %s: %s\n", tmp, strerror(errno));
+            close(fd);
+            unlink(tmp);
+            free(buf);
+            free(h);
+            return (-1);
+        }
+    }
+    close(fd);
+    if (rename(tmp, fname) == -1)
+    {
+        fprintf(stderr, "can't rename %s to %s: %s\n", tmp, fname,
+            strerror(errno));
+        unlink(tmp);
+        free(buf);
+        free(h);
+        return (-1);
+    }
+    printf("wrote %d file types to signature image %s (%lld bytes)\n",
+        set->nfileids, fname, (long long)h->size);
+    free(buf);
+    free(h);
+
+    return (1);
+}
+
+/** is [off, off + len) inside the image? */
+static int
+sigs_inside(struct sigs_header *h, uint64_t off, uint64_t len)
+{
+    return (off <= h->size && len <= h->size - off);
+}
+
+/*
+ * check a machine's transitions go to states that exist and, if it's
+ * compressed, that every lookup stays inside the arrays and its walk
+ * through the defaults ends
+ */
+static int
+sigs_check(struct sigs_header *h, struct sigs_machine *sm, uint8_t *image)
+{
+    uint32_t s, c, k, *table, *base, *def, *next, *check;
+
+    s = sm->nstates;
+    if (sm->ncomb == 0)
+    {
+        if (!sigs_inside(h, sm->table, (uint64_t)s * 256 * 4))
+        {
+            return (-1);
+        }
+        table = (uint32_t *)(image + sm->table);
+        for (k = 0; k < s * 256; k++)
+        {
+            if (table[k] >= s && (table[k] != SRCH_DEAD || sm->anchored == 0))
+            {
+                return (-1);
+            }
+        }
+        return (1);
+    }
+
+    if (sm->ncomb < 256 ||
+        !sigs_inside(h, sm->base, (uint64_t)s * 4) ||
+        !sigs_inside(h, sm->def, (uint64_t)s * 4) ||
+        !sigs_inside(h, sm->next, (uint64_t)sm->ncomb * 4) ||
+        !sigs_inside(h, sm->check, (uint64_t)sm->ncomb * 4))
+    {
+        return (-1);
+    }
+    base  = (uint32_t *)(image + sm->base);
+    def   = (uint32_t *)(image + sm->def);
+    next  = (uint32_t *)(image + sm->next);
+    check = (uint32_t *)(image + sm->check);
+    for (k = 0; k < s; k++)
+    {
+        /** defaults only go down, to the start state which has every byte */
+        if (base[k] > sm->ncomb - 256 || (k && def[k] >= k && 
+            (def[k] != SRCH_EMPTY || sm->anchored == 0)))
+        {
+            return (-1);
+        }
+    }
+    for (c = 0; c < 256; c++)
+    {
+        if (check[base[0] + c] != SRCH_START)
+        {
+            return (-1);
+        }
+    }
+    for (k = 0; k < sm->ncomb; k++)
+    {
+        if (check[k] == SRCH_EMPTY)
+        {
+            continue;
+        }
+        if (check[k] >= s ||
+            (next[k] >= s && (next[k] != SRCH_DEAD || sm->anchored == 0)))
+        {
+            return (-1);
+        }
+    }
+    return (1);
+}
+
+/** is fname a signature image? */
+int
+sigs_probe(char *fname)
+{
+    int fd, n;
+    char magic[8];
+
+    fd = open(fname, O_RDONLY);
+    if (fd == -1)
+    {
+        return (0);
+    }
+    n = read(fd, magic, sizeof (magic)) == sizeof (magic) &&
+        memcmp(magic, SIGS_MAGIC, sizeof (magic)) == 0;
+    close(fd);
+
+    return (n);
+}
+
+/*
+ * map a signature image if that's what fname is.  returns 1 if it was
+ * loaded, 0 if it's not an image (so it's a config file) and -1 if it's
+ * an image we can't use.
+ */
+int
+sigs_load(srch_set_t *set, char *fname)
+{
+    int fd, i;
+    uint8_t *base;
+    uint32_t j, s, c, *table;
+    srch_machine_t *m;
+    srch_match_t *matches;
+    struct stat st;
+    struct sigs_header *h;
+    struct sigs_fileid *f;
+    char magic[sizeof (h->magic)];
+
+    fd = open(fname, O_RDONLY);
+    if (fd == -1)
+    {
+        /** let the config file code complain */
+        return (0);
+    }
+    if (read(fd, magic, sizeof (magic)) != sizeof (magic) ||
+        memcmp(magic, SIGS_MAGIC, sizeof (magic)))
+    {
+        close(fd);
+        return (0);
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof (struct sigs_header))
+    {
+        fprintf(stderr, "%s: truncated signature image\n", fname);
+        close(fd);
+        return (-1);
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "can't map %s: %s\n", fname, strerror(errno));
+        return (-1);
+    }
+    h = (struct sigs_header *)base;
+    if (h->bom != SIGS_BOM || h->version != SIGS_VERSION)
+    {
+        fprintf(stderr, "%s: signature image is version %d, need %d, "
+            "recompile it with --compile-sigs\n", fname,
+            h->bom == SIGS_BOM ? h->version : -1, SIGS_VERSION);
+        goto bad;
+    }
+    if (h->size != (uint64_t)st.st_size ||
+        h->nprofiles == 0 || h->nprofiles > SRCH_PROFILE_MAX ||
+        !sigs_inside(h, h->fileids,
+            (uint64_t)h->nfileids * sizeof (struct sigs_fileid)))
+    {
+        goto corrupt;
+    }
+
+    /** check everything we'll follow at runtime is in bounds */
+    f = (struct sigs_fileid *)(base + h->fileids);
+    for (j = 0; j < h->nfileids; j++)
+    {
+        if (f[j].id != j || f[j].ext >= h->size ||
+            f[j].profile >= h->nprofiles || (f[j].rate && f[j].burst == 0) ||
+            f[j].commit > EXTRACT_COMMIT_MAX ||
+            memchr(base + f[j].ext, '\0', h->size - f[j].ext) == NULL)
+        {
+            goto corrupt;
+        }
+    }
+    for (i = 0; i < SIGS_MACHINES; i++)
+    {
+        if (h->machine[i].present == 0)
+        {
+            continue;
+        }
+        s = h->machine[i].nstates;
+        if (s == 0 || h->machine[i].nmatches == 0 ||
+            !sigs_inside(h, h->machine[i].match, (uint64_t)s * 4) ||
+            !sigs_inside(h, h->machine[i].matches,
+                (uint64_t)h->machine[i].nmatches * sizeof (srch_match_t)) ||
+            sigs_check(h, &(h->machine[i]), base) == -1)
+        {
+            goto corrupt;
+        }
+        table = (uint32_t *)(base + h->machine[i].match);
+        for (c = 0; c < s; c++)
+        {
+            if (table[c] > h->machine[i].nmatches)
+            {
+                goto corrupt;
+            }
+        }
+        matches = (srch_match_t *)(base + h->machine[i].matches);
+        for (c = 0; c < h->machine[i].nmatches; c++)
+        {
+            if (matches[c].fileid >= h->nfileids ||
+                matches[c].spectype > FOOTER)
+            {
+                goto corrupt;
+            }
+        }
+        if (matches[h->machine[i].nmatches - 1].last == 0)
+        {
+            goto corrupt;
+        }
+    }
+
+    /** it's good, rebuild the fileid table and point the machines at it */
+    set->fileids   = ecalloc(h->nfileids, sizeof (fileid_t *));
+    set->nfileids  = h->nfileids;
+    set->nprofiles = h->nprofiles;
+    for (j = 0; j < h->nprofiles; j++)
+    {
+        snprintf(set->profile[j], SRCH_PROFILE_NAME, "%.*s", 
+            SRCH_PROFILE_NAME - 1, h->profile[j]);
+    }
+    for (j = 0; j < h->nfileids; j++)
+    {
+        set->fileids[j]          = ecalloc(1, sizeof (fileid_t));
+        set->fileids[j]->id      = f[j].id;
+        set->fileids[j]->ext     = strdup((char *)base + f[j].ext);
+        set->fileids[j]->maxlen  = f[j].maxlen;
+        set->fileids[j]->window  = f[j].window;
+        set->fileids[j]->anchor  = f[j].anchor;
+        set->fileids[j]->profile = f[j].profile;
+        set->fileids[j]->max      = f[j].max;
+        set->fileids[j]->rate     = f[j].rate;
+        set->fileids[j]->burst    = f[j].burst;
+        set->fileids[j]->priority = f[j].priority;
+        set->fileids[j]->commit   = f[j].commit;
+        if (f[j].flags & SIGS_VALIDATE)
+        {
+            set->fileids[j]->validate = validate_lookup(set->fileids[j]->ext);
+        }
+        set->fileids[j]->footer     = (f[j].flags & SIGS_FOOTER) != 0;
+        set->fileids[j]->nothrottle = (f[j].flags & SIGS_NOTHROTTLE) != 0;
+        set->fileids[j]->nopack     = (f[j].flags & SIGS_NOPACK) != 0;
+        if (f[j].flags & SIGS_RESOLVE)
+        {
+            set->fileids[j]->resolve = resolve_lookup(set->fileids[j]->ext);
+        }
+    }
+    for (i = 0; i < SIGS_MACHINES; i++)
+    {
+        if (h->machine[i].present == 0)
+        {
+            continue;
+        }
+        m = ecalloc(1, sizeof (srch_machine_t));
+        m->mapped   = 1;
+        m->anchored = h->machine[i].anchored;
+        m->nstates  = h->machine[i].nstates;
+        m->nmatches = h->machine[i].nmatches;
+        if (h->machine[i].ncomb == 0)
+        {
+            m->table = (uint32_t (*)[256])(base + h->machine[i].table);
+        }
+        else
+        {
+            m->ncomb = h->machine[i].ncomb;
+            m->base  = (uint32_t *)(base + h->machine[i].base);
+            m->def   = (uint32_t *)(base + h->machine[i].def);
+            m->next  = (uint32_t *)(base + h->machine[i].next);
+            m->check = (uint32_t *)(base + h->machine[i].check);
+        }
+        m->match    = (uint32_t *)(base + h->machine[i].match);
+        m->matches  = (srch_match_t *)(base + h->machine[i].matches);
+        for (c = 0; c < m->nmatches; c++)
+        {
+            m->maxlen = MAX(m->maxlen, m->matches[c].len);
+        }
+        m->fileids  = set->fileids;
+        *sigs_machine(set, i) = m;
+    }
+    set->anch_depth = h->anch_depth;
+    set->image      = base;
+    set->image_size = h->size;
+
+    printf("mapped %d file types from signature image %s\n", set->nfileids,
+        fname);
+    return (1);
+
+corrupt:
+    fprintf(stderr, "%s: corrupt signature image\n", fname);
+bad:
+    munmap(base, st.st_size);
+    return (-1);
+}
+
+/** EOF */
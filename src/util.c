@@ -32,6 +32,7 @@
 #include "nfex.h"
 #include <stdarg.h>
 #include <math.h>
+#include <dirent.h>
 
 void
 fprintip(FILE *stream, uint32_t ip, ncc_t *ncc)
@@ -109,6 +110,20 @@ ecalloc(size_t nmemb, size_t size)
     return (p);
 }
 
+void *
+erealloc(void *ptr, size_t size)
+{
+    void *p = realloc(ptr, size);
+
+    if (p == NULL)
+    {
+        perror("Error in function erealloc()");
+        exit(0);
+    }
+
+    return (p);
+}
+
 void
 error(char *msg)
 {
@@ -141,6 +156,82 @@ u_int32_t *s)
     *s -= 60 * (*m);
 }
 
+/** how much memory we have resident (in KB) and how many fds are open */
+void
+proc_usage(long *rss, int *fds)
+{
+    int fd, n;
+    long max, pages;
+    DIR *dir;
+    FILE *fp;
+    struct dirent *de;
+    struct rusage ru;
+
+    /** right now if /proc has it, a leak that's freed and redone shows */
+    fp = fopen("/proc/self/statm", "r");
+    if (fp && fscanf(fp, "%*s %ld", &pages) == 1)
+    {
+        *rss = pages * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+    else
+    {
+        /** otherwise the most we've ever had */
+        *rss = getrusage(RUSAGE_SELF, &ru) == -1 ? 0 : ru.ru_maxrss;
+    }
+    if (fp)
+    {
+        fclose(fp);
+    }
+    dir  = opendir("/proc/self/fd");
+    if (dir)
+    {
+        /** one entry per open fd, less ., .. and the one reading it */
+        for (n = 0; (de = readdir(dir)); )
+        {
+            if (de->d_name[0] != '.' && atoi(de->d_name) != dirfd(dir))
+            {
+                n++;
+            }
+        }
+        closedir(dir);
+        *fds = n;
+        return;
+    }
+    /** no /proc, probe them one at a time */
+    max = sysconf(_SC_OPEN_MAX);
+    for (fd = 0, n = 0; fd < max; fd++)
+    {
+        if (fcntl(fd, F_GETFD) != -1)
+        {
+            n++;
+        }
+    }
+    *fds = n;
+}
+
+/** make every directory in path past the first from bytes, like mkdir -p */
+int
+mkpath(char *path, size_t from)
+{
+    char *p;
+
+    for (p = path + from; *p; p++)
+    {
+        if (*p != '/' || p == path)
+        {
+            continue;
+        }
+        *p = '\0';
+        if (mkdir(path, S_IRWXU|S_IRWXG|S_IRWXO) == -1 && errno != EEXIST)
+        {
+            *p = '/';
+            return (-1);
+        }
+        *p = '/';
+    }
+    return (1);
+}
+
 /** modified from tcpdump.c */
 void
 build_bpf_filter(register char **argv, char **buf)
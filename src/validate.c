@@ -0,0 +1,301 @@
+/*
+ * validate.c - file format validation
+ *
+ * 2009, 2010 Mike Schiffman <mschiffm@cisco.com>
+ *
+ * Copyright (c) 2010 by Cisco Systems, Inc.
+ * All rights reserved.
+ */
+
+#include <ctype.h>
+#include "nfex.h"
+#include "validate.h"
+
+/*
+ * a HEADER match is only a guess.  these look a little deeper into the
+ * first bytes of a candidate to decide if it really is what the HEADER
+ * says it is before we spend any I/O on it.  each one gets the bytes from
+ * the start of the match and returns VALIDATE_MORE until it's seen enough.
+ */
+
+#define LE16(p) ((uint16_t)((p)[0] | (p)[1] << 8))
+#define LE32(p) ((uint32_t)((p)[0] | (p)[1] << 8 | (p)[2] << 16 |           \
+                 (uint32_t)(p)[3] << 24))
+#define BE16(p) ((uint16_t)((p)[0] << 8 | (p)[1]))
+#define BE32(p) ((uint32_t)((uint32_t)(p)[0] << 24 | (p)[1] << 16 |         \
+                 (p)[2] << 8 | (p)[3]))
+
+static validator_t validators[] =
+{
+    {"exe",  validate_pe},
+    {"dll",  validate_pe},
+    {"pdf",  validate_pdf},
+    {"zip",  validate_zip},
+    {"png",  validate_png},
+    {"jpg",  validate_jpg},
+    {"jpeg", validate_jpg},
+    {"gif",  validate_gif},
+    {NULL,   NULL}
+};
+
+/** find the validator for a file extension, NULL if there isn't one */
+validate_t
+validate_lookup(char *ext)
+{
+    int i;
+
+    for (i = 0; validators[i].ext; i++)
+    {
+        if (strcasecmp(validators[i].ext, ext) == 0)
+        {
+            return (validators[i].check);
+        }
+    }
+    return (NULL);
+}
+
+/** DOS stub, then "PE\0\0" where e_lfanew says it should be */
+static int
+validate_pe(const uint8_t *data, size_t len)
+{
+    uint32_t e_lfanew;
+
+    if (len < 0x40)
+    {
+        return (VALIDATE_MORE);
+    }
+    if (data[0] != 'M' || data[1] != 'Z')
+    {
+        return (VALIDATE_BAD);
+    }
+    e_lfanew = LE32(data + 0x3c);
+    if (e_lfanew < 4 || e_lfanew > VALIDATE_MAX - 4)
+    {
+        return (VALIDATE_BAD);
+    }
+    if (len < e_lfanew + 4)
+    {
+        return (VALIDATE_MORE);
+    }
+    if (memcmp(data + e_lfanew, "PE\0\0", 4))
+    {
+        return (VALIDATE_BAD);
+    }
+    return (VALIDATE_OK);
+}
+
+/** "%PDF-" and a version number */
+static int
+validate_pdf(const uint8_t *data, size_t len)
+{
+    if (len < 8)
+    {
+        return (VALIDATE_MORE);
+    }
+    if (memcmp(data, "%PDF-", 5) || !isdigit(data[5]) || data[6] != '.' ||
+        !isdigit(data[7]))
+    {
+        return (VALIDATE_BAD);
+    }
+    return (VALIDATE_OK);
+}
+
+/** a sane local file header with a sane file name */
+static int
+validate_zip(const uint8_t *data, size_t len)
+{
+    uint16_t method, namelen;
+    size_t i;
+
+    if (len < 30)
+    {
+        return (VALIDATE_MORE);
+    }
+    if (memcmp(data, "PK\x03\x04", 4) || (LE16(data + 4) & 0xff) > 63)
+    {
+        return (VALIDATE_BAD);
+    }
+    method = LE16(data + 8);
+    switch (method)
+    {
+        case 0:         /* stored */
+        case 1:         /* shrunk */
+        case 6:         /* imploded */
+        case 8:         /* deflated */
+        case 9:         /* deflate64 */
+        case 12:        /* bzip2 */
+        case 14:        /* lzma */
+        case 93:        /* zstd */
+        case 95:        /* xz */
+        case 98:        /* ppmd */
+        case 99:        /* aes encrypted */
+            break;
+        default:
+            return (VALIDATE_BAD);
+    }
+    namelen = LE16(data + 26);
+    if (namelen == 0 || namelen > VALIDATE_MAX - 30)
+    {
+        return (VALIDATE_BAD);
+    }
+    if (len < 30 + (size_t)namelen)
+    {
+        return (VALIDATE_MORE);
+    }
+    for (i = 30; i < 30 + (size_t)namelen; i++)
+    {
+        if (data[i] < 0x20)
+        {
+            return (VALIDATE_BAD);
+        }
+    }
+    return (VALIDATE_OK);
+}
+
+/*
+ * signature followed by a well formed IHDR.  the stock config matches
+ * from "PNG" rather than the leading 0x89 so either is accepted.
+ */
+static int
+validate_png(const uint8_t *data, size_t len)
+{
+    const uint8_t *ihdr;
+    size_t o;
+
+    o = (len && data[0] == 0x89) ? 1 : 0;
+    if (len < o + 7 + 25)
+    {
+        return (VALIDATE_MORE);
+    }
+    if (memcmp(data + o, "PNG\r\n\x1a\n", 7))
+    {
+        return (VALIDATE_BAD);
+    }
+    ihdr = data + o + 7;
+    if (BE32(ihdr) != 13 || memcmp(ihdr + 4, "IHDR", 4))
+    {
+        return (VALIDATE_BAD);
+    }
+    if (BE32(ihdr + 8) == 0 || BE32(ihdr + 8) > 0x7fffffff ||
+        BE32(ihdr + 12) == 0 || BE32(ihdr + 12) > 0x7fffffff)
+    {
+        return (VALIDATE_BAD);
+    }
+    switch (ihdr[16])
+    {
+        case 1: case 2: case 4: case 8: case 16:
+            break;
+        default:
+            return (VALIDATE_BAD);
+    }
+    switch (ihdr[17])
+    {
+        case 0: case 2: case 3: case 4: case 6:
+            break;
+        default:
+            return (VALIDATE_BAD);
+    }
+    if (ihdr[18] != 0 || ihdr[19] != 0 || ihdr[20] > 1)
+    {
+        return (VALIDATE_BAD);
+    }
+    return (VALIDATE_OK);
+}
+
+/*
+ * walk the marker segments after SOI until a frame or scan header shows
+ * up.  segments that run past what we hold (big EXIF blocks) are taken
+ * on faith.
+ */
+static int
+validate_jpg(const uint8_t *data, size_t len)
+{
+    size_t pos;
+    uint8_t marker;
+
+    if (len < 3)
+    {
+        return (VALIDATE_MORE);
+    }
+    if (data[0] != 0xff || data[1] != 0xd8 || data[2] != 0xff)
+    {
+        return (VALIDATE_BAD);
+    }
+    for (pos = 2; ; )
+    {
+        if (pos + 4 > len)
+        {
+            return (pos + 4 > VALIDATE_MAX ? VALIDATE_OK : VALIDATE_MORE);
+        }
+        if (data[pos] != 0xff)
+        {
+            return (VALIDATE_BAD);
+        }
+        marker = data[pos + 1];
+        if (marker == 0xff)
+        {
+            /** fill byte */
+            pos++;
+            continue;
+        }
+        if (marker < 0xc0 || marker == 0xd8 || marker == 0xd9)
+        {
+            return (VALIDATE_BAD);
+        }
+        if (marker >= 0xd0 && marker <= 0xd7)
+        {
+            /** restart markers have no length */
+            pos += 2;
+            continue;
+        }
+        if (BE16(data + pos + 2) < 2)
+        {
+            return (VALIDATE_BAD);
+        }
+        if (marker == 0xda || (marker >= 0xc0 && marker <= 0xcf &&
+            marker != 0xc4 && marker != 0xc8 && marker != 0xcc))
+        {
+            /** SOS or SOFn */
+            return (VALIDATE_OK);
+        }
+        pos += 2 + BE16(data + pos + 2);
+    }
+}
+
+/** logical screen descriptor, color table, then a block introducer */
+static int
+validate_gif(const uint8_t *data, size_t len)
+{
+    size_t n;
+
+    if (len < 13)
+    {
+        return (VALIDATE_MORE);
+    }
+    if (memcmp(data, "GIF8", 4) || (data[4] != '7' && data[4] != '9') ||
+        data[5] != 'a')
+    {
+        return (VALIDATE_BAD);
+    }
+    if (LE16(data + 6) == 0 || LE16(data + 8) == 0)
+    {
+        return (VALIDATE_BAD);
+    }
+    n = 13;
+    if (data[10] & 0x80)
+    {
+        /** global color table */
+        n += 3 << ((data[10] & 0x07) + 1);
+    }
+    if (len < n + 1)
+    {
+        return (VALIDATE_MORE);
+    }
+    if (data[n] != 0x2c && data[n] != 0x21 && data[n] != 0x3b)
+    {
+        return (VALIDATE_BAD);
+    }
+    return (VALIDATE_OK);
+}
+
+/** EOF */